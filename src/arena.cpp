@@ -0,0 +1,122 @@
+/*
+ * Buffer arena for AudioGraph
+ *
+ * See arena.h.
+ */
+
+#include <new>
+#include <string.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
+#include "arena.h"
+
+
+static void* AlignedAlloc(size_t bytes, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(bytes, alignment);
+#else
+	void* block = NULL;
+	return (posix_memalign(&block, alignment, bytes) == 0) ? block : NULL;
+#endif
+}
+
+
+static void AlignedFree(void* block)
+{
+#ifdef _WIN32
+	_aligned_free(block);
+#else
+	free(block);
+#endif
+}
+
+
+Arena::Arena() :
+	cursor(NULL),
+	remaining(0),
+	reserved(0)
+{
+}
+
+
+Arena::~Arena()
+{
+	for (size_t i = 0; i < blocks.size(); i++)
+		AlignedFree(blocks[i]);
+}
+
+
+/*
+ * Arena::NewBlock
+ *
+ * Allocate a block of at least the given size and record it for freeing.
+ * Must be called with the mutex held.
+ */
+uint8_t* Arena::NewBlock(size_t& size)
+{
+	size_t alignment = ARENA_ALIGNMENT;
+	if (size >= ARENA_HUGE_PAGE)
+	{
+		if (size > SIZE_MAX - (ARENA_HUGE_PAGE - 1))
+			throw std::bad_alloc();
+		size = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+		alignment = ARENA_HUGE_PAGE;
+	}
+	blocks.reserve(blocks.size() + 1);
+	void* block = AlignedAlloc(size, alignment);
+	if (!block)
+		throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+	if (alignment == ARENA_HUGE_PAGE)
+		madvise(block, size, MADV_HUGEPAGE);
+#endif
+	blocks.push_back(block);
+	reserved += size;
+	return (uint8_t*)block;
+}
+
+
+/*
+ * Arena::Carve
+ *
+ * Get zeroed memory for a buffer of the given size, padded and aligned as
+ * described in arena.h.  Only the bytes handed out are zeroed, so the rest
+ * of a block is not touched until it is used.  Throws std::bad_alloc if the
+ * system is out of memory, as new[] would.
+ */
+void* Arena::Carve(size_t bytes)
+{
+	size_t needed = (bytes + ARENA_PADDING + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+	if (needed < bytes)
+		throw std::bad_alloc();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	void* buffer;
+	if (needed > ARENA_BLOCK)
+	{
+		// A block of its own, so the shared block keeps its free space.
+		size_t size = needed;
+		buffer = NewBlock(size);
+	}
+	else
+	{
+		if (needed > remaining)
+		{
+			size_t size = ARENA_BLOCK;
+			cursor = NewBlock(size);
+			remaining = size;
+		}
+		buffer = cursor;
+		cursor += needed;
+		remaining -= needed;
+	}
+	memset(buffer, 0, needed);
+	return buffer;
+}
@@ -0,0 +1,60 @@
+/*
+ * Buffer arena for AudioGraph
+ *
+ * Every buffer of an AudioGraph instance is carved from one arena, and freed
+ * with it.  Buffers start on a 64 byte (cache line) boundary and are followed
+ * by at least ARENA_PADDING bytes that belong to no other buffer, so an SIMD
+ * kernel may load or store a whole vector past the end of its data.  The
+ * memory is zeroed.
+ *
+ * Small buffers share blocks of ARENA_BLOCK bytes, so an instance with few
+ * buffers only commits what it uses.  A buffer bigger than that gets a block
+ * of its own; if that is a huge page or more, it is aligned to one and, where
+ * the system supports it (Linux transparent huge pages), advised to be backed
+ * by huge pages, so that big caches need few TLB entries.
+ *
+ * A request that is out of memory, or whose size does not fit a size_t,
+ * throws std::bad_alloc, as new[] would.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#define ARENA_ALIGNMENT 64
+#define ARENA_PADDING 64
+#define ARENA_BLOCK ((size_t)64 << 10)
+#define ARENA_HUGE_PAGE ((size_t)2 << 20)
+
+class Arena
+{
+public:
+	Arena();
+	~Arena();
+	template<class T>
+	T* Allocate(size_t count)
+	{
+		if (count > SIZE_MAX / sizeof(T))
+			throw std::bad_alloc();
+		return (T*)Carve(count * sizeof(T));
+	}
+	size_t Size() const { return reserved; }
+private:
+	Arena(const Arena&);
+	Arena& operator=(const Arena&);
+	void* Carve(size_t bytes);
+	uint8_t* NewBlock(size_t& size);
+
+	std::mutex mutex;
+	std::vector<void*> blocks;
+	uint8_t* cursor;
+	size_t remaining;
+	size_t reserved;
+};
+
+#endif //__ARENA_H__
@@ -27,6 +27,84 @@
  *	 _graph_scale			The vertical scale factor. Set to 0 to enable auto-scale
  *	 _middle_colour			The graph colour for the current frame
  *	 _side_colour			The graph colour for the frames on either side of the current
+ *	 mode					"wave" (default) graphs the waveform, "correlation" graphs the
+ *							phase correlation of the first two channels (+1 at the top,
+ *							-1 at the bottom)
+ *							"bands" colours the waveform by the balance of low (red),
+ *							mid (green) and high (blue) frequency energy
+ *							"mel" and "cqt" draw a mel or constant-Q spectrogram, low
+ *							frequencies at the bottom
+ *	 goniometer				Draw a goniometer (Lissajous) inset for the current frame
+ *	 onsets					Mark detected onsets (transients) with ticks at the top and
+ *							bottom of the frame
+ *	 vad					Draw a voice activity lane along the bottom of the frame
+ *	 vad_file				If set, write the speech segments of the whole clip to this
+ *							file (first frame, last frame, start and end in seconds)
+ *	 labels					"none" (default), "frames" or "timecode" labels the audioframe
+ *							boundaries along the top, and adds level (or frequency) labels
+ *							to the Y axis
+ *	 grid					Draw a grid: ticks at the audioframe boundaries, a line at the
+ *							start of each second and level reference lines (centre, -6 and
+ *							-12 dB)
+ *	 db						Graph the level on a dB scale, so that quiet passages stay visible
+ *							(graph_scale is ignored)
+ *	 db_floor				The level at the centre line with db=true (default -60)
+ *	 db_ceiling				The level at the top and bottom with db=true (default 0)
+ *	 colour_by				"frame" (default) uses middle_colour and side_colour per frame,
+ *							"amplitude" colours the waveform from side_colour (quiet) through
+ *							middle_colour to red (full scale), "distance" fades from
+ *							middle_colour at the current frame to side_colour at the edges
+ *							(not used by bands mode)
+ *	 latency_budget_ms		For live preview: if set, GetFrame spends at most about this
+ *							long generating missing audioframes (the current frame is always
+ *							generated).  The rest are drawn as a flat line and generated
+ *							first on the next frames, so they appear in full on later frames.
+ *							The frames are then not cached by AviSynth.
+ *							0 (default) disables the budget.
+ *	 minimap				Draw an overview of the whole clip's waveform along the bottom,
+ *							with a playhead at the current frame
+ *	 vfr					Variable frame rate: take each frame's duration from its
+ *							_DurationNum / _DurationDen properties (AviSynth+ 3.6 or later)
+ *							instead of the clip frame rate
+ *	 timecodes				Variable frame rate: take frame start times from this v2
+ *							timecode file (implies vfr)
+ *	 offset_samples			Shift the audio against the video by this many samples: positive
+ *							values graph later audio at each frame (default 0).  Instances
+ *							on the same clip share the cached waveform sums, so trying
+ *							several offsets does not read the audio again
+ *	 working_rate			Decimate very high rate audio by halving, down to the lowest rate
+ *							that is still at least this many Hz, before any graph is computed
+ *							(0 = off, the default).  The clip's own audio is passed through
+ *							undecimated.  offset_samples stays in source samples
+ *	 threads				The most threads to use at once for one frame: spectrogram columns
+ *							are computed on a thread pool shared by all instances.  Reading
+ *							and reducing the audio stays on the thread GetFrame is called on.
+ *							0 (default) uses the AUDIOGRAPH_THREADS environment variable, or
+ *							else one thread per core.  The pool itself is sized by the first
+ *							instance that needs it
+ *	 peaks_file				Keep the minimap's peak index in this file (implies minimap): it is read
+ *							instead of the audio when it matches the clip's rate and channel count,
+ *							and written when it does not exist yet.  The audiograph-peaks tool
+ *							built by CMakeLists.txt writes the same files from WAV or raw PCM
+ *	 layer_cache_mb			Keep the finished overlay of recently shown frames, up to this many MB,
+ *							so that showing a frame again only copies it over the video, with no
+ *							audio work (0 = off, the default).  Frames drawn with latency budget
+ *							placeholders are not kept
+ *	 paged					Show the frames a page at a time: the graph stays still while a
+ *							playhead moves across it, and turns to the next page at the right
+ *							edge.  The graph of a page is drawn once and reused for each of
+ *							its frames, so the current frame is not highlighted and
+ *							colour_by "distance" colours like "frame"
+ *	 dropouts				Mark suspected dropouts behind the graph: gaps of exact zeros,
+ *							repeated 5, 10 or 20 ms stretches and step discontinuities.
+ *							With frame properties the whole clip is also indexed, as with
+ *							dropout_file
+ *	 dropout_file			If set, scan the whole clip for dropouts and write the suspect
+ *							regions to this file (first frame, last frame, start and end in
+ *							seconds, kinds).  Every frame then gets the first frames of the
+ *							nearest regions before and after it as the AudioGraph_DropoutPrevious
+ *							and AudioGraph_DropoutNext properties (-1 if none), so that a
+ *							script can jump between them
  * 
  * The effect of the frames_either_side parameter is perhaps better explained
  * by this table:
@@ -62,9 +140,413 @@
  */
 
 #include <windows.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "avisynth.h"
+#include "arena.h"
+#include "audioqc.h"
 #include "convertaudio.h"
+#include "decimator.h"
+#include "dropouts.h"
+#include "engine/channels.h"
+#include "engine/engine.h"
+#include "engine/peakfile.h"
+#include "engine/peaks.h"
+#include "fft.h"
+#include "filterbank.h"
+#include "frameprops.h"
+#include "glyphs.h"
+#include "layercache.h"
+#include "overlay.h"
+#include "sumcache.h"
+#include "threadpool.h"
+#include "vad.h"
+
+/*
+ * Overlays such as the goniometer inset are drawn through a Canvas, which
+ * hides the differences between the supported pixel layouts.  Colours are
+ * converted to a PixelColour once, so that drawing a pixel is only a couple of
+ * byte stores.  y = 0 is the top row of the picture for every layout.
+ */
+struct PixelColour
+{
+	uint8_t c[4];
+};
+
+
+struct Canvas
+{
+	enum Layout { PACKED_RGB, PACKED_YUY2, PLANAR };
+
+	Canvas(const VideoInfo& vi, PVideoFrame& frame);
+	Canvas(const VideoInfo& vi, uint8_t* buffer, int _height);
+	void Put(int x, int y, const PixelColour& colour);
+	uint8_t* Row(int plane, int y) const;
+
+	Layout layout;
+	uint8_t* planes[4];
+	int pitches[4];
+	int num_planes;
+	int bytes_per_pixel;
+	int width, height;
+};
+
+
+Canvas::Canvas(const VideoInfo& vi, PVideoFrame& frame) :
+	num_planes(1),
+	bytes_per_pixel(vi.BytesFromPixels(1)),
+	width(vi.width),
+	height(vi.height)
+{
+	static const int yuv_planes[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+	static const int rgb_planes[] = { PLANAR_G, PLANAR_B, PLANAR_R, PLANAR_A };
+
+	if (vi.IsYV24())
+	{
+		layout = PLANAR;
+		num_planes = 3;
+		for (int p = 0; p < num_planes; p++)
+		{
+			planes[p] = frame->GetWritePtr(yuv_planes[p]);
+			pitches[p] = frame->GetPitch(yuv_planes[p]);
+		}
+	}
+	else if (vi.IsPlanarRGB() || vi.IsPlanarRGBA())
+	{
+		layout = PLANAR;
+		num_planes = (vi.IsPlanarRGBA()) ? 4 : 3;
+		for (int p = 0; p < num_planes; p++)
+		{
+			planes[p] = frame->GetWritePtr(rgb_planes[p]);
+			pitches[p] = frame->GetPitch(rgb_planes[p]);
+		}
+	}
+	else
+	{
+		layout = (vi.IsYUY2()) ? PACKED_YUY2 : PACKED_RGB;
+		planes[0] = frame->GetWritePtr();
+		pitches[0] = frame->GetPitch();
+	}
+}
+
+
+/*
+ * A Canvas over a private picture in the clip's pixel format, _height rows
+ * high, with its planes one after the other in buffer.  The buffer must hold
+ * PictureSize(vi, _height) bytes.
+ */
+static inline int PictureSize(const VideoInfo& vi, int height)
+{
+	int num_planes = (vi.IsYV24() || vi.IsPlanarRGB()) ? 3 : (vi.IsPlanarRGBA()) ? 4 : 1;
+	return vi.BytesFromPixels(vi.width) * height * num_planes;
+}
+
+
+Canvas::Canvas(const VideoInfo& vi, uint8_t* buffer, int _height) :
+	num_planes(1),
+	bytes_per_pixel(vi.BytesFromPixels(1)),
+	width(vi.width),
+	height(_height)
+{
+	if (vi.IsYV24() || vi.IsPlanarRGB() || vi.IsPlanarRGBA())
+	{
+		layout = PLANAR;
+		num_planes = (vi.IsPlanarRGBA()) ? 4 : 3;
+	}
+	else
+		layout = (vi.IsYUY2()) ? PACKED_YUY2 : PACKED_RGB;
+	for (int p = 0; p < num_planes; p++)
+	{
+		pitches[p] = vi.BytesFromPixels(vi.width);
+		planes[p] = buffer + p * pitches[p] * height;
+	}
+}
+
+
+/*
+ * The planes of a canvas as the layer cache sees them: rows in memory order,
+ * so packed RGB is not flipped.
+ */
+static LayerPlanes CanvasPlanes(const Canvas& canvas)
+{
+	LayerPlanes planes;
+	planes.num_planes = canvas.num_planes;
+	for (int p = 0; p < canvas.num_planes; p++)
+	{
+		planes.planes[p] = canvas.planes[p];
+		planes.pitches[p] = canvas.pitches[p];
+	}
+	planes.row_size = canvas.width * canvas.bytes_per_pixel;
+	planes.height = canvas.height;
+	return planes;
+}
+
+
+/*
+ * The start of picture row y of a plane.
+ */
+inline uint8_t* Canvas::Row(int plane, int y) const
+{
+	// Packed RGB is stored bottom-up.
+	if (layout == PACKED_RGB)
+		y = height - 1 - y;
+	return planes[plane] + y * pitches[plane];
+}
+
+
+inline void Canvas::Put(int x, int y, const PixelColour& colour)
+{
+	switch (layout)
+	{
+	case PLANAR:
+		for (int p = 0; p < num_planes; p++)
+			planes[p][y * pitches[p] + x] = colour.c[p];
+		break;
+	case PACKED_YUY2:
+	{
+		uint8_t* dstp = planes[0] + y * pitches[0] + (x >> 1) * 4;
+		dstp[(x & 1) * 2] = colour.c[0];
+		dstp[1] = colour.c[1];
+		dstp[3] = colour.c[2];
+		break;
+	}
+	default:
+	{
+		// Packed RGB is stored bottom-up.
+		uint8_t* dstp = planes[0] + (height - 1 - y) * pitches[0] + x * bytes_per_pixel;
+		for (int b = 0; b < bytes_per_pixel; b++)
+			dstp[b] = colour.c[b];
+		break;
+	}
+	}
+}
+
+
+/*
+ * Pixel writers for AudioGraph::DrawSpectrum and AudioGraph::DrawOverlay, one
+ * per pixel layout.  They take the same coordinates and colours as Canvas,
+ * but with the layout fixed at compile time.  In YUY2 Put writes both pixels
+ * of a pair, which makes the spectrogram a bit blocky but avoids chroma
+ * fringes; PutSingle writes one pixel, as Canvas::Put does.
+ */
+template<int bytes_per_pixel>
+struct PackedRGBWriter
+{
+	PackedRGBWriter(const Canvas& canvas) :
+		bottom(canvas.planes[0] + (canvas.height - 1) * canvas.pitches[0]),
+		pitch(canvas.pitches[0])
+	{
+	}
+
+	inline void Put(int x, int y, const PixelColour& colour)
+	{
+		memcpy(bottom - y * pitch + x * bytes_per_pixel, colour.c, bytes_per_pixel);
+	}
+
+	inline void PutSingle(int x, int y, const PixelColour& colour)
+	{
+		Put(x, y, colour);
+	}
+
+	uint8_t* bottom;
+	int pitch;
+};
+
+
+struct YUY2Writer
+{
+	YUY2Writer(const Canvas& canvas) :
+		base(canvas.planes[0]),
+		pitch(canvas.pitches[0])
+	{
+	}
+
+	inline void Put(int x, int y, const PixelColour& colour)
+	{
+		uint8_t* dstp = base + y * pitch + (x >> 1) * 4;
+		dstp[0] = dstp[2] = colour.c[0];
+		dstp[1] = colour.c[1];
+		dstp[3] = colour.c[2];
+	}
+
+	inline void PutSingle(int x, int y, const PixelColour& colour)
+	{
+		uint8_t* dstp = base + y * pitch + (x >> 1) * 4;
+		dstp[(x & 1) * 2] = colour.c[0];
+		dstp[1] = colour.c[1];
+		dstp[3] = colour.c[2];
+	}
+
+	uint8_t* base;
+	int pitch;
+};
+
+
+template<int num_planes>
+struct PlanarWriter
+{
+	PlanarWriter(const Canvas& canvas) :
+		pitch(canvas.pitches[0])
+	{
+		for (int p = 0; p < num_planes; p++)
+			planes[p] = canvas.planes[p];
+	}
+
+	inline void Put(int x, int y, const PixelColour& colour)
+	{
+		int offset = y * pitch + x;
+		for (int p = 0; p < num_planes; p++)
+			planes[p][offset] = colour.c[p];
+	}
+
+	inline void PutSingle(int x, int y, const PixelColour& colour)
+	{
+		Put(x, y, colour);
+	}
+
+	uint8_t* planes[num_planes];
+	int pitch;
+};
+
+
+/*
+ * Onset detection: the flux threshold is ONSET_RATIO times the mean flux of
+ * the previous ONSET_MEAN_HOPS hops, plus ONSET_DELTA (per FFT bin).
+ */
+#define ONSET_MEAN_HOPS 8
+#define ONSET_RATIO 1.5f
+#define ONSET_DELTA 0.05f
+#define MAX_ONSETS_PER_FRAME 16
+
+/*
+ * The dB scale lookup table has one entry per 16-bit sample magnitude.
+ */
+#define DB_LUT_SIZE 32768
+
+/*
+ * Variable frame rate: the frame index is built FRAME_INDEX_BLOCK frames at a
+ * time, and an audioframe may be at most VFR_MAX_FRAME_LENGTH times the
+ * nominal frame length.
+ */
+#define FRAME_INDEX_BLOCK 4096
+#define VFR_MAX_FRAME_LENGTH 4
+
+/*
+ * The most adjacent audioframes whose audio is read from the child at once.
+ */
+#define AUDIO_SPAN_FRAMES 16
+
+/*
+ * The most threads that compute spectrogram columns at once.
+ */
+#define SPECTRUM_MAX_LANES 16
+
+
+enum LabelMode
+{
+	LABELS_NONE,
+	LABELS_FRAMES,
+	LABELS_TIMECODE
+};
+
+
+/*
+ * A precomputed label on the Y axis: its text and the picture row it is
+ * centred on.
+ */
+struct AxisLabel
+{
+	int y;
+	char text[16];
+};
+
+
+enum ColourMode
+{
+	COLOUR_FRAME,
+	COLOUR_AMPLITUDE,
+	COLOUR_DISTANCE
+};
+
+
+enum GraphMode
+{
+	MODE_WAVE,
+	MODE_CORRELATION,
+	MODE_BANDS,
+	MODE_MEL,
+	MODE_CQT
+};
+
+
+/*
+ * The overlay layers (see overlay.h), bottom to top.  The minimap is copied
+ * into the frame directly and only the layers from LAYER_PLAYHEAD up are
+ * drawn over it.  Dropouts are marked behind the graph, and the paged mode
+ * cursor stays below the minimap.  Label
+ * outline and ink work as one 2-bit layer.  In YUY2
+ * the graph is drawn a pixel pair at a time, and the pairs drawn for odd
+ * columns go in layers of their own, above those of even columns, as they
+ * were drawn after them.
+ */
+enum OverlayLayer
+{
+	LAYER_GRID,
+	LAYER_DROPOUTS,
+	LAYER_MARKERS,
+	LAYER_WAVE,
+	LAYER_ODD_MARKERS,
+	LAYER_ODD_WAVE,
+	LAYER_VAD,
+	LAYER_ONSETS,
+	LAYER_CURSOR,
+	LAYER_PLAYHEAD,
+	LAYER_OUTLINE,
+	LAYER_INK,
+	OVERLAY_LAYERS
+};
+
+
+/*
+ * The number of elements in a buffer of a * b * c elements, each up to 16
+ * bytes, checked so that a long, high rate or many channel clip fails with an
+ * error instead of wrapping round to a small allocation.
+ */
+static size_t BufferElements(int64_t a, int64_t b, int64_t c, IScriptEnvironment* env)
+{
+	const int64_t limit = (int64_t)(SIZE_MAX / 16 < INT64_MAX ? SIZE_MAX / 16 : INT64_MAX);
+	if (a < 0 || b < 0 || c < 0 ||
+		(b && a > limit / b) || (c && a * b > limit / c))
+		env->ThrowError("AudioGraph: buffer too large");
+	return (size_t)(a * b * c);
+}
+
+
+/*
+ * A text file written by the constructor, closed when it goes out of scope
+ * so that it is not leaked when reading the audio throws.
+ */
+class OutputFile
+{
+public:
+	explicit OutputFile(FILE* _file) : file(_file) {}
+	~OutputFile() { if (file) fclose(file); }
+	FILE* get() const { return file; }
+private:
+	OutputFile(const OutputFile&);
+	OutputFile& operator=(const OutputFile&);
+	FILE* file;
+};
+
 
 /*
  * How this filter works:
@@ -84,35 +566,243 @@
  * specific audioframe is only ever cached in a specific audioframe buffer, so
  * that cache lookup is very fast.  This caching also improves performance
  * when seeking back and forth in a video.
+ *
+ * The raw audio of an audioframe is first split into one float plane per
+ * channel (the "deinterleaved buffer").  Every reduction - the waveform, the
+ * phase correlation and the goniometer - reads these planes, so none of them
+ * has to care about the sample type or the channel layout.
+ *
+ * In bands mode the planes are also run through a three-band crossover
+ * filterbank, and each X pixel gets a colour from the energy balance of the
+ * bands.  The filter state at the end of each audioframe is checkpointed in
+ * the cache, so that the next audioframe can continue from it instead of
+ * warming the filters up again.
+ *
+ * Onsets are found with spectral flux: the summed increase in log magnitude
+ * between successive short FFT hops, compared against a moving average of
+ * the recent flux.  The hops lie on a fixed grid, so when audioframes are
+ * requested in order the detector simply carries on from where the previous
+ * audioframe stopped.  The onsets of each audioframe are cached next to it as
+ * X pixel offsets, so scrolling the markers costs nothing.
+ *
+ * The voice activity lane works the same way with 10 ms hops (see vad.h):
+ * consecutive audioframes continue the detector and its hangover, and each
+ * audioframe caches one speech flag per X pixel.
+ *
+ * The spectrogram modes take one FFT per X pixel, centred on the pixel's
+ * sample range, and reduce the bins to mel or constant-Q bands with a sparse
+ * matrix (see filterbank.h).  Each column is cached as one byte of log
+ * magnitude per band, so redrawing a spectrogram that scrolls by is only a
+ * palette lookup per pixel.
  */
 class AudioGraph : public GenericVideoFilter
 {
 public:
-	AudioGraph(PClip _child, int _frames_either_side, int _graph_scale, int _middle_colour, int _side_colour, IScriptEnvironment* _env);
+	AudioGraph(PClip _child, int _frames_either_side, int _graph_scale, int _middle_colour, int _side_colour, const char* _mode, bool _goniometer, bool _onsets, bool _vad, const char* _vad_file, const char* _labels, bool _grid, bool _db, float _db_floor, float _db_ceiling, const char* _colour_by, float _latency_budget_ms, bool _minimap, bool _vfr, const char* _timecodes, int _offset_samples, int _working_rate, int _threads, const char* _peaks_file, int _layer_cache_mb, bool _paged, bool _dropouts, const char* _dropout_file, IScriptEnvironment* _env);
 	virtual ~AudioGraph();
 	int GetGraphAutoScale(IScriptEnvironment* _env);
-	void FillAudioFrame8(uint16_t *audioframe_buffer);
-	void FillAudioFrame16(uint16_t *audioframe_buffer);
+	void Deinterleave(const uint8_t *src, int count);
+	void FillAudioFrame(int64_t start, uint16_t *audioframe_buffer, IScriptEnvironment* env);
+	void FillGoniometer(uint8_t *goniometer_buffer);
+	void RestoreBandState(int frame, int64_t start, __m128 *state, IScriptEnvironment* env);
+	void RunFilterbank(int count, __m128 *state, float *output);
+	void FillBandColours(uint16_t *colour_buffer, __m128 *state, float *checkpoint);
 	uint16_t *GetAudioFrame(int frame, IScriptEnvironment* env);
+	uint8_t *GetGoniometer(int frame, IScriptEnvironment* env);
+	uint16_t *GetBandColours(int frame, IScriptEnvironment* env);
+	void MixToMono(const uint8_t *raw, int count, float *mono);
+	void DetectOnsets(int64_t start, uint8_t *onset_count, uint16_t *onset_positions, IScriptEnvironment* env);
+	int GetOnsets(int frame, const uint16_t **onset_positions, IScriptEnvironment* env);
+	void DrawOnsets(int n, IScriptEnvironment* env);
+	void DetectVoice(int64_t start, uint8_t *lane, IScriptEnvironment* env);
+	uint8_t *GetVoiceLane(int frame, IScriptEnvironment* env);
+	uint8_t *GetDropouts(int frame, IScriptEnvironment* env);
+	void DrawVoiceLane(int n, IScriptEnvironment* env);
+	void DrawDropouts(int n, IScriptEnvironment* env);
+	void ExportVoiceSegments(const char* filename, IScriptEnvironment* env);
+	void ReadDropoutAudio(int64_t start, int count, int16_t *samples, uint8_t *raw, IScriptEnvironment* env);
+	void DetectDropouts(int64_t start, uint8_t *columns);
+	void IndexDropouts(const char* filename, IScriptEnvironment* env);
+	void FillSpectrum(int64_t start, uint8_t *columns, IScriptEnvironment* env);
+	uint8_t *GetSpectrum(int frame, IScriptEnvironment* env);
+	void BuildAxisLabels();
+	void DrawText(int x, int y, const char *text);
+	void DrawLabels(int n, IScriptEnvironment* env);
+	int LevelToY(double level) const;
+	void BuildGrid();
+	void DrawGridRows();
+	int SecondMarker(int frame, IScriptEnvironment* env);
+	PixelColour ConvertColour(int colour) const;
+	void DrawGoniometer(Canvas& canvas, const uint8_t *goniometer_buffer);
+	void DrawGraph(int n, IScriptEnvironment* env);
+	template<class Writer>
+	void DrawSpectrum(Writer writer, int n, IScriptEnvironment* env);
+	const PixelColour** ColumnColours(int layer) const { return m_column_colours + (size_t)(layer - LAYER_MARKERS) * (vi.width + 1); }
+	inline const PixelColour& OverlayColour(int layer, int x, int y) const;
+	template<class Writer>
+	void CompositeOverlay(Writer writer);
+	template<class Writer>
+	void DrawOverlay(Writer writer, Canvas& canvas, int n, int page, IScriptEnvironment* env);
+	bool Deferred(int frame) const;
+	void PrefetchAudioFrames(int n, IScriptEnvironment* env);
+	void BuildMinimap(IScriptEnvironment* env);
+	void DrawMinimap(Canvas& canvas, int n, IScriptEnvironment* env);
+	void ReadTimecodes(const char* filename, IScriptEnvironment* env);
+	void BuildFrameIndexBlock(IScriptEnvironment* env);
+	int64_t FrameStart(int frame, IScriptEnvironment* env);
+	int FrameLength(int frame, IScriptEnvironment* env);
+	int FrameFromSample(int64_t sample, IScriptEnvironment* env);
+	void SetFrameLength(int length);
+	void SetWindow(int n);
+	const uint8_t *ReadFrameAudio(int frame, int64_t start, IScriptEnvironment* env);
+	void ReadAudio(void *buffer, int64_t start, int64_t count, IScriptEnvironment* env);
 	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+	int __stdcall SetCacheHints(int cachehints, int frame_range);
 private:
 	IScriptEnvironment* m_env;
+	PClip   m_audio;
+	VideoInfo audio_vi;
+	Arena   m_arena;
 	size_t  m_audio_buffer_size;
 	uint8_t*   m_audio_buffer;
+	size_t  m_span_buffer_size;
+	uint8_t*   m_span_buffer;
+	int64_t span_start;
+	int64_t span_length;
+	int span_lead;
+	int span_trail;
+	int bytes_per_sample;
+	size_t  m_channel_buffers_size;
+	float*  m_channel_buffers;
 	size_t  m_cache_lookup_size;
 	int*    m_cache_lookup;
 	size_t  m_audioframe_buffers_size;
 	uint16_t*   m_audioframe_buffers;
 	size_t  m_sample_ranges_size;
-	uint8_t**  m_sample_ranges;
+	int*    m_sample_ranges;
+	size_t  m_goniometer_buffers_size;
+	uint8_t*   m_goniometer_buffers;
+	uint16_t*  m_goniometer_counts;
+	PixelColour m_goniometer_palette[256];
+	size_t  m_band_buffer_size;
+	float*  m_band_buffer;
+	size_t  m_band_colour_buffers_size;
+	uint16_t*  m_band_colour_buffers;
+	size_t  m_band_checkpoints_size;
+	float*  m_band_checkpoints;
+	PixelColour* m_band_palette;
+	float   m_band_coefficients[5][4];
+	int band_preroll;
+	std::unique_ptr<FFT> m_onset_fft;
+	size_t  m_onset_audio_size;
+	uint8_t*   m_onset_audio;
+	size_t  m_onset_mono_size;
+	float*  m_onset_mono;
+	float*  m_onset_previous;
+	float*  m_onset_current;
+	float*  m_onset_flux;
+	uint8_t*   m_onset_counts;
+	uint16_t*  m_onset_positions;
+	int onset_hop;
+	int onset_history_size;
+	int64_t onset_next_hop;
+	int64_t onset_valid_from;
+	bool onsets;
+	PixelColour onset_pixel;
+	std::unique_ptr<VoiceDetector> m_vad;
+	size_t  m_vad_audio_size;
+	uint8_t*   m_vad_audio;
+	size_t  m_vad_mono_size;
+	float*  m_vad_mono;
+	uint8_t*   m_vad_decisions;
+	size_t  m_vad_lanes_size;
+	uint8_t*   m_vad_lanes;
+	int64_t vad_next_hop;
+	bool vad_last_decision;
+	bool vad;
+	PixelColour vad_pixel;
+	std::unique_ptr<DropoutDetector> m_dropouts;
+	size_t  m_dropout_audio_size;
+	int16_t*   m_dropout_audio;
+	size_t  m_dropout_columns_size;
+	uint8_t*   m_dropout_columns;
+	std::vector<DropoutEvent> m_dropout_events;
+	std::vector<int> m_dropout_frames;
+	bool dropouts;
+	bool dropout_index;
+	PixelColour dropout_pixel;
+	std::vector<std::unique_ptr<FFT> > m_spectrum_ffts;
+	std::unique_ptr<SparseFilterbank> m_spectrum_filterbank;
+	size_t  m_spectrum_audio_size;
+	uint8_t*   m_spectrum_audio;
+	size_t  m_spectrum_mono_size;
+	float*  m_spectrum_mono;
+	float*  m_spectrum_powers;
+	float*  m_spectrum_band_powers;
+	size_t  m_spectrum_columns_size;
+	uint8_t*   m_spectrum_columns;
+	int*    m_spectrum_rows;
+	PixelColour m_spectrum_palette[256];
+	int spectrum_bands;
+	float spectrum_reference;
+	bool spectrogram;
+	std::unique_ptr<GlyphAtlas> m_glyphs;
+	std::vector<AxisLabel> m_axis_labels;
+	LabelMode labels;
+	int label_step;
+	PixelColour label_pixel, outline_pixel;
+	std::vector<int> m_grid_rows;
+	PixelColour grid_pixel, second_pixel;
+	bool grid;
+	size_t  m_db_lut_size;
+	uint16_t*  m_db_lut;
+	bool db;
+	ColourMode colour_by;
+	PixelColour m_gradient[256];
+	uint8_t*   m_gradient_rows;
+	ThreadPool* m_pool;
+	int thread_count;
+	std::deque<int> m_deferred_frames;
+	uint16_t*  m_placeholder;
+	int window_first, window_last;
+	double latency_budget;
+	double miss_cost;
+	std::unique_ptr<PeakPyramid> m_peaks;
+	uint8_t*   m_minimap;
+	int64_t minimap_samples;
+	int minimap_height;
+	bool minimap;
+	std::string peaks_file;
+	std::unique_ptr<LayerCache> m_layers;
+	uint8_t*   m_layer_bare;
+	std::unique_ptr<OverlayMasks> m_overlay;
+	uint8_t*   m_overlay_ids;
+	const PixelColour** m_column_colours;
+	int overlay_pair_mask;
+	bool paged;
+	int overlay_page;
+	bool overlay_complete;
+	int cursor_x, playhead_x;
+	std::vector<std::vector<int64_t> > m_frame_starts;
+	std::vector<double> m_timecodes;
+	double frame_index_time;
+	bool vfr;
+	std::unique_ptr<SumCache> m_sums;
+	int64_t offset_samples;
+	PixelColour middle_pixel, side_pixel;
 	int samples_per_frame;
+	int max_samples_per_frame;
+	int frame_length;
+	int channel_stride;
 	int num_audioframe_buffers;
 	int frames_either_side;
 	int pixels_per_audioframe;
 	int log_samples_per_pixel;
-	int log_mono_samples_per_pixel;
 	int middle_colour, side_colour;
 	int graph_scale;
+	GraphMode mode;
+	bool goniometer;
+	int log_goniometer_size;
 	bool v8;
 };
 
@@ -127,22 +817,142 @@ private:
  *	 _graph_scale			The vertical scale factor
  *	 _middle_colour			The graph colour for the current frame
  *	 _side_colour			The graph colour for the frames on either side of the current
+ *	 _mode					"wave", "correlation", "bands", "mel" or "cqt"
+ *	 _goniometer			Draw a goniometer inset for the current frame
+ *	 _onsets				Mark detected onsets with ticks
+ *	 _vad					Draw the voice activity lane
+ *	 _vad_file				If not empty, write the voice activity segments of the whole
+ *							clip to this file
+ *	 _labels				"none", "frames" or "timecode"
+ *	 _grid					Draw the grid
+ *	 _db					Graph the level on a dB scale
+ *	 _db_floor				The level graphed at the centre line, in dB
+ *	 _db_ceiling			The level graphed at the top and bottom, in dB
+ *	 _colour_by				"frame", "amplitude" or "distance"
+ *	 _latency_budget_ms		If not 0, the time GetFrame may spend generating audioframes
+ *	 _minimap				Draw an overview of the whole clip along the bottom
+ *	 _vfr					Take frame durations from the _DurationNum / _DurationDen
+ *							frame properties
+ *	 _timecodes				If not empty, take frame start times from this v2 timecode file
+ *	 _offset_samples		Graph the audio this many samples later (positive) or earlier
+ *	 _working_rate			If nonzero, decimate the audio to the lowest rate at least this high
+ *	 _threads				The most threads to use for one frame (0 = AUDIOGRAPH_THREADS or all cores)
+ *	 _peaks_file			If not empty, load the minimap's peak index from this file, or write it
+ *	 _layer_cache_mb		If not 0, keep the drawn layers of recent frames in this many MB
+ *	 _paged					Show whole pages of frames with a moving playhead
+ *	 _dropouts				Mark suspected dropouts in the graph
+ *	 _dropout_file			If not empty, write the suspect regions of the whole clip to this file
  */
-AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale, int _middle_colour, int _side_colour, IScriptEnvironment* _env) :
+AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale, int _middle_colour, int _side_colour, const char* _mode, bool _goniometer, bool _onsets, bool _vad, const char* _vad_file, const char* _labels, bool _grid, bool _db, float _db_floor, float _db_ceiling, const char* _colour_by, float _latency_budget_ms, bool _minimap, bool _vfr, const char* _timecodes, int _offset_samples, int _working_rate, int _threads, const char* _peaks_file, int _layer_cache_mb, bool _paged, bool _dropouts, const char* _dropout_file, IScriptEnvironment* _env) :
 	GenericVideoFilter(ConvertAudio::Create(_child,SAMPLE_INT16|SAMPLE_INT8,SAMPLE_INT16)),
 	m_env(_env),
+	m_audio(Decimator::Create(child, _working_rate, _env)),
+	audio_vi(m_audio->GetVideoInfo()),
 	m_audio_buffer_size(0),
 	m_audio_buffer(NULL),
+	m_span_buffer_size(0),
+	m_span_buffer(NULL),
+	span_start(0),
+	span_length(0),
+	span_lead(0),
+	span_trail(0),
+	bytes_per_sample(0),
+	m_channel_buffers_size(0),
+	m_channel_buffers(NULL),
 	m_cache_lookup_size(0),
 	m_cache_lookup(NULL),
 	m_audioframe_buffers_size(0),
 	m_audioframe_buffers(NULL),
 	m_sample_ranges_size(0),
 	m_sample_ranges(NULL),
+	m_goniometer_buffers_size(0),
+	m_goniometer_buffers(NULL),
+	m_goniometer_counts(NULL),
+	m_band_buffer_size(0),
+	m_band_buffer(NULL),
+	m_band_colour_buffers_size(0),
+	m_band_colour_buffers(NULL),
+	m_band_checkpoints_size(0),
+	m_band_checkpoints(NULL),
+	m_band_palette(NULL),
+	band_preroll(0),
+	m_onset_audio_size(0),
+	m_onset_audio(NULL),
+	m_onset_mono_size(0),
+	m_onset_mono(NULL),
+	m_onset_previous(NULL),
+	m_onset_current(NULL),
+	m_onset_flux(NULL),
+	m_onset_counts(NULL),
+	m_onset_positions(NULL),
+	onset_hop(0),
+	onset_history_size(0),
+	onset_next_hop(INT64_MIN),
+	onset_valid_from(INT64_MAX),
+	onsets(_onsets),
+	m_vad_audio_size(0),
+	m_vad_audio(NULL),
+	m_vad_mono_size(0),
+	m_vad_mono(NULL),
+	m_vad_decisions(NULL),
+	m_vad_lanes_size(0),
+	m_vad_lanes(NULL),
+	vad_next_hop(INT64_MIN),
+	vad_last_decision(false),
+	vad(_vad),
+	m_dropout_audio_size(0),
+	m_dropout_audio(NULL),
+	m_dropout_columns_size(0),
+	m_dropout_columns(NULL),
+	dropouts(_dropouts),
+	dropout_index(false),
+	m_spectrum_audio_size(0),
+	m_spectrum_audio(NULL),
+	m_spectrum_mono_size(0),
+	m_spectrum_mono(NULL),
+	m_spectrum_powers(NULL),
+	m_spectrum_band_powers(NULL),
+	m_spectrum_columns_size(0),
+	m_spectrum_columns(NULL),
+	m_spectrum_rows(NULL),
+	spectrum_bands(0),
+	spectrum_reference(1.0f),
+	label_step(1),
+	grid(_grid),
+	m_db_lut_size(0),
+	m_db_lut(NULL),
+	db(_db),
+	m_gradient_rows(NULL),
+	m_pool(NULL),
+	thread_count(0),
+	m_placeholder(NULL),
+	window_first(0),
+	window_last(-1),
+	latency_budget(_latency_budget_ms),
+	miss_cost(0.0),
+	m_minimap(NULL),
+	minimap_samples(0),
+	minimap_height(0),
+	minimap(_minimap || (_peaks_file && *_peaks_file)),
+	peaks_file((_peaks_file) ? _peaks_file : ""),
+	m_layer_bare(NULL),
+	m_overlay_ids(NULL),
+	m_column_colours(NULL),
+	overlay_pair_mask(0),
+	paged(_paged),
+	overlay_page(-1),
+	overlay_complete(false),
+	cursor_x(-1),
+	playhead_x(-1),
+	frame_index_time(0.0),
+	vfr(_vfr || (_timecodes && *_timecodes)),
+	offset_samples(_offset_samples),
 	graph_scale(_graph_scale),
 	frames_either_side(_frames_either_side),
 	middle_colour(_middle_colour),
-	side_colour(_side_colour)
+	side_colour(_side_colour),
+	goniometer(_goniometer),
+	log_goniometer_size(0)
 {
 
 	if (frames_either_side == 0)
@@ -153,7 +963,6 @@ AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale,
 		side_colour = 0x7F7F7F;
 
 	int num_visible_audioframes;
-	int bytes_per_sample;
 
 	if (vi.IsYUY2()) 
 	  child = _env->Invoke("Greyscale", child).AsClip();
@@ -164,17 +973,118 @@ AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale,
 	if (! vi.HasAudio())
 		_env->ThrowError("AudioGraph: clip has no audio");
 
+	/*
+	 * With a working rate, every reduction reads the decimated audio of
+	 * m_audio (see decimator.h), while the clip's own audio passes through
+	 * untouched.  offset_samples is given in source samples.
+	 */
+	int decimation = _child->GetVideoInfo().audio_samples_per_second / audio_vi.audio_samples_per_second;
+	offset_samples = (_offset_samples >= 0) ? (_offset_samples + decimation / 2) / decimation : -((-(int64_t)_offset_samples + decimation / 2) / decimation);
+
 	if (_frames_either_side < 0)
 		_env->ThrowError("AudioGraph: negative parameter not allowed");
+
+	if (!_stricmp(_mode, "wave"))
+		mode = MODE_WAVE;
+	else if (!_stricmp(_mode, "correlation"))
+		mode = MODE_CORRELATION;
+	else if (!_stricmp(_mode, "bands"))
+		mode = MODE_BANDS;
+	else if (!_stricmp(_mode, "mel"))
+		mode = MODE_MEL;
+	else if (!_stricmp(_mode, "cqt"))
+		mode = MODE_CQT;
+	else
+		_env->ThrowError("AudioGraph: mode must be \"wave\", \"correlation\", \"bands\", \"mel\" or \"cqt\"");
+	spectrogram = (mode == MODE_MEL || mode == MODE_CQT);
+
+	if (!_stricmp(_labels, "none"))
+		labels = LABELS_NONE;
+	else if (!_stricmp(_labels, "frames"))
+		labels = LABELS_FRAMES;
+	else if (!_stricmp(_labels, "timecode"))
+		labels = LABELS_TIMECODE;
+	else
+		_env->ThrowError("AudioGraph: labels must be \"none\", \"frames\" or \"timecode\"");
+
+	if (!_stricmp(_colour_by, "frame"))
+		colour_by = COLOUR_FRAME;
+	else if (!_stricmp(_colour_by, "amplitude"))
+		colour_by = COLOUR_AMPLITUDE;
+	else if (!_stricmp(_colour_by, "distance"))
+		colour_by = COLOUR_DISTANCE;
+	else
+		_env->ThrowError("AudioGraph: colour_by must be \"frame\", \"amplitude\" or \"distance\"");
+
+	if (_latency_budget_ms < 0.0f)
+		_env->ThrowError("AudioGraph: latency_budget_ms must not be negative");
+
+	if (_layer_cache_mb < 0)
+		_env->ThrowError("AudioGraph: layer_cache_mb must not be negative");
+
+	if (_threads < 0)
+		_env->ThrowError("AudioGraph: threads must not be negative");
+	thread_count = (_threads > 0) ? _threads : ThreadPool::DefaultThreads();
+
+	if (db && _db_floor >= _db_ceiling)
+		_env->ThrowError("AudioGraph: db_floor must be below db_ceiling");
+
+	if ((mode == MODE_CORRELATION || goniometer) && audio_vi.AudioChannels() < 2)
+		_env->ThrowError("AudioGraph: correlation and goniometer need at least two audio channels");
+
+	/*
+	 * Variable frame rate: frame durations come from a timecode file, read
+	 * here, or from frame properties, read as the frame index is built.
+	 * Audioframes then vary in length, so every buffer that holds one is
+	 * sized for the longest allowed.
+	 */
+	v8 = HasFrameProperties(_env);
+	if (_timecodes && *_timecodes)
+		ReadTimecodes(_timecodes, _env);
+	else if (vfr && !v8)
+		_env->ThrowError("AudioGraph: vfr needs frame properties (AviSynth+ 3.6 or later)");
+
+	/*
+	 * Allocate the buffers for raw audio data: one frame's worth, and a span
+	 * of adjacent frames read in one go.
+	 */
+	bytes_per_sample = audio_vi.BytesPerAudioSample();
+	int audio_channels_count = audio_vi.AudioChannels();
 	/*
-	 * Allocate the buffer for raw audio data.  We only ever read raw audio
-	 * data for one frame at a time.
+	 * Sample positions are 64-bit throughout, but one audioframe's worth of
+	 * samples is indexed with ints, so refuse frame rates so low that a frame
+	 * holds more than that.
 	 */
-	bytes_per_sample = vi.BytesPerAudioSample();
-	int audio_channels_count = vi.AudioChannels();
-	samples_per_frame = (int)vi.AudioSamplesFromFrames(1);
-	m_audio_buffer_size = bytes_per_sample * samples_per_frame * audio_channels_count;
-	m_audio_buffer = new uint8_t[m_audio_buffer_size]();
+	int64_t samples_in_frame = audio_vi.AudioSamplesFromFrames(1);
+	if (samples_in_frame < 1 || samples_in_frame > INT32_MAX / (VFR_MAX_FRAME_LENGTH * 16))
+		_env->ThrowError("AudioGraph: too many audio samples per frame");
+	samples_per_frame = (int)samples_in_frame;
+	// Frames are a sample longer than the nominal length wherever the rate does not divide evenly.
+	max_samples_per_frame = (vfr) ? samples_per_frame * VFR_MAX_FRAME_LENGTH : samples_per_frame + 1;
+	frame_length = samples_per_frame;
+	m_audio_buffer_size = BufferElements(bytes_per_sample, max_samples_per_frame, audio_channels_count, _env);
+	m_audio_buffer = m_arena.Allocate<uint8_t>(m_audio_buffer_size);
+	/*
+	 * The span of audio read for a run of audioframes (see ReadFrameAudio) is
+	 * widened by the most any reader looks before or after an audioframe, so
+	 * that the readers below are served from it too.  It is allocated once
+	 * they are all set up.
+	 */
+	auto widen_span = [&](int lead, int trail)
+	{
+		if (span_lead < lead)
+			span_lead = lead;
+		if (span_trail < trail)
+			span_trail = trail;
+	};
+	/*
+	 * The deinterleaved buffer holds one float plane per channel.  Each plane
+	 * is padded to a multiple of 4 samples so that SSE loads of a plane never
+	 * straddle into the next one.
+	 */
+	channel_stride = (max_samples_per_frame + 3) & ~3;
+	m_channel_buffers_size = BufferElements(channel_stride, audio_channels_count, 1, _env);
+	m_channel_buffers = m_arena.Allocate<float>(m_channel_buffers_size);
 	/*
 	 * Calculate the number of visible audioframes.  For efficiency reasons,
 	 * the width of an audioframe is rounded up to an exact number of pixels.
@@ -202,8 +1112,8 @@ AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale,
 	num_audioframe_buffers = 1;
 	while (num_audioframe_buffers < num_visible_audioframes)
 		num_audioframe_buffers <<= 1;
-	m_audioframe_buffers_size = pixels_per_audioframe * num_audioframe_buffers;
-	m_audioframe_buffers = new uint16_t[m_audioframe_buffers_size];
+	m_audioframe_buffers_size = BufferElements(pixels_per_audioframe, num_audioframe_buffers, 1, _env);
+	m_audioframe_buffers = m_arena.Allocate<uint16_t>(m_audioframe_buffers_size);
 	/*
 	 * cache_lookup tells us which audioframe is currently stored in each
 	 * audioframe buffer.  Initialise this with an invalid value meaning
@@ -211,7 +1121,7 @@ AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale,
 	 * audioframes.
 	 */
 	m_cache_lookup_size = num_audioframe_buffers;
-	m_cache_lookup = new int[m_cache_lookup_size];
+	m_cache_lookup = m_arena.Allocate<int>(m_cache_lookup_size);
 	for (int i = 0; i < num_audioframe_buffers; i++)
 		m_cache_lookup[i] = -num_audioframe_buffers;
 	/*
@@ -236,531 +1146,2506 @@ AudioGraph::AudioGraph(PClip _child, int _frames_either_side, int _graph_scale,
 	log_samples_per_pixel = 0;
 	while (1 << log_samples_per_pixel < (samples_per_frame / pixels_per_audioframe))
 		log_samples_per_pixel++;
-	log_mono_samples_per_pixel = log_samples_per_pixel;
-//    if (vi.AudioChannels)
-		log_mono_samples_per_pixel+=vi.AudioChannels()-1;
 	/*
 	 * The second problem is that calculating which pixel a given sample
 	 * contributes to also involves division.  This is easily solved by
 	 * calculating the first sample in each range once at startup, and storing
-	 * a pointer to it in the sample_ranges array which can then be indexed by
-	 * the X pixel coordinate.
+	 * its offset into the channel planes in the sample_ranges array which can
+	 * then be indexed by the X pixel coordinate.
 	 */
 	int start_of_last_sample_range = (samples_per_frame - (1 << log_samples_per_pixel));
-	if ((int)m_audio_buffer_size <= (pixels_per_audioframe * start_of_last_sample_range / (pixels_per_audioframe - 1)) * bytes_per_sample)
+	if (start_of_last_sample_range < 0)
 		_env->ThrowError("AudioGraph: invalid audio buffer size");
 
 	m_sample_ranges_size = pixels_per_audioframe;
-	m_sample_ranges = new uint8_t*[m_sample_ranges_size];
-	m_sample_ranges[0] = m_audio_buffer;
+	m_sample_ranges = m_arena.Allocate<int>(m_sample_ranges_size);
+	m_sample_ranges[0] = 0;
 	// Note, pixels_per_audioframe must be at least 2 - this was checked above
 	for (int x_pixel = 1; x_pixel < pixels_per_audioframe; x_pixel++)
-		m_sample_ranges[x_pixel] = m_audio_buffer	+ (x_pixel * start_of_last_sample_range / (pixels_per_audioframe - 1)) * bytes_per_sample;
+		m_sample_ranges[x_pixel] = (int)((int64_t)x_pixel * start_of_last_sample_range / (pixels_per_audioframe - 1));
 
 	/*
-	*	Set the vertical scale factor.
-	*/
-	if (graph_scale == 0)
+	 * The goniometer is a square density image, a power of 2 pixels wide so
+	 * that a sample's cell index is a shift and an add.  One image is cached
+	 * next to each audioframe buffer, so it shares the audioframe lookup.
+	 */
+	if (goniometer)
 	{
-		graph_scale = 1;
-		graph_scale = GetGraphAutoScale(_env);
+		int smaller_side = (vi.width < vi.height) ? vi.width : vi.height;
+		log_goniometer_size = 6;
+		while (log_goniometer_size < 8 && (2 << log_goniometer_size) <= smaller_side / 4)
+			log_goniometer_size++;
+		size_t goniometer_cells = (size_t)1 << (log_goniometer_size * 2);
+		m_goniometer_buffers_size = BufferElements(goniometer_cells, num_audioframe_buffers, 1, _env);
+		m_goniometer_buffers = m_arena.Allocate<uint8_t>(m_goniometer_buffers_size);
+		m_goniometer_counts = m_arena.Allocate<uint16_t>(goniometer_cells);
+
+		// Palette: black background fading up to middle_colour.
+		for (int level = 0; level < 256; level++)
+		{
+			int r = ((middle_colour >> 16) & 0xFF) * level / 255;
+			int g = ((middle_colour >> 8) & 0xFF) * level / 255;
+			int b = (middle_colour & 0xFF) * level / 255;
+			m_goniometer_palette[level] = ConvertColour((r << 16) | (g << 8) | b);
+		}
 	}
 
-	v8 = _env->FunctionExists("propShow");
-}
-
-
-/*
- * AudioGraph::~AudioGraph
- * 
- * Free allocated memory.
- */
-AudioGraph::~AudioGraph()
-{
-	delete[] m_audio_buffer;
-	delete[] m_audioframe_buffers;
-	delete[] m_cache_lookup;
-	delete[] m_sample_ranges;
-}
-
+	middle_pixel = ConvertColour(middle_colour);
+	side_pixel = ConvertColour(side_colour);
 
-int AudioGraph::GetGraphAutoScale(IScriptEnvironment* _env)
-{
-	int max_graph_y_pixel = 0, y_pixel;
-	int height2 = vi.height>>1;
-	uint16_t* audioframe_buffer;
-
-	for (int fi = 0; fi < vi.num_frames; ++fi)
+	/*
+	 * Gradient colouring: 256 colours, converted to the clip's pixel format
+	 * here so that drawing only loads them.  By amplitude the gradient runs
+	 * from side_colour at the centre line through middle_colour at three
+	 * quarters to red at full scale, and each picture row has its gradient
+	 * index precomputed.  By distance it runs from middle_colour at the
+	 * current frame to side_colour frames_either_side frames away.
+	 */
+	if (colour_by != COLOUR_FRAME)
 	{
-		audioframe_buffer = GetAudioFrame(fi, _env);
-		for (int x_pixel = 0; x_pixel < pixels_per_audioframe; ++x_pixel)
+		int stops[3] = { side_colour, middle_colour, 0xFF0000 };
+		int positions[3] = { 0, 192, 255 };
+		if (colour_by == COLOUR_DISTANCE)
 		{
-			y_pixel = abs(int(audioframe_buffer[x_pixel])-height2);
-			if (max_graph_y_pixel < y_pixel)
-				max_graph_y_pixel = y_pixel;
+			stops[0] = stops[1] = middle_colour;
+			stops[2] = side_colour;
+			positions[1] = 0;
+		}
+		for (int level = 0; level < 256; level++)
+		{
+			int stop = (level > positions[1]) ? 1 : 0;
+			int span = positions[stop + 1] - positions[stop];
+			int weight = (span) ? (level - positions[stop]) * 255 / span : 0;
+			int rgb = 0;
+			for (int shift = 0; shift <= 16; shift += 8)
+			{
+				int from = (stops[stop] >> shift) & 0xFF, to = (stops[stop + 1] >> shift) & 0xFF;
+				rgb |= (from + (to - from) * weight / 255) << shift;
+			}
+			m_gradient[level] = ConvertColour(rgb);
 		}
-	}
-	int result = height2/max_graph_y_pixel;
-	return !result ? 1 : result;
-}
-
-
-template<class T>
-inline T Clamp(const T& _x, const T& _a, const T& _b)
-{
-	if (_x < _a)
-		return _a;
-	else if (_x > _b)
-		return _b;
-	return _x;
-}
-
 
-/*
- * AudioGraph::FillAudioFrame8
- * 
- * Fill an audioframe buffer from the 8-bit audio data in audio_buffer.  If
- * the source is stereo, the channels are averaged.  The resulting Y pixel
- * coordinates are stored into the given audioframe buffer.
- * 
- * Parameters:
- *   audioframe_buffer     A pointer to the audioframe buffer to fill.
- */
-void AudioGraph::FillAudioFrame8(uint16_t *audioframe_buffer)
-{
-	int height2 = vi.height>>1;
-	for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
-	{
-		if (x_pixel >= (int)m_sample_ranges_size)
-			m_env->ThrowError("AudioGraph: x pixel 8");
-		uint8_t *src = m_sample_ranges[x_pixel];
-		int y_pixel = 0;
-		int num_samples = 1 << log_mono_samples_per_pixel;
-		while (num_samples--)
+		int height2 = vi.height >> 1;
+		m_gradient_rows = m_arena.Allocate<uint8_t>(vi.height);
+		for (int y = 0; y < vi.height; y++)
 		{
-			y_pixel += *(uint8_t*)src - 128;
-			src++;
+			int distance = abs(vi.height - 1 - y - height2);
+			m_gradient_rows[y] = (uint8_t)((distance >= height2) ? 255 : distance * 255 / height2);
 		}
-		y_pixel >>= log_mono_samples_per_pixel;
-		y_pixel = Clamp((y_pixel * vi.height / 256) * graph_scale, -height2, height2);
-		audioframe_buffer[x_pixel] = (uint16_t)(height2 + y_pixel);
 	}
-}
+
+	/*
+	 * Bands mode: a low-pass at 250 Hz, a band-pass across 250 Hz - 4 kHz
+	 * and a high-pass at 4 kHz, as RBJ biquads.  Each band is one lane of an
+	 * SSE register (the fourth lane is unused), so the whole filterbank costs
+	 * one vector biquad per sample.  Coefficients are stored lane-wise as b0,
+	 * b1, b2, a1, a2.
+	 */
+	if (mode == MODE_BANDS)
+	{
+		const double pi = 3.14159265358979323846;
+		double rate = audio_vi.audio_samples_per_second;
+		double low_edge = 250.0;
+		double high_edge = (4000.0 < rate * 0.4) ? 4000.0 : rate * 0.4;
+		double mid_centre = sqrt(low_edge * high_edge);
+		double octaves = log(high_edge / low_edge) / log(2.0);
+		double mid_q = sqrt(pow(2.0, octaves)) / (pow(2.0, octaves) - 1.0);
+		const double frequencies[3] = { low_edge, mid_centre, high_edge };
+		const double qs[3] = { 0.7071, mid_q, 0.7071 };
+
+		memset(m_band_coefficients, 0, sizeof(m_band_coefficients));
+		for (int band = 0; band < 3; band++)
+		{
+			double w0 = 2.0 * pi * frequencies[band] / rate;
+			double alpha = sin(w0) / (2.0 * qs[band]);
+			double cosw0 = cos(w0);
+			double a0 = 1.0 + alpha;
+			double b0, b1, b2;
+			if (band == 0)
+			{
+				b0 = b2 = (1.0 - cosw0) / 2.0;
+				b1 = 1.0 - cosw0;
+			}
+			else if (band == 1)
+			{
+				b0 = alpha;
+				b1 = 0.0;
+				b2 = -alpha;
+			}
+			else
+			{
+				b0 = b2 = (1.0 + cosw0) / 2.0;
+				b1 = -(1.0 + cosw0);
+			}
+			m_band_coefficients[0][band] = (float)(b0 / a0);
+			m_band_coefficients[1][band] = (float)(b1 / a0);
+			m_band_coefficients[2][band] = (float)(b2 / a0);
+			m_band_coefficients[3][band] = (float)(-2.0 * cosw0 / a0);
+			m_band_coefficients[4][band] = (float)((1.0 - alpha) / a0);
+		}
+
+		// Enough audio to settle the 250 Hz filters when there is no checkpoint.
+		band_preroll = audio_vi.audio_samples_per_second / 50;
+		if (band_preroll > max_samples_per_frame)
+			band_preroll = max_samples_per_frame;
+		widen_span(band_preroll, 0);
+
+		m_band_buffer_size = BufferElements(channel_stride, 4, 1, _env);
+		m_band_buffer = m_arena.Allocate<float>(m_band_buffer_size);
+		m_band_colour_buffers_size = m_audioframe_buffers_size;
+		m_band_colour_buffers = m_arena.Allocate<uint16_t>(m_band_colour_buffers_size);
+		m_band_checkpoints_size = (size_t)num_audioframe_buffers * 8;
+		m_band_checkpoints = m_arena.Allocate<float>(m_band_checkpoints_size);
+
+		/*
+		 * The palette is indexed by the share of each band in the total, 4
+		 * bits per band: low in bits 8-11 (red), mid in bits 4-7 (green),
+		 * high in bits 0-3 (blue).  Entries are scaled so the strongest band
+		 * is at full intensity.  Silence uses side_colour.
+		 */
+		m_band_palette = m_arena.Allocate<PixelColour>(4096);
+		for (int index = 0; index < 4096; index++)
+		{
+			int low = index >> 8, mid = (index >> 4) & 15, high = index & 15;
+			int strongest = (low > mid) ? low : mid;
+			if (high > strongest)
+				strongest = high;
+			if (!strongest)
+			{
+				m_band_palette[index] = side_pixel;
+				continue;
+			}
+			int r = low * 255 / strongest, g = mid * 255 / strongest, b = high * 255 / strongest;
+			m_band_palette[index] = ConvertColour((r << 16) | (g << 8) | b);
+		}
+	}
+
+	/*
+	 * Onsets: FFT blocks of about 23 ms, hopping by a quarter block.  The
+	 * flux ring must hold every hop an audioframe looks at: its own hops,
+	 * the ONSET_MEAN_HOPS before them, the previous spectrum and one hop of
+	 * lookahead for the peak test.  The raw audio buffer is sized for the
+	 * worst case, which is filling the whole ring in one read.
+	 */
+	if (onsets)
+	{
+		int log_fft_size = 6;
+		while ((1 << log_fft_size) < audio_vi.audio_samples_per_second * 23 / 1000)
+			log_fft_size++;
+		m_onset_fft.reset(new FFT(log_fft_size));
+		onset_hop = m_onset_fft->Size() / 4;
+		widen_span((ONSET_MEAN_HOPS + 1) * onset_hop + m_onset_fft->Size() / 2, onset_hop + m_onset_fft->Size() / 2);
+		onset_history_size = 1;
+		while (onset_history_size < max_samples_per_frame / onset_hop + ONSET_MEAN_HOPS + 4)
+			onset_history_size <<= 1;
+		m_onset_mono_size = (size_t)onset_history_size * onset_hop + m_onset_fft->Size();
+		m_onset_mono = m_arena.Allocate<float>(m_onset_mono_size);
+		m_onset_audio_size = BufferElements(m_onset_mono_size, bytes_per_sample, 1, _env);
+		m_onset_audio = m_arena.Allocate<uint8_t>(m_onset_audio_size);
+		m_onset_previous = m_arena.Allocate<float>(m_onset_fft->Bins());
+		m_onset_current = m_arena.Allocate<float>(m_onset_fft->Bins());
+		m_onset_flux = m_arena.Allocate<float>(onset_history_size);
+		m_onset_counts = m_arena.Allocate<uint8_t>(num_audioframe_buffers);
+		m_onset_positions = m_arena.Allocate<uint16_t>((size_t)num_audioframe_buffers * MAX_ONSETS_PER_FRAME);
+		onset_pixel = ConvertColour(0xFFFFFF);
+	}
+
+	/*
+	 * Voice activity: an audioframe reads at most its own hops plus the
+	 * hangover before them, plus one hop lost to rounding at each end.
+	 */
+	if (vad)
+	{
+		m_vad.reset(new VoiceDetector(audio_vi.audio_samples_per_second));
+		int hops = max_samples_per_frame / m_vad->Hop() + VAD_HANGOVER_HOPS + 2;
+		m_vad_mono_size = (size_t)hops * m_vad->Hop();
+		widen_span((VAD_HANGOVER_HOPS + 1) * m_vad->Hop(), m_vad->Hop());
+		m_vad_mono = m_arena.Allocate<float>(m_vad_mono_size);
+		m_vad_audio_size = BufferElements(m_vad_mono_size, bytes_per_sample, 1, _env);
+		m_vad_audio = m_arena.Allocate<uint8_t>(m_vad_audio_size);
+		m_vad_decisions = m_arena.Allocate<uint8_t>(hops);
+		m_vad_lanes_size = m_audioframe_buffers_size;
+		m_vad_lanes = m_arena.Allocate<uint8_t>(m_vad_lanes_size);
+		vad_pixel = ConvertColour(0xFF8000);
+	}
+
+	/*
+	 * Dropouts: each span of audio is scanned once, with the detector's
+	 * margin either side, so that gaps and repeats running over the edges
+	 * of its audioframes are seen whole.
+	 */
+	if (dropouts || (_dropout_file && *_dropout_file))
+		m_dropouts.reset(new DropoutDetector(audio_vi.audio_samples_per_second, audio_channels_count));
+	if (dropouts)
+	{
+		m_dropout_columns_size = m_audioframe_buffers_size;
+		m_dropout_columns = m_arena.Allocate<uint8_t>(m_dropout_columns_size);
+		widen_span(m_dropouts->Margin(), m_dropouts->Margin());
+		dropout_pixel = ConvertColour(0x802020);
+	}
+
+	/*
+	 * Spectrogram: FFT blocks of about 40 ms, reduced to one band per row up
+	 * to 256 bands.  The mono buffer covers the audioframe plus half a block
+	 * either side, so that every column's block is centred on its pixel.
+	 * Band power is shown in dB over a 90 dB range, 0 dB being a full scale
+	 * sine (whose Hann windowed magnitude is a quarter of the block size).
+	 */
+	if (spectrogram)
+	{
+		int log_fft_size = 8;
+		while ((1 << log_fft_size) < audio_vi.audio_samples_per_second / 25)
+			log_fft_size++;
+		/*
+		 * The columns are shared out over the thread pool, and every thread
+		 * needs its own transform and power buffers.
+		 */
+		int lanes = (thread_count < SPECTRUM_MAX_LANES) ? thread_count : SPECTRUM_MAX_LANES;
+		for (int lane = 0; lane < lanes; lane++)
+			m_spectrum_ffts.push_back(std::unique_ptr<FFT>(new FFT(log_fft_size)));
+		const int fft_size = m_spectrum_ffts[0]->Size();
+		widen_span(fft_size / 2, fft_size / 2);
+		spectrum_bands = (vi.height < 256) ? vi.height : 256;
+		m_spectrum_filterbank.reset(new SparseFilterbank((mode == MODE_MEL) ? SparseFilterbank::MEL : SparseFilterbank::CONSTANT_Q,
+			spectrum_bands, fft_size, audio_vi.audio_samples_per_second));
+		spectrum_reference = fft_size * 0.25f;
+		spectrum_reference *= spectrum_reference;
+
+		m_spectrum_mono_size = (size_t)max_samples_per_frame + fft_size;
+		m_spectrum_mono = m_arena.Allocate<float>(m_spectrum_mono_size);
+		m_spectrum_audio_size = BufferElements(m_spectrum_mono_size, bytes_per_sample, 1, _env);
+		m_spectrum_audio = m_arena.Allocate<uint8_t>(m_spectrum_audio_size);
+		m_spectrum_powers = m_arena.Allocate<float>((size_t)lanes * m_spectrum_ffts[0]->Bins());
+		m_spectrum_band_powers = m_arena.Allocate<float>((size_t)lanes * spectrum_bands);
+		m_spectrum_columns_size = BufferElements(m_audioframe_buffers_size, spectrum_bands, 1, _env);
+		m_spectrum_columns = m_arena.Allocate<uint8_t>(m_spectrum_columns_size);
+
+		// Band of each writer row, top row first.
+		m_spectrum_rows = m_arena.Allocate<int>(vi.height);
+		for (int y = 0; y < vi.height; y++)
+			m_spectrum_rows[y] = (vi.height - 1 - y) * spectrum_bands / vi.height;
+
+		// Palette: black through blue, red and yellow to white.
+		static const int stops[5] = { 0x000000, 0x0000A0, 0xD00000, 0xFFD000, 0xFFFFFF };
+		for (int level = 0; level < 256; level++)
+		{
+			int stop = level * 4 / 256;
+			int weight = level * 4 - stop * 256;
+			int rgb = 0;
+			for (int shift = 0; shift <= 16; shift += 8)
+			{
+				int from = (stops[stop] >> shift) & 0xFF, to = (stops[stop + 1] >> shift) & 0xFF;
+				rgb |= (from + (to - from) * weight / 255) << shift;
+			}
+			m_spectrum_palette[level] = ConvertColour(rgb);
+		}
+	}
+
+	m_span_buffer_size = BufferElements(bytes_per_sample, (int64_t)max_samples_per_frame * AUDIO_SPAN_FRAMES + span_lead + span_trail, audio_channels_count, _env);
+	m_span_buffer = m_arena.Allocate<uint8_t>(m_span_buffer_size);
+	// The dropout detector reads 16-bit audio, so 8-bit spans are widened.
+	if (dropouts && audio_vi.SampleType() == SAMPLE_INT8)
+	{
+		m_dropout_audio_size = m_span_buffer_size;
+		m_dropout_audio = m_arena.Allocate<int16_t>(m_dropout_audio_size);
+	}
+
+	/*
+	 * The plain waveform needs nothing but the sum over each pixel's sample
+	 * range, so it is computed from the shared prefix sums (see sumcache.h)
+	 * instead of reading the audio of every audioframe.  The sums belong to
+	 * the clip before audio conversion, which is what other instances on the
+	 * same clip will see too.  Decimated audio is only shared through its own
+	 * decimator.
+	 */
+	if (mode == MODE_WAVE && !goniometer)
+		m_sums.reset(new SumCache(m_audio, (decimation > 1) ? m_audio.operator->() : _child.operator->()));
+
+	if (_vad_file && *_vad_file)
+		ExportVoiceSegments(_vad_file, _env);
+	if ((_dropout_file && *_dropout_file) || (dropouts && v8))
+		IndexDropouts(_dropout_file, _env);
+
+	/*
+	 * dB scale: the height above the centre line for every magnitude of a
+	 * 16-bit sample, so that FillAudioFrame only quantizes and looks up.
+	 * The scale replaces graph_scale.
+	 */
+	if (db)
+	{
+		int height2 = vi.height >> 1;
+		m_db_lut_size = DB_LUT_SIZE + 1;
+		m_db_lut = m_arena.Allocate<uint16_t>(m_db_lut_size);
+		m_db_lut[0] = 0;
+		for (int magnitude = 1; magnitude <= DB_LUT_SIZE; magnitude++)
+		{
+			double level = 20.0 * log10((double)magnitude / DB_LUT_SIZE);
+			double y = (level - _db_floor) / (_db_ceiling - _db_floor) * height2;
+			m_db_lut[magnitude] = (uint16_t)((y < 0.0) ? 0 : (y > height2) ? height2 : (int)y);
+		}
+		graph_scale = 1;
+	}
+
+	/*
+	*	Set the vertical scale factor.
+	*/
+	if (graph_scale == 0)
+	{
+		graph_scale = 1;
+		if (mode != MODE_CORRELATION && !spectrogram)
+			graph_scale = GetGraphAutoScale(_env);
+	}
+
+	/*
+	 * Labels: the font is scaled with the picture, about one font pixel per
+	 * 300 lines.  Audioframes are usually much narrower than a label, so
+	 * only every label_step'th audioframe boundary is labelled; labelling
+	 * frames that are multiples of the step keeps the labels fixed to their
+	 * audioframes as the graph scrolls.
+	 */
+	if (labels != LABELS_NONE)
+	{
+		int font_scale = vi.height / 300;
+		m_glyphs.reset(new GlyphAtlas((font_scale < 1) ? 1 : (font_scale > 4) ? 4 : font_scale));
+		label_pixel = ConvertColour(0xFFFFFF);
+		outline_pixel = ConvertColour(0x000000);
+		const char *widest = (labels == LABELS_TIMECODE) ? "00:00:00.000" : "-0000000";
+		int label_width = m_glyphs->TextWidth(widest) + m_glyphs->Advance();
+		label_step = (label_width + pixels_per_audioframe - 1) / pixels_per_audioframe;
+		BuildAxisLabels();
+	}
+
+	if (grid)
+		BuildGrid();
+
+	/*
+	 * Latency budget: audioframes that do not fit in the budget are drawn as
+	 * a flat placeholder line, and generated first by the next GetFrame
+	 * calls.  They are never generated in the background, as the child may
+	 * only be read from the thread GetFrame is called on.
+	 */
+	if (minimap)
+		minimap_height = (vi.height / 8 > 16) ? vi.height / 8 : 16;
+
+	if (latency_budget > 0.0)
+	{
+		m_placeholder = m_arena.Allocate<uint16_t>(pixels_per_audioframe);
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
+			m_placeholder[x_pixel] = (uint16_t)(vi.height >> 1);
+	}
+
+	/*
+	 * Overlay masks, with the colour of each column of the marker and
+	 * waveform layers.
+	 */
+	m_overlay.reset(new OverlayMasks(vi.width, vi.height, OVERLAY_LAYERS, m_arena));
+	m_overlay_ids = m_arena.Allocate<uint8_t>(m_overlay->ResolvedWidth());
+	m_column_colours = m_arena.Allocate<const PixelColour*>(4 * ((size_t)vi.width + 1));
+	overlay_pair_mask = (vi.IsYUY2()) ? 1 : 0;
+
+	/*
+	 * Layer cache: the picture is copied before drawing, so that what was
+	 * drawn can be told apart from the video.
+	 */
+	if (_layer_cache_mb > 0)
+	{
+		m_layers.reset(new LayerCache((size_t)_layer_cache_mb << 20));
+		m_layer_bare = m_arena.Allocate<uint8_t>(PictureSize(vi, vi.height));
+	}
+
+	/*
+	 * The shared thread pool is acquired last, once nothing can throw, as
+	 * the destructor that releases it does not run if the constructor throws.
+	 */
+	if (spectrogram && m_spectrum_ffts.size() > 1)
+		m_pool = ThreadPool::Acquire(thread_count);
+}
+
+
+/*
+ * AudioGraph::~AudioGraph
+ * 
+ * Free allocated memory.
+ */
+AudioGraph::~AudioGraph()
+{
+	if (m_pool)
+		ThreadPool::Release();
+}
+
+
+/*
+ * AudioGraph::GetGraphAutoScale
+ * 
+ * Find the largest graph_scale at which the loudest pixel of the clip still
+ * fits, with graph_scale still 1.  Only the waveform is computed, into a
+ * scratch audioframe: the detectors are not run and nothing is cached.
+ */
+int AudioGraph::GetGraphAutoScale(IScriptEnvironment* _env)
+{
+	int max_graph_y_pixel = 0, y_pixel;
+	int height2 = vi.height>>1;
+	std::vector<uint16_t> audioframe(pixels_per_audioframe);
+	uint16_t* audioframe_buffer = audioframe.data();
+
+	for (int fi = 0; fi < vi.num_frames; ++fi)
+	{
+		int64_t start = FrameStart(fi, _env) + offset_samples;
+		SetFrameLength(FrameLength(fi, _env));
+		if (!m_sums)
+		{
+			m_audio->GetAudio(m_audio_buffer, start, frame_length, _env);
+			Deinterleave(m_audio_buffer, frame_length);
+		}
+		FillAudioFrame(start, audioframe_buffer, _env);
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe; ++x_pixel)
+		{
+			y_pixel = abs(int(audioframe_buffer[x_pixel])-height2);
+			if (max_graph_y_pixel < y_pixel)
+				max_graph_y_pixel = y_pixel;
+		}
+	}
+	// Silence, or audio offset beyond the clip, fits at any scale.
+	if (max_graph_y_pixel == 0)
+		return 1;
+	int result = height2/max_graph_y_pixel;
+	return !result ? 1 : result;
+}
+
+
+template<class T>
+inline T Clamp(const T& _x, const T& _a, const T& _b)
+{
+	if (_x < _a)
+		return _a;
+	else if (_x > _b)
+		return _b;
+	return _x;
+}
+
+
+/*
+ * AudioGraph::Deinterleave
+ * 
+ * Split 8-bit or 16-bit interleaved audio data into the float channel planes
+ * of channel_buffers, scaled to [-1, 1).  Wide layouts are transposed 8
+ * channels at a time (see channels.h).
+ * 
+ * Parameters:
+ *   src        The interleaved audio data.
+ *   count      The number of samples (per channel) in src.
+ */
+void AudioGraph::Deinterleave(const uint8_t *src, int count)
+{
+	if (audio_vi.SampleType() == SAMPLE_INT16)
+		Deinterleave16((const int16_t*)src, audio_vi.AudioChannels(), count, 1.0f / 32768, m_channel_buffers, channel_stride);
+	else
+		Deinterleave8(src, audio_vi.AudioChannels(), count, 1.0f / 128, m_channel_buffers, channel_stride);
+}
 
 
 /*
- * AudioGraph::FillAudioFrame16
+ * AudioGraph::FillAudioFrame
  * 
- * Fill an audioframe buffer from the 16-bit audio data in audio_buffer.  If
- * the source is stereo, the channels are averaged.  The resulting Y pixel
- * coordinates are stored into the given audioframe buffer.
+ * Fill an audioframe buffer from the channel planes.  In wave mode the
+ * samples of all channels are averaged; in correlation mode the phase
+ * correlation of the first two channels is computed for each pixel.  The
+ * resulting Y pixel coordinates are stored into the given audioframe buffer.
  * 
  * Parameters:
  *   audioframe_buffer     A pointer to the audioframe buffer to fill.
  */
-void AudioGraph::FillAudioFrame16(uint16_t *audioframe_buffer)
+void AudioGraph::FillAudioFrame(int64_t start, uint16_t *audioframe_buffer, IScriptEnvironment* env)
 {
 	int height2 = vi.height>>1;
+	int max_y_pixel = vi.height - 1 - height2;
+	int channels = audio_vi.AudioChannels();
+	int num_samples = 1 << log_samples_per_pixel;
+	const float wave_scale = vi.height * 0.5f / (num_samples * channels);
+	const float db_scale = (float)DB_LUT_SIZE / (num_samples * channels);
+	const float sample_scale = (audio_vi.SampleType() == SAMPLE_INT16) ? 1.0f / 32768.0f : 1.0f / 128.0f;
 	for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
 	{
 		if (x_pixel >= (int)m_sample_ranges_size)
-			m_env->ThrowError("AudioGraph: x pixel 16");
-		uint8_t *src = m_sample_ranges[x_pixel];
-		int y_pixel = 0;
-		int num_samples = 1 << log_mono_samples_per_pixel;
-		while (num_samples--)
+			m_env->ThrowError("AudioGraph: x pixel");
+		const float *src = &m_channel_buffers[m_sample_ranges[x_pixel]];
+		int y_pixel;
+		if (mode == MODE_CORRELATION)
+		{
+			const float *left = src;
+			const float *right = src + channel_stride;
+			float lr = 0.0f, ll = 0.0f, rr = 0.0f;
+			for (int i = 0; i < num_samples; i++)
+			{
+				lr += left[i] * right[i];
+				ll += left[i] * left[i];
+				rr += right[i] * right[i];
+			}
+			// Silence has no defined correlation; graph it as 0.
+			float correlation = (ll > 0.0f && rr > 0.0f) ? lr / sqrtf(ll * rr) : 0.0f;
+			y_pixel = (int)(correlation * height2);
+		}
+		else
 		{
-			y_pixel += *(short*)src;
-			src += 2;
+			float sum = 0.0f;
+			if (m_sums)
+				sum = m_sums->Sum(start + m_sample_ranges[x_pixel], num_samples, env) * sample_scale;
+			else
+			{
+				for (int channel = 0; channel < channels; channel++)
+				{
+					const float *plane = src + channel * channel_stride;
+					for (int i = 0; i < num_samples; i++)
+						sum += plane[i];
+				}
+			}
+			if (db)
+			{
+				int magnitude = (int)(fabsf(sum) * db_scale);
+				y_pixel = m_db_lut[(magnitude < DB_LUT_SIZE) ? magnitude : DB_LUT_SIZE];
+				if (sum < 0.0f)
+					y_pixel = -y_pixel;
+			}
+			else
+				y_pixel = (int)(sum * wave_scale) * graph_scale;
 		}
-		y_pixel >>= log_mono_samples_per_pixel;
-		y_pixel = Clamp((y_pixel * vi.height / 65536) * graph_scale, -height2, height2);
+		y_pixel = Clamp(y_pixel, -height2, max_y_pixel);
 		audioframe_buffer[x_pixel] = (uint16_t)(height2 + y_pixel);
 	}
 }
 
 
 /*
- * AudioGraph::GetAudioFrame
+ * AudioGraph::FillGoniometer
+ * 
+ * Accumulate the first two channel planes of the whole audioframe into a
+ * goniometer density image.  Mid (L+R) runs up the image and side (L-R)
+ * across it, so mono audio is a vertical line and an inverted channel is a
+ * horizontal one.  Cell indices are computed four samples at a time with
+ * SSE2; only the increments themselves are scalar.
+ * 
+ * Parameters:
+ *   goniometer_buffer     A pointer to the goniometer buffer to fill.
+ */
+void AudioGraph::FillGoniometer(uint8_t *goniometer_buffer)
+{
+	const int size = 1 << log_goniometer_size;
+	const int cells = size * size;
+	const float *left = m_channel_buffers;
+	const float *right = m_channel_buffers + channel_stride;
+
+	memset(m_goniometer_counts, 0, cells * sizeof(uint16_t));
+
+	// Half the width per unit of mid/side, which is (L+R)/2 and (L-R)/2.
+	const __m128 half_size = _mm_set1_ps(size * 0.5f);
+	const __m128 scale = _mm_set1_ps(size * 0.25f);
+	const __m128 lowest = _mm_setzero_ps();
+	const __m128 highest = _mm_set1_ps(size - 1.0f);
+	alignas(16) int32_t cell[4];
+
+	int i = 0;
+	for (; i + 4 <= frame_length; i += 4)
+	{
+		__m128 l = _mm_loadu_ps(left + i);
+		__m128 r = _mm_loadu_ps(right + i);
+		__m128 x = _mm_add_ps(half_size, _mm_mul_ps(_mm_sub_ps(l, r), scale));
+		__m128 y = _mm_sub_ps(half_size, _mm_mul_ps(_mm_add_ps(l, r), scale));
+		x = _mm_min_ps(_mm_max_ps(x, lowest), highest);
+		y = _mm_min_ps(_mm_max_ps(y, lowest), highest);
+		__m128i index = _mm_add_epi32(_mm_slli_epi32(_mm_cvttps_epi32(y), log_goniometer_size), _mm_cvttps_epi32(x));
+		_mm_store_si128((__m128i*)cell, index);
+		m_goniometer_counts[cell[0]]++;
+		m_goniometer_counts[cell[1]]++;
+		m_goniometer_counts[cell[2]]++;
+		m_goniometer_counts[cell[3]]++;
+	}
+	for (; i < frame_length; i++)
+	{
+		int x = Clamp((int)(size * 0.5f + (left[i] - right[i]) * size * 0.25f), 0, size - 1);
+		int y = Clamp((int)(size * 0.5f - (left[i] + right[i]) * size * 0.25f), 0, size - 1);
+		m_goniometer_counts[(y << log_goniometer_size) + x]++;
+	}
+
+	for (int c = 0; c < cells; c++)
+	{
+		int count = m_goniometer_counts[c];
+		goniometer_buffer[c] = (uint8_t)((count) ? Clamp(96 + (count << 4), 0, 255) : 0);
+	}
+}
+
+
+/*
+ * AudioGraph::RestoreBandState
+ * 
+ * Set up the filterbank state for the start of an audioframe.  If the
+ * previous audioframe is still cached, its checkpoint is used.  Otherwise
+ * the filters are warmed up from silence over a short preroll of audio
+ * before the audioframe; this uses audio_buffer, so it must be done before
+ * the audioframe itself is read.
+ * 
+ * Parameters:
+ *   frame      The frame whose audioframe is about to be generated.
+ *   start      The first audio sample of that frame.
+ *   state      Receives the filter state (z1 and z2 for each band).
+ */
+void AudioGraph::RestoreBandState(int frame, int64_t start, __m128 *state, IScriptEnvironment* env)
+{
+	int previous_index = (frame - 1) & (num_audioframe_buffers - 1);
+	if (m_cache_lookup[previous_index] == frame - 1)
+	{
+		state[0] = _mm_loadu_ps(&m_band_checkpoints[previous_index * 8]);
+		state[1] = _mm_loadu_ps(&m_band_checkpoints[previous_index * 8 + 4]);
+		return;
+	}
+	state[0] = state[1] = _mm_setzero_ps();
+	ReadAudio(m_audio_buffer, start - band_preroll, band_preroll, env);
+	Deinterleave(m_audio_buffer, band_preroll);
+	RunFilterbank(band_preroll, state, NULL);
+}
+
+
+/*
+ * AudioGraph::RunFilterbank
+ * 
+ * Run the mono mix of the channel planes through the three-band filterbank,
+ * as a transposed direct form II biquad with one band per SSE lane.
+ * 
+ * Parameters:
+ *   count      The number of samples to filter.
+ *   state      The filter state, updated in place.
+ *   output     Receives 4 floats (one per lane) per sample, or NULL.
+ */
+void AudioGraph::RunFilterbank(int count, __m128 *state, float *output)
+{
+	const int channels = audio_vi.AudioChannels();
+	const float mix = 1.0f / channels;
+	const __m128 b0 = _mm_loadu_ps(m_band_coefficients[0]);
+	const __m128 b1 = _mm_loadu_ps(m_band_coefficients[1]);
+	const __m128 b2 = _mm_loadu_ps(m_band_coefficients[2]);
+	const __m128 a1 = _mm_loadu_ps(m_band_coefficients[3]);
+	const __m128 a2 = _mm_loadu_ps(m_band_coefficients[4]);
+	__m128 z1 = state[0], z2 = state[1];
+
+	for (int i = 0; i < count; i++)
+	{
+		float mono = 0.0f;
+		for (int channel = 0; channel < channels; channel++)
+			mono += m_channel_buffers[channel * channel_stride + i];
+		__m128 x = _mm_set1_ps(mono * mix);
+		__m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+		z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+		z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+		if (output)
+			_mm_storeu_ps(output + i * 4, y);
+	}
+	state[0] = z1;
+	state[1] = z2;
+}
+
+
+/*
+ * AudioGraph::FillBandColours
+ * 
+ * Filter the audioframe in the channel planes, and fill a buffer of band
+ * palette indices, one per X pixel.  The final filter state is stored in the
+ * audioframe's checkpoint.
+ * 
+ * Parameters:
+ *   colour_buffer  A pointer to the band colour buffer to fill.
+ *   state          The filter state at the start of the audioframe.
+ *   checkpoint     Receives the filter state at the end of the audioframe.
+ */
+void AudioGraph::FillBandColours(uint16_t *colour_buffer, __m128 *state, float *checkpoint)
+{
+	int num_samples = 1 << log_samples_per_pixel;
+	RunFilterbank(frame_length, state, m_band_buffer);
+	_mm_storeu_ps(checkpoint, state[0]);
+	_mm_storeu_ps(checkpoint + 4, state[1]);
+
+	for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
+	{
+		const float *src = &m_band_buffer[m_sample_ranges[x_pixel] * 4];
+		__m128 energy = _mm_setzero_ps();
+		for (int i = 0; i < num_samples; i++)
+		{
+			__m128 y = _mm_loadu_ps(src + i * 4);
+			energy = _mm_add_ps(energy, _mm_mul_ps(y, y));
+		}
+		alignas(16) float band[4];
+		_mm_store_ps(band, _mm_sqrt_ps(energy));
+		float total = band[0] + band[1] + band[2];
+		if (total < 1e-6f * num_samples)
+		{
+			colour_buffer[x_pixel] = 0;
+			continue;
+		}
+		float scale = 15.0f / total;
+		int low = (int)(band[0] * scale + 0.5f);
+		int mid = (int)(band[1] * scale + 0.5f);
+		int high = (int)(band[2] * scale + 0.5f);
+		colour_buffer[x_pixel] = (uint16_t)((low << 8) | (mid << 4) | high);
+	}
+}
+
+
+/*
+ * AudioGraph::MixToMono
+ * 
+ * Average the channels of 8-bit or 16-bit interleaved audio into one float
+ * plane, scaled to [-1, 1).
+ * 
+ * Parameters:
+ *   raw        The interleaved audio.
+ *   count      The number of samples (per channel).
+ *   mono       Receives count floats.
+ */
+void AudioGraph::MixToMono(const uint8_t *raw, int count, float *mono)
+{
+	int channels = audio_vi.AudioChannels();
+	if (audio_vi.SampleType() == SAMPLE_INT16)
+		Downmix16((const int16_t*)raw, channels, count, 1.0f / (32768.0f * channels), mono);
+	else
+		Downmix8(raw, channels, count, 1.0f / (128.0f * channels), mono);
+}
+
+
+/*
+ * Division rounding towards plus infinity, also for negative sample
+ * positions (frames before the start of the clip).
+ */
+static inline int64_t CeilDiv(int64_t a, int64_t b)
+{
+	return (a >= 0) ? (a + b - 1) / b : -((-a) / b);
+}
+
+
+static inline int64_t FloorDiv(int64_t a, int64_t b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+
+/*
+ * AudioGraph::DetectOnsets
+ * 
+ * Find the onsets in the audioframe starting at the given sample.  Hop h is
+ * centred on sample h * onset_hop, and belongs to the audioframe containing
+ * that sample.  If the flux of the hops just before this audioframe is still
+ * in the ring (because the previous audioframe was the last one analysed),
+ * only the new hops are computed; otherwise the detector is primed from the
+ * audio before the audioframe.
+ * 
+ * Parameters:
+ *   start              The first audio sample of the audioframe.
+ *   onset_count        Receives the number of onsets found.
+ *   onset_positions    Receives the X pixel offset of each onset.
+ */
+void AudioGraph::DetectOnsets(int64_t start, uint8_t *onset_count, uint16_t *onset_positions, IScriptEnvironment* env)
+{
+	const int bins = m_onset_fft->Bins();
+	const int64_t mask = onset_history_size - 1;
+	const int64_t first_hop = CeilDiv(start, onset_hop);
+	const int64_t last_hop = CeilDiv(start + frame_length, onset_hop) - 1;
+	// The earliest hop whose spectrum is needed, as the predecessor of the
+	// earliest hop whose flux is needed.
+	const int64_t prime_hop = first_hop - ONSET_MEAN_HOPS - 1;
+
+	bool primed = onset_next_hop > prime_hop && onset_next_hop <= last_hop + 2 && onset_valid_from <= prime_hop + 1;
+	int64_t compute_from = (primed) ? onset_next_hop : prime_hop;
+	if (!primed)
+		onset_valid_from = prime_hop + 1;
+
+	int count = (int)((last_hop + 1 - compute_from) * onset_hop + m_onset_fft->Size());
+	if ((size_t)count > m_onset_mono_size)
+		m_env->ThrowError("AudioGraph: onset buffer size");
+	ReadAudio(m_onset_audio, compute_from * onset_hop - m_onset_fft->Size() / 2, count, env);
+	MixToMono(m_onset_audio, count, m_onset_mono);
+
+	for (int64_t hop = compute_from; hop <= last_hop + 1; hop++)
+	{
+		m_onset_fft->Magnitudes(&m_onset_mono[(hop - compute_from) * onset_hop], m_onset_current);
+		float flux = 0.0f;
+		for (int k = 0; k < bins; k++)
+		{
+			m_onset_current[k] = logf(1.0f + 100.0f * m_onset_current[k]);
+			float rise = m_onset_current[k] - m_onset_previous[k];
+			if (rise > 0.0f)
+				flux += rise;
+		}
+		// The priming hop has no predecessor, and only serves as one.
+		m_onset_flux[hop & mask] = (hop == onset_valid_from - 1) ? 0.0f : flux / bins;
+		float *swap = m_onset_previous;
+		m_onset_previous = m_onset_current;
+		m_onset_current = swap;
+	}
+	onset_next_hop = last_hop + 2;
+
+	int found = 0;
+	for (int64_t hop = first_hop; hop <= last_hop && found < MAX_ONSETS_PER_FRAME; hop++)
+	{
+		float mean = 0.0f;
+		for (int back = 1; back <= ONSET_MEAN_HOPS; back++)
+			mean += m_onset_flux[(hop - back) & mask];
+		mean /= ONSET_MEAN_HOPS;
+		float flux = m_onset_flux[hop & mask];
+		if (flux > mean * ONSET_RATIO + ONSET_DELTA && flux >= m_onset_flux[(hop - 1) & mask] && flux > m_onset_flux[(hop + 1) & mask])
+			onset_positions[found++] = (uint16_t)((hop * onset_hop - start) * pixels_per_audioframe / frame_length);
+	}
+	*onset_count = (uint8_t)found;
+}
+
+
+/*
+ * AudioGraph::DetectVoice
+ * 
+ * Fill the voice activity lane of the audioframe starting at the given
+ * sample.  Hop h covers samples [h * hop, (h + 1) * hop), and belongs to
+ * every audioframe it overlaps.  If the previous audioframe was the last one
+ * analysed, the detector continues where it stopped (reusing its decision
+ * for a shared hop); otherwise it is reset and run over the hangover period
+ * before the audioframe first.
+ * 
+ * Parameters:
+ *   start      The first audio sample of the audioframe.
+ *   lane       Receives one speech flag per X pixel.
+ */
+void AudioGraph::DetectVoice(int64_t start, uint8_t *lane, IScriptEnvironment* env)
+{
+	const int hop = m_vad->Hop();
+	const int64_t first_hop = FloorDiv(start, hop);
+	const int64_t last_hop = FloorDiv(start + frame_length - 1, hop);
+
+	int64_t compute_from = vad_next_hop;
+	if (compute_from == first_hop + 1)
+		m_vad_decisions[0] = vad_last_decision;
+	else if (compute_from != first_hop)
+	{
+		compute_from = first_hop - VAD_HANGOVER_HOPS;
+		m_vad->Reset();
+	}
+
+	if (compute_from <= last_hop)
+	{
+		int count = (int)((last_hop + 1 - compute_from) * hop);
+		if ((size_t)count > m_vad_mono_size)
+			m_env->ThrowError("AudioGraph: vad buffer size");
+		ReadAudio(m_vad_audio, compute_from * hop, count, env);
+		MixToMono(m_vad_audio, count, m_vad_mono);
+		for (int64_t h = compute_from; h <= last_hop; h++)
+		{
+			bool speech = m_vad->Process(&m_vad_mono[(h - compute_from) * hop]);
+			if (h >= first_hop)
+				m_vad_decisions[h - first_hop] = speech;
+			vad_last_decision = speech;
+		}
+	}
+	vad_next_hop = last_hop + 1;
+
+	int half_range = (1 << log_samples_per_pixel) / 2;
+	for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
+	{
+		int64_t h = FloorDiv(start + m_sample_ranges[x_pixel] + half_range, hop);
+		lane[x_pixel] = m_vad_decisions[Clamp(h, first_hop, last_hop) - first_hop];
+	}
+}
+
+
+/*
+ * AudioGraph::ExportVoiceSegments
+ * 
+ * Run the voice activity detector over the whole clip, reading the audio in
+ * large batches, and write the speech segments to a text file.  Each line
+ * holds the first and last frame of a segment, followed by its start and
+ * end time in seconds.
+ * 
+ * Parameters:
+ *   filename   The file to write.
+ */
+void AudioGraph::ExportVoiceSegments(const char* filename, IScriptEnvironment* env)
+{
+	VoiceDetector detector(audio_vi.audio_samples_per_second);
+	const int hop = detector.Hop();
+	const int hops_per_batch = 1024;
+	std::vector<uint8_t> raw((size_t)hops_per_batch * hop * audio_vi.BytesPerAudioSample());
+	std::vector<float> mono((size_t)hops_per_batch * hop);
+	const int64_t total_hops = CeilDiv(audio_vi.num_audio_samples, hop);
+	const double rate = audio_vi.audio_samples_per_second;
+
+	OutputFile file(fopen(filename, "w"));
+	if (!file.get())
+		env->ThrowError("AudioGraph: cannot open vad_file \"%s\"", filename);
+	fprintf(file.get(), "# AudioGraph voice activity segments\n# first_frame last_frame start_seconds end_seconds\n");
+
+	bool in_speech = false;
+	int64_t segment_start = 0;
+	auto write_segment = [&](int64_t segment_end)
+	{
+		// Segments are reported in video time, so the offset is taken off.
+		int64_t first = segment_start - offset_samples, last = segment_end - offset_samples;
+		fprintf(file.get(), "%d %d %.3f %.3f\n", FrameFromSample(first, env), FrameFromSample(last - 1, env), first / rate, last / rate);
+	};
+	for (int64_t batch = 0; batch < total_hops; batch += hops_per_batch)
+	{
+		int hops = (int)((total_hops - batch < hops_per_batch) ? total_hops - batch : hops_per_batch);
+		m_audio->GetAudio(raw.data(), batch * hop, (int64_t)hops * hop, env);
+		MixToMono(raw.data(), hops * hop, mono.data());
+		for (int i = 0; i < hops; i++)
+		{
+			bool speech = detector.Process(&mono[(size_t)i * hop]);
+			int64_t position = (batch + i) * hop;
+			if (speech && !in_speech)
+			{
+				in_speech = true;
+				segment_start = position;
+			}
+			else if (!speech && in_speech)
+			{
+				write_segment(position);
+				in_speech = false;
+			}
+		}
+	}
+	if (in_speech)
+		write_segment(audio_vi.num_audio_samples);
+}
+
+
+/*
+ * AudioGraph::ReadDropoutAudio
+ * 
+ * Read count samples from start into samples as 16-bit audio for the
+ * dropout detector.  8-bit audio is read into raw first and widened.
+ */
+void AudioGraph::ReadDropoutAudio(int64_t start, int count, int16_t *samples, uint8_t *raw, IScriptEnvironment* env)
+{
+	if (audio_vi.SampleType() == SAMPLE_INT16)
+	{
+		m_audio->GetAudio(samples, start, count, env);
+		return;
+	}
+	m_audio->GetAudio(raw, start, count, env);
+	size_t values = (size_t)count * audio_vi.AudioChannels();
+	for (size_t i = 0; i < values; i++)
+		samples[i] = (int16_t)((raw[i] - 128) * 256);
+}
+
+
+/*
+ * AudioGraph::DetectDropouts
+ * 
+ * Flag the X pixels of the audioframe starting at the given sample that
+ * overlap a suspected dropout, with the DROPOUT_* kinds found there.  The
+ * events are those found in the current span by ReadFrameAudio.
+ * 
+ * Parameters:
+ *   start      The first audio sample of the audioframe.
+ *   columns    Receives one set of flags per X pixel.
+ */
+void AudioGraph::DetectDropouts(int64_t start, uint8_t *columns)
+{
+	// A pixel is flagged if the samples it is drawn from overlap an event.
+	const int range = 1 << log_samples_per_pixel;
+	memset(columns, 0, pixels_per_audioframe);
+	for (size_t i = 0; i < m_dropout_events.size(); i++)
+	{
+		const DropoutEvent& event = m_dropout_events[i];
+		const int64_t first = event.start - start, end = first + event.length;
+		if (end <= 0 || first >= frame_length)
+			continue;
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe; x_pixel++)
+			if (m_sample_ranges[x_pixel] < end && m_sample_ranges[x_pixel] + range > first)
+				columns[x_pixel] |= (uint8_t)event.kind;
+	}
+}
+
+
+/*
+ * AudioGraph::IndexDropouts
+ * 
+ * Scan the whole clip for dropouts in large batches, each read with the
+ * detector's margin either side.  Events less than a second apart make one
+ * region, and the first frame of each region is kept for the frame
+ * properties.  If a file is given the regions are also written to it, one
+ * per line: the first and last frame, the start and end time in seconds,
+ * and the kinds of dropout found.
+ * 
+ * Parameters:
+ *   filename   The file to write, or NULL or empty for the index only.
+ */
+void AudioGraph::IndexDropouts(const char* filename, IScriptEnvironment* env)
+{
+	const int margin = m_dropouts->Margin();
+	const int batch = 1 << 18;
+	std::vector<int16_t> samples((size_t)(batch + 2 * margin) * audio_vi.AudioChannels());
+	std::vector<uint8_t> raw((audio_vi.SampleType() == SAMPLE_INT8) ? samples.size() : 0);
+	std::vector<DropoutEvent> events;
+	const double rate = audio_vi.audio_samples_per_second;
+	const int64_t join = audio_vi.audio_samples_per_second;
+
+	// The file is closed however the scan ends, as reading the audio may throw.
+	OutputFile file((filename && *filename) ? fopen(filename, "w") : NULL);
+	if (filename && *filename && !file.get())
+		env->ThrowError("AudioGraph: cannot open dropout_file \"%s\"", filename);
+	if (file.get())
+		fprintf(file.get(), "# AudioGraph suspected dropouts\n# first_frame last_frame start_seconds end_seconds kinds\n");
+
+	int64_t region_start = -1, region_end = -1;
+	int region_kinds = 0;
+	auto write_region = [&]()
+	{
+		// Regions are reported in video time, so the offset is taken off.
+		int64_t first = region_start - offset_samples, last = region_end - offset_samples;
+		int first_frame = FrameFromSample(first, env);
+		if (file.get())
+			fprintf(file.get(), "%d %d %.3f %.3f %s%s%s\n", first_frame, FrameFromSample(last - 1, env), first / rate, last / rate,
+				(region_kinds & DROPOUT_ZEROS) ? "z" : "", (region_kinds & DROPOUT_REPEAT) ? "r" : "", (region_kinds & DROPOUT_STEP) ? "s" : "");
+		if (m_dropout_frames.empty() || m_dropout_frames.back() != first_frame)
+			m_dropout_frames.push_back(first_frame);
+	};
+	for (int64_t position = 0; position < audio_vi.num_audio_samples; position += batch)
+	{
+		int count = (int)((audio_vi.num_audio_samples - position < batch) ? audio_vi.num_audio_samples - position : batch);
+		ReadDropoutAudio(position - margin, count + 2 * margin, samples.data(), raw.data(), env);
+		events.clear();
+		m_dropouts->Scan(samples.data(), count + 2 * margin, position - margin, events);
+		// Each event is taken from the batch it starts in, in order of position.
+		std::sort(events.begin(), events.end(), [](const DropoutEvent& a, const DropoutEvent& b) { return a.start < b.start; });
+		for (size_t i = 0; i < events.size(); i++)
+		{
+			const DropoutEvent& event = events[i];
+			if (event.start < position || event.start >= position + count)
+				continue;
+			if (region_start >= 0 && event.start > region_end + join)
+			{
+				write_region();
+				region_start = -1;
+			}
+			if (region_start < 0)
+			{
+				region_start = event.start;
+				region_end = event.start;
+				region_kinds = 0;
+			}
+			if (event.start + event.length > region_end)
+				region_end = event.start + event.length;
+			region_kinds |= event.kind;
+		}
+	}
+	if (region_start >= 0)
+		write_region();
+	dropout_index = true;
+}
+
+
+/*
+ * AudioGraph::FillSpectrum
+ * 
+ * Compute the spectrogram columns of the audioframe starting at the given
+ * sample.  Neighbouring pixels whose blocks are centred on the same sample
+ * (when there are more pixels than samples) share one transform.
+ * 
+ * Parameters:
+ *   start      The first audio sample of the audioframe.
+ *   columns    Receives spectrum_bands bytes per X pixel.
+ */
+void AudioGraph::FillSpectrum(int64_t start, uint8_t *columns, IScriptEnvironment* env)
+{
+	const int size = m_spectrum_ffts[0]->Size();
+	const int bins = m_spectrum_ffts[0]->Bins();
+	const float db_scale = 255.0f / 90.0f;
+	const int half_range = (1 << log_samples_per_pixel) / 2;
+
+	ReadAudio(m_spectrum_audio, start - size / 2, frame_length + size, env);
+	MixToMono(m_spectrum_audio, frame_length + size, m_spectrum_mono);
+
+	// Each thread of the pool works in its own lane.
+	auto fill = [&](int first, int last, int lane)
+	{
+		FFT* fft = m_spectrum_ffts[lane].get();
+		float* powers = &m_spectrum_powers[(size_t)lane * bins];
+		float* band_powers = &m_spectrum_band_powers[(size_t)lane * spectrum_bands];
+		int previous_centre = -1;
+		for (int x_pixel = first; x_pixel < last; x_pixel++)
+		{
+			uint8_t* column = &columns[(size_t)x_pixel * spectrum_bands];
+			int centre = m_sample_ranges[x_pixel] + half_range;
+			if (centre == previous_centre)
+			{
+				memcpy(column, column - spectrum_bands, spectrum_bands);
+				continue;
+			}
+			previous_centre = centre;
+
+			fft->Magnitudes(&m_spectrum_mono[centre], powers);
+			for (int bin = 0; bin < bins; bin++)
+				powers[bin] *= powers[bin];
+			m_spectrum_filterbank->Apply(powers, band_powers);
+			for (int band = 0; band < spectrum_bands; band++)
+			{
+				float db = 10.0f * log10f(band_powers[band] / spectrum_reference + 1e-12f);
+				column[band] = (uint8_t)Clamp((int)((db + 90.0f) * db_scale), 0, 255);
+			}
+		}
+	};
+	if (m_spectrum_ffts.size() > 1)
+		m_pool->ParallelFor(pixels_per_audioframe, (int)m_spectrum_ffts.size(), fill);
+	else
+		fill(0, pixels_per_audioframe, 0);
+}
+
+
+/*
+ * AudioGraph::ReadTimecodes
+ * 
+ * Read a v2 timecode file: one frame start time in milliseconds per line,
+ * after a "# timecode format v2" header.  Other comment lines are skipped.
+ */
+void AudioGraph::ReadTimecodes(const char* filename, IScriptEnvironment* env)
+{
+	FILE* file = fopen(filename, "r");
+	if (!file)
+		env->ThrowError("AudioGraph: cannot open timecodes \"%s\"", filename);
+	char line[256];
+	bool header = false;
+	while (fgets(line, sizeof(line), file))
+	{
+		if (line[0] == '#')
+		{
+			header = header || strstr(line, "v2");
+			continue;
+		}
+		double ms;
+		if (sscanf(line, "%lf", &ms) == 1)
+			m_timecodes.push_back(ms / 1000.0);
+	}
+	fclose(file);
+	if (!header)
+		env->ThrowError("AudioGraph: timecodes must be a v2 timecode file");
+	if (m_timecodes.empty())
+		env->ThrowError("AudioGraph: timecodes file \"%s\" is empty", filename);
+}
+
+
+/*
+ * AudioGraph::BuildFrameIndexBlock
+ * 
+ * Add the next FRAME_INDEX_BLOCK entries to the frame index.  Entry f is the
+ * first audio sample of frame f, for f from 0 to vi.num_frames (the end of
+ * the clip).  Start times come from the timecode file, extended at the
+ * nominal rate past its end; or they are the sum of the previous frames'
+ * _DurationNum / _DurationDen, frames without them counting as nominal.
+ */
+void AudioGraph::BuildFrameIndexBlock(IScriptEnvironment* env)
+{
+	const double nominal = (double)vi.fps_denominator / vi.fps_numerator;
+	const double rate = audio_vi.audio_samples_per_second;
+	int first = (int)m_frame_starts.size() * FRAME_INDEX_BLOCK;
+	int last = (first + FRAME_INDEX_BLOCK < vi.num_frames + 1) ? first + FRAME_INDEX_BLOCK : vi.num_frames + 1;
+	std::vector<int64_t> starts(last - first);
+	for (int frame = first; frame < last; frame++)
+	{
+		double time;
+		if (!m_timecodes.empty())
+		{
+			int known = (int)m_timecodes.size();
+			time = (frame < known) ? m_timecodes[frame] : m_timecodes[known - 1] + (frame - known + 1) * nominal;
+		}
+		else
+		{
+			time = frame_index_time;
+			if (frame < vi.num_frames)
+			{
+				PVideoFrame src = child->GetFrame(frame, env);
+				const AVSMap* props = env->getFramePropsRO(src);
+				int error_num, error_den;
+				int64_t num = env->propGetInt(props, "_DurationNum", 0, &error_num);
+				int64_t den = env->propGetInt(props, "_DurationDen", 0, &error_den);
+				frame_index_time += (error_num || error_den || num <= 0 || den <= 0) ? nominal : (double)num / den;
+			}
+		}
+		starts[frame - first] = (int64_t)floor(time * rate + 0.5);
+	}
+	m_frame_starts.push_back(starts);
+}
+
+
+/*
+ * AudioGraph::FrameStart
+ * 
+ * The first audio sample of a frame.  At a constant frame rate this is
+ * frame * rate / fps rounded down, in exact 64-bit rational arithmetic, so
+ * that consecutive frames cover the audio without gaps or overlaps, before
+ * the clip too.  With variable frame rate it is a lookup in the frame index,
+ * building it up to the frame first if necessary; frames outside the clip
+ * are extended at the nominal rate.
+ */
+int64_t AudioGraph::FrameStart(int frame, IScriptEnvironment* env)
+{
+	if (!vfr || frame < 0)
+		return FloorDiv((int64_t)frame * audio_vi.audio_samples_per_second * vi.fps_denominator, vi.fps_numerator);
+	if (frame > vi.num_frames)
+		return FrameStart(vi.num_frames, env) + audio_vi.AudioSamplesFromFrames(frame - vi.num_frames);
+	size_t block = frame / FRAME_INDEX_BLOCK;
+	while (m_frame_starts.size() <= block)
+		BuildFrameIndexBlock(env);
+	return m_frame_starts[block][frame % FRAME_INDEX_BLOCK];
+}
+
+
+/*
+ * AudioGraph::FrameLength
+ * 
+ * The number of audio samples graphed for a frame: its own length, but at
+ * least one pixel's sample range and at most what the buffers can hold.  At
+ * a constant frame rate the length is exact, and only ever the nominal one
+ * or a sample more.
+ */
+int AudioGraph::FrameLength(int frame, IScriptEnvironment* env)
+{
+	int64_t length = FrameStart(frame + 1, env) - FrameStart(frame, env);
+	return (int)Clamp(length, (int64_t)1 << log_samples_per_pixel, (int64_t)max_samples_per_frame);
+}
+
+
+/*
+ * AudioGraph::FrameFromSample
+ * 
+ * The frame containing an audio sample; the inverse of FrameStart.  At a
+ * constant frame rate it is the last frame whose exact start is not after
+ * the sample.  With variable frame rate this builds the whole index and
+ * searches it.
+ */
+int AudioGraph::FrameFromSample(int64_t sample, IScriptEnvironment* env)
+{
+	if (!vfr)
+	{
+		int64_t rate = (int64_t)audio_vi.audio_samples_per_second * vi.fps_denominator;
+		return (int)FloorDiv((sample + 1) * vi.fps_numerator - 1, rate);
+	}
+	int low = 0, high = vi.num_frames;
+	while (low < high)
+	{
+		int middle = low + (high - low + 1) / 2;
+		if (FrameStart(middle, env) <= sample)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return low;
+}
+
+
+/*
+ * AudioGraph::SetFrameLength
+ * 
+ * Spread the pixels of an audioframe over a new number of samples.  With a
+ * constant frame rate the length only changes by the odd sample.
+ */
+void AudioGraph::SetFrameLength(int length)
+{
+	if (length == frame_length)
+		return;
+	frame_length = length;
+	int start_of_last_sample_range = frame_length - (1 << log_samples_per_pixel);
+	for (int x_pixel = 1; x_pixel < pixels_per_audioframe; x_pixel++)
+		m_sample_ranges[x_pixel] = (int)((int64_t)x_pixel * start_of_last_sample_range / (pixels_per_audioframe - 1));
+}
+
+
+/*
+ * AudioGraph::ReadFrameAudio
+ * 
+ * Get the interleaved audio of a frame that is about to be generated.  The
+ * audio is read in spans: on a miss, the run of visible frames around this
+ * one that still need generating, up to AUDIO_SPAN_FRAMES, is read from the
+ * child in one request, along with span_lead samples before it and
+ * span_trail after it for the detectors (see ReadAudio).  As frame ranges
+ * are exact the span has no gaps, and the frames after this one are then
+ * served from it.  The dropout detector scans each span once, for all of
+ * its audioframes.
+ * 
+ * Parameters:
+ *   frame      The frame.
+ *   start      Its first audio sample, offset included; frame_length must
+ *              already be set.
+ */
+const uint8_t *AudioGraph::ReadFrameAudio(int frame, int64_t start, IScriptEnvironment* env)
+{
+	if (start - span_lead < span_start || start + frame_length + span_trail > span_start + span_length)
+	{
+		auto missing = [&](int other)
+		{
+			return other >= window_first && other <= window_last && m_cache_lookup[other & (num_audioframe_buffers - 1)] != other;
+		};
+		int first = frame, last = frame;
+		while (last - first + 1 < AUDIO_SPAN_FRAMES && missing(last + 1))
+			last++;
+		while (last - first + 1 < AUDIO_SPAN_FRAMES && missing(first - 1))
+			first--;
+		int64_t end = FrameStart(last + 1, env) + offset_samples;
+		span_start = FrameStart(first, env) + offset_samples;
+		// Frame lengths are clamped with variable frame rate, so the span may need stretching or cutting back.
+		if (end < start + frame_length)
+			end = start + frame_length;
+		if ((size_t)(end - span_start + span_lead + span_trail) * bytes_per_sample > m_span_buffer_size)
+		{
+			span_start = start;
+			end = start + frame_length;
+		}
+		span_start -= span_lead;
+		span_length = end + span_trail - span_start;
+		m_audio->GetAudio(m_span_buffer, span_start, span_length, env);
+		if (dropouts)
+		{
+			const int16_t *samples = (const int16_t*)m_span_buffer;
+			if (audio_vi.SampleType() == SAMPLE_INT8)
+			{
+				size_t values = (size_t)span_length * audio_vi.AudioChannels();
+				for (size_t i = 0; i < values; i++)
+					m_dropout_audio[i] = (int16_t)((m_span_buffer[i] - 128) * 256);
+				samples = m_dropout_audio;
+			}
+			m_dropout_events.clear();
+			m_dropouts->Scan(samples, (int)span_length, span_start, m_dropout_events);
+		}
+	}
+	return &m_span_buffer[(size_t)(start - span_start) * bytes_per_sample];
+}
+
+
+/*
+ * AudioGraph::ReadAudio
+ * 
+ * Read count samples from start, from the current span when it holds them
+ * and from the child otherwise.
+ */
+void AudioGraph::ReadAudio(void *buffer, int64_t start, int64_t count, IScriptEnvironment* env)
+{
+	if (start >= span_start && start + count <= span_start + span_length)
+		memcpy(buffer, &m_span_buffer[(size_t)(start - span_start) * bytes_per_sample], (size_t)count * bytes_per_sample);
+	else
+		m_audio->GetAudio(buffer, start, count, env);
+}
+
+
+/*
+ * AudioGraph::GetAudioFrame
+ * 
+ * Get a pointer to the audioframe corresponding to the given video frame.  If
+ * the audioframe already exists in the cache, it is returned immediately.
+ * Otherwise it is generated from the raw audio data, stored in the cache, and
+ * returned.
+ *
+ * Parameters:
+ *   frame      The frame whose audioframe is needed.
+ *   env        A pointer to the IScriptEnvironment.
+ * 
+ * Returns:
+ *   A pointer to the audioframe buffer holding the requested audioframe.
+ */
+uint16_t *AudioGraph::GetAudioFrame(int frame, IScriptEnvironment* env)
+{
+	int audioframe_buffer_index, audioframe_index;
+	uint16_t *audioframe_buffer;
+
+	audioframe_index = frame & (num_audioframe_buffers - 1);
+	audioframe_buffer_index = audioframe_index * pixels_per_audioframe;
+	if (audioframe_buffer_index >= (int)m_audioframe_buffers_size)
+		m_env->ThrowError("AudioGraph: audioframe buffer index");
+	audioframe_buffer = &m_audioframe_buffers[audioframe_buffer_index];
+	if (audioframe_index >= (int)m_cache_lookup_size)
+		m_env->ThrowError("AudioGraph: audioframe index");
+	if (m_cache_lookup[audioframe_index] != frame)
+	{
+		if (audio_vi.SampleType() == SAMPLE_INT16) {
+			if ((size_t)max_samples_per_frame * 2 > m_audio_buffer_size)
+				m_env->ThrowError("AudGraph: invalid buf size 16");
+		} else if (audio_vi.SampleType() == SAMPLE_INT8) {
+			if ((size_t)max_samples_per_frame > m_audio_buffer_size)
+				m_env->ThrowError("AudGraph: invalid buf size 8");
+		} else {
+			m_env->ThrowError("AudGraph: invalid sample type");
+		}
+		int64_t start = FrameStart(frame, env) + offset_samples;
+		SetFrameLength(FrameLength(frame, env));
+		// The prefix sums need no audio, but the detectors are served from the span.
+		const uint8_t *audio = NULL;
+		if (!m_sums || onsets || vad || dropouts || spectrogram)
+			audio = ReadFrameAudio(frame, start, env);
+		__m128 band_state[2];
+		if (mode == MODE_BANDS)
+			RestoreBandState(frame, start, band_state, env);
+		if (!m_sums)
+			Deinterleave(audio, frame_length);
+		FillAudioFrame(start, audioframe_buffer, env);
+		if (goniometer)
+			FillGoniometer(&m_goniometer_buffers[(size_t)audioframe_index << (log_goniometer_size * 2)]);
+		if (mode == MODE_BANDS)
+			FillBandColours(&m_band_colour_buffers[audioframe_buffer_index], band_state, &m_band_checkpoints[audioframe_index * 8]);
+		if (onsets)
+			DetectOnsets(start, &m_onset_counts[audioframe_index], &m_onset_positions[audioframe_index * MAX_ONSETS_PER_FRAME], env);
+		if (vad)
+			DetectVoice(start, &m_vad_lanes[audioframe_buffer_index], env);
+		if (dropouts)
+			DetectDropouts(start, &m_dropout_columns[audioframe_buffer_index]);
+		if (spectrogram)
+			FillSpectrum(start, &m_spectrum_columns[(size_t)audioframe_buffer_index * spectrum_bands], env);
+		m_cache_lookup[audioframe_index] = frame;
+	}
+	return audioframe_buffer;
+}
+
+
+/*
+ * AudioGraph::GetGoniometer
+ * 
+ * Get a pointer to the goniometer image of the given video frame, generating
+ * its audioframe first if necessary.
+ */
+uint8_t *AudioGraph::GetGoniometer(int frame, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	return &m_goniometer_buffers[(size_t)(frame & (num_audioframe_buffers - 1)) << (log_goniometer_size * 2)];
+}
+
+
+/*
+ * AudioGraph::GetBandColours
+ * 
+ * Get a pointer to the band palette indices of the given video frame,
+ * generating its audioframe first if necessary.
+ */
+uint16_t *AudioGraph::GetBandColours(int frame, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	return &m_band_colour_buffers[(frame & (num_audioframe_buffers - 1)) * pixels_per_audioframe];
+}
+
+
+/*
+ * AudioGraph::GetOnsets
+ * 
+ * Get the onsets of the given video frame, generating its audioframe first
+ * if necessary.
+ * 
+ * Returns:
+ *   The number of onsets; onset_positions receives a pointer to their X
+ *   pixel offsets.
+ */
+int AudioGraph::GetOnsets(int frame, const uint16_t **onset_positions, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	int audioframe_index = frame & (num_audioframe_buffers - 1);
+	*onset_positions = &m_onset_positions[audioframe_index * MAX_ONSETS_PER_FRAME];
+	return m_onset_counts[audioframe_index];
+}
+
+
+/*
+ * AudioGraph::GetVoiceLane
+ * 
+ * Get a pointer to the voice activity lane of the given video frame,
+ * generating its audioframe first if necessary.
+ */
+uint8_t *AudioGraph::GetVoiceLane(int frame, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	return &m_vad_lanes[(frame & (num_audioframe_buffers - 1)) * pixels_per_audioframe];
+}
+
+
+/*
+ * AudioGraph::GetDropouts
+ * 
+ * Get a pointer to the dropout flags of each X pixel of the given video
+ * frame, generating its audioframe first if necessary.
+ */
+uint8_t *AudioGraph::GetDropouts(int frame, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	return &m_dropout_columns[(frame & (num_audioframe_buffers - 1)) * pixels_per_audioframe];
+}
+
+
+/*
+ * AudioGraph::GetSpectrum
+ * 
+ * Get a pointer to the spectrogram columns of the given video frame,
+ * generating its audioframe first if necessary.
+ */
+uint8_t *AudioGraph::GetSpectrum(int frame, IScriptEnvironment* env)
+{
+	GetAudioFrame(frame, env);
+	return &m_spectrum_columns[(size_t)(frame & (num_audioframe_buffers - 1)) * pixels_per_audioframe * spectrum_bands];
+}
+
+
+/*
+ * AudioGraph::ConvertColour
+ * 
+ * Convert an $RRGGBB colour to the byte values used by the clip's pixel
+ * layout, in Canvas plane order.  YUV formats use limited range BT.601.
+ */
+PixelColour AudioGraph::ConvertColour(int colour) const
+{
+	int a = (colour >> 24) & 0xFF;
+	int r = (colour >> 16) & 0xFF;
+	int g = (colour >> 8) & 0xFF;
+	int b = colour & 0xFF;
+	PixelColour result;
+	if (vi.IsYUY2() || vi.IsYV24())
+	{
+		result.c[0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		result.c[1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+		result.c[2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		result.c[3] = 0;
+	}
+	else if (vi.IsPlanarRGB() || vi.IsPlanarRGBA())
+	{
+		result.c[0] = (uint8_t)g;
+		result.c[1] = (uint8_t)b;
+		result.c[2] = (uint8_t)r;
+		result.c[3] = (uint8_t)a;
+	}
+	else
+	{
+		result.c[0] = (uint8_t)b;
+		result.c[1] = (uint8_t)g;
+		result.c[2] = (uint8_t)r;
+		result.c[3] = (uint8_t)a;
+	}
+	return result;
+}
+
+
+/*
+ * AudioGraph::DrawGoniometer
+ * 
+ * Blit a goniometer image into the top right corner of the canvas.
+ */
+void AudioGraph::DrawGoniometer(Canvas& canvas, const uint8_t *goniometer_buffer)
+{
+	const int size = 1 << log_goniometer_size;
+	const int margin = 8;
+	int x0 = canvas.width - size - margin;
+	if (x0 < 0 || size + margin > canvas.height)
+		return;
+	for (int y = 0; y < size; y++)
+	{
+		const uint8_t *row = goniometer_buffer + (y << log_goniometer_size);
+		for (int x = 0; x < size; x++)
+			canvas.Put(x0 + x, margin + y, m_goniometer_palette[row[x]]);
+	}
+}
+
+
+/*
+ * AudioGraph::DrawOnsets
+ * 
+ * Draw a tick at the top and bottom of the picture for every cached onset of
+ * the visible audioframes, into the onset layer.
+ */
+void AudioGraph::DrawOnsets(int n, IScriptEnvironment* env)
+{
+	int tick = vi.height / 8;
+	for (int i = 0; i < frames_either_side * 2 + 1; i++)
+	{
+		int x0 = i * pixels_per_audioframe;
+		if (x0 >= vi.width)
+			break;
+		if (Deferred(n - frames_either_side + i))
+			continue;
+		const uint16_t *onset_positions;
+		int onset_count = GetOnsets(n - frames_either_side + i, &onset_positions, env);
+		for (int onset = 0; onset < onset_count; onset++)
+		{
+			int x = x0 + onset_positions[onset];
+			if (x >= vi.width)
+				break;
+			if (tick > 0)
+			{
+				m_overlay->SetColumn(LAYER_ONSETS, x, 0, tick - 1);
+				m_overlay->SetColumn(LAYER_ONSETS, x, vi.height - tick, vi.height - 1);
+			}
+		}
+	}
+}
+
+
+/*
+ * AudioGraph::DrawVoiceLane
+ * 
+ * Fill a thin lane along the bottom of the picture wherever the visible
+ * audioframes contain speech, in the VAD layer.
+ */
+void AudioGraph::DrawVoiceLane(int n, IScriptEnvironment* env)
+{
+	int lane_height = vi.height / 32;
+	if (lane_height < 4)
+		lane_height = 4;
+	// The lane sits just above the minimap, if there is one.
+	int bottom = vi.height - minimap_height;
+	for (int i = 0; i < frames_either_side * 2 + 1; i++)
+	{
+		int x0 = i * pixels_per_audioframe;
+		if (x0 >= vi.width)
+			break;
+		if (Deferred(n - frames_either_side + i))
+			continue;
+		const uint8_t *lane = GetVoiceLane(n - frames_either_side + i, env);
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe && x0 + x_pixel < vi.width; x_pixel++)
+			if (lane[x_pixel])
+				m_overlay->SetColumn(LAYER_VAD, x0 + x_pixel, bottom - lane_height, bottom - 1);
+	}
+}
+
+
+/*
+ * AudioGraph::DrawDropouts
+ * 
+ * Fill the columns of the visible audioframes that hold a suspected dropout,
+ * from top to bottom, in the dropout layer behind the graph.
+ */
+void AudioGraph::DrawDropouts(int n, IScriptEnvironment* env)
+{
+	for (int i = 0; i < frames_either_side * 2 + 1; i++)
+	{
+		int x0 = i * pixels_per_audioframe;
+		if (x0 >= vi.width)
+			break;
+		if (Deferred(n - frames_either_side + i))
+			continue;
+		const uint8_t *columns = GetDropouts(n - frames_either_side + i, env);
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe && x0 + x_pixel < vi.width; x_pixel++)
+			if (columns[x_pixel])
+				m_overlay->SetColumn(LAYER_DROPOUTS, x0 + x_pixel, 0, vi.height - 1);
+	}
+}
+
+
+/*
+ * AudioGraph::LevelToY
+ * 
+ * The height above the centre line at which a constant level is graphed.
+ * 
+ * Parameters:
+ *   level      A linear level; 1 is full scale.
+ */
+int AudioGraph::LevelToY(double level) const
+{
+	if (db)
+		return m_db_lut[Clamp((int)(level * DB_LUT_SIZE), 0, DB_LUT_SIZE)];
+	return (int)(level * vi.height * 0.5) * graph_scale;
+}
+
+
+/*
+ * AudioGraph::BuildAxisLabels
+ * 
+ * Work out the Y axis labels once, as they only depend on the geometry and
+ * the scale: dB levels for the waveform, +1 / 0 / -1 for the correlation and
+ * frequencies for the spectrograms.  Labels that would overlap the previous
+ * one are dropped, and the top of the picture is kept clear for the frame
+ * labels.
+ */
+void AudioGraph::BuildAxisLabels()
+{
+	int height = vi.height;
+	int height2 = height >> 1;
+	int max_y_pixel = height - 1 - height2;
+	int glyph_height = m_glyphs->Height();
+	int top = glyph_height + 4;
+	int bottom = height - glyph_height;
+	int last_y = -height;
+
+	// y is in audioframe coordinates, growing upwards.
+	auto add = [&](int y, const char *text)
+	{
+		AxisLabel label;
+		label.y = Clamp(height - 1 - y - glyph_height / 2, top, bottom);
+		if (abs(label.y - last_y) < glyph_height + 2 || top > bottom)
+			return;
+		snprintf(label.text, sizeof(label.text), "%s", text);
+		m_axis_labels.push_back(label);
+		last_y = label.y;
+	};
+
+	if (mode == MODE_CORRELATION)
+	{
+		add(height - 1, "+1");
+		add(height2, "0");
+		add(0, "-1");
+	}
+	else if (spectrogram)
+	{
+		static const int frequencies[] = { 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000 };
+		for (int i = 0; i < (int)(sizeof(frequencies) / sizeof(frequencies[0])); i++)
+		{
+			int band = 0;
+			while (band < spectrum_bands && m_spectrum_filterbank->Centre(band) < frequencies[i])
+				band++;
+			if (band == 0 || band == spectrum_bands)
+				continue;
+			char text[16];
+			if (frequencies[i] >= 1000)
+				snprintf(text, sizeof(text), "%dkHz", frequencies[i] / 1000);
+			else
+				snprintf(text, sizeof(text), "%dHz", frequencies[i]);
+			add((band * 2 + 1) * height / (spectrum_bands * 2), text);
+		}
+	}
+	else
+	{
+		for (int db = 0; db >= -60; db -= 6)
+		{
+			int y = LevelToY(pow(10.0, db / 20.0));
+			if (y > max_y_pixel)
+				continue;
+			if (y < glyph_height)
+				break;
+			char text[16];
+			snprintf(text, sizeof(text), "%ddB", db);
+			add(height2 + y, text);
+		}
+	}
+}
+
+
+/*
+ * AudioGraph::DrawText
+ * 
+ * Copy a label from the glyph atlas into the label layers, clipped to the
+ * picture.  A later label covers an earlier one, ink and outline alike.
+ * 
+ * Parameters:
+ *   x, y       The top left corner of the label.
+ *   text       The label; characters missing from the font are left blank.
+ */
+void AudioGraph::DrawText(int x, int y, const char *text)
+{
+	int width = m_glyphs->Width();
+	int height = m_glyphs->Height();
+	for (; *text; text++, x += m_glyphs->Advance())
+	{
+		const uint8_t *glyph = m_glyphs->Glyph(*text);
+		if (!glyph)
+			continue;
+		for (int gy = 0; gy < height; gy++)
+		{
+			if (y + gy < 0 || y + gy >= vi.height)
+				continue;
+			for (int gx = 0; gx < width; gx++)
+			{
+				uint8_t coverage = glyph[gy * width + gx];
+				if (!coverage)
+					continue;
+				int layer = (coverage == GLYPH_INK) ? LAYER_INK : LAYER_OUTLINE;
+				m_overlay->Set(layer, x + gx, y + gy);
+				m_overlay->Unset(LAYER_INK + LAYER_OUTLINE - layer, x + gx, y + gy);
+			}
+		}
+	}
+}
+
+
+/*
+ * AudioGraph::DrawLabels
+ * 
+ * Label every label_step'th audioframe boundary with its frame number or
+ * timecode, and draw the Y axis labels down the left edge.
+ */
+void AudioGraph::DrawLabels(int n, IScriptEnvironment* env)
+{
+	char text[16];
+	for (int i = 0; i * pixels_per_audioframe < vi.width; i++)
+	{
+		int frame = n - frames_either_side + i;
+		if (frame < 0 || frame >= vi.num_frames || frame % label_step)
+			continue;
+		if (labels == LABELS_TIMECODE)
+		{
+			int64_t ms = (vfr) ? FrameStart(frame, env) * 1000 / audio_vi.audio_samples_per_second : (int64_t)frame * vi.fps_denominator * 1000 / vi.fps_numerator;
+			snprintf(text, sizeof(text), "%02d:%02d:%02d.%03d", (int)(ms / 3600000), (int)(ms / 60000 % 60), (int)(ms / 1000 % 60), (int)(ms % 1000));
+		}
+		else
+			snprintf(text, sizeof(text), "%d", frame);
+		DrawText(i * pixels_per_audioframe + 2, 2, text);
+	}
+
+	for (size_t i = 0; i < m_axis_labels.size(); i++)
+		DrawText(2, m_axis_labels[i].y, m_axis_labels[i].text);
+}
+
+
+/*
+ * AudioGraph::BuildGrid
+ * 
+ * The horizontal grid lines never move, so their picture rows are worked
+ * out once and filled in the grid layer of every frame.  The rows are the
+ * centre line and the -6 and -12 dB levels either side of it for
+ * the waveform, or 0 and +-0.5 for the correlation.  Spectrograms have no
+ * level axis, so they only get the vertical ticks and second markers.
+ */
+void AudioGraph::BuildGrid()
+{
+	int height = vi.height;
+	int height2 = height >> 1;
+	int max_y_pixel = height - 1 - height2;
+	grid_pixel = ConvertColour(0x606060);
+	second_pixel = ConvertColour(0xA0A0A0);
+
+	std::vector<int> heights;
+	if (mode == MODE_CORRELATION)
+	{
+		heights.push_back(0);
+		heights.push_back(height2 / 2);
+	}
+	else if (!spectrogram)
+	{
+		heights.push_back(0);
+		heights.push_back(LevelToY(0.5012));
+		heights.push_back(LevelToY(0.2512));
+	}
+	for (size_t i = 0; i < heights.size(); i++)
+	{
+		// Audioframe Y coordinates grow upwards, picture rows grow downwards.
+		if (heights[i] <= max_y_pixel)
+			m_grid_rows.push_back(height - 1 - (height2 + heights[i]));
+		if (heights[i] > 0 && heights[i] <= height2)
+			m_grid_rows.push_back(height - 1 - (height2 - heights[i]));
+	}
+}
+
+
+/*
+ * AudioGraph::DrawGridRows
+ * 
+ * Fill each horizontal grid line in the grid layer.
+ */
+void AudioGraph::DrawGridRows()
+{
+	for (size_t i = 0; i < m_grid_rows.size(); i++)
+		m_overlay->SetRow(LAYER_GRID, m_grid_rows[i], 0, vi.width);
+}
+
+
+/*
+ * AudioGraph::SecondMarker
  * 
- * Get a pointer to the audioframe corresponding to the given video frame.  If
- * the audioframe already exists in the cache, it is returned immediately.
- * Otherwise it is generated from the raw audio data, stored in the cache, and
- * returned.
- *
- * Parameters:
- *   frame      The frame whose audioframe is needed.
- *   env        A pointer to the IScriptEnvironment.
+ * Find where a whole second of audio starts within an audioframe.
  * 
  * Returns:
- *   A pointer to the audioframe buffer holding the requested audioframe.
+ *   The X pixel offset of the second marker, or -1 if the audioframe does
+ *   not contain the start of a second (or it falls on the audioframe
+ *   marker).
  */
-uint16_t *AudioGraph::GetAudioFrame(int frame, IScriptEnvironment* env)
+int AudioGraph::SecondMarker(int frame, IScriptEnvironment* env)
 {
-	int audioframe_buffer_index, audioframe_index;
-	uint16_t *audioframe_buffer;
-
-	audioframe_index = frame & (num_audioframe_buffers - 1);
-	audioframe_buffer_index = audioframe_index * pixels_per_audioframe;
-	if (audioframe_buffer_index >= (int)m_audioframe_buffers_size)
-		m_env->ThrowError("AudioGraph: audioframe buffer index");
-	audioframe_buffer = &m_audioframe_buffers[audioframe_buffer_index];
-	if (audioframe_index >= (int)m_cache_lookup_size)
-		m_env->ThrowError("AudioGraph: audioframe index");
-	if (m_cache_lookup[audioframe_index] != frame)
-	{
-		if (vi.SampleType() == SAMPLE_INT16) {
-			if (samples_per_frame * 2 > (int) m_audio_buffer_size)
-				m_env->ThrowError("AudGraph: invalid buf size 16");
-		} else if (vi.SampleType() == SAMPLE_INT8) {
-			if (samples_per_frame > (int) m_audio_buffer_size)
-				m_env->ThrowError("AudGraph: invalid buf size 8");
-		} else {
-			m_env->ThrowError("AudGraph: invalid sample type");
-		}
-		int64_t start = vi.AudioSamplesFromFrames(frame);
-		child->GetAudio(m_audio_buffer, start, samples_per_frame, env);
-		if (vi.sample_type == SAMPLE_INT16)
-			FillAudioFrame16(audioframe_buffer);
-		else if (vi.sample_type == SAMPLE_INT8)
-			FillAudioFrame8(audioframe_buffer);
-		else
-			m_env->ThrowError("AudioGraph: invalid sample type");
-		m_cache_lookup[audioframe_index] = frame;
-	}
-	return audioframe_buffer;
+	int64_t rate = audio_vi.audio_samples_per_second;
+	int64_t start = FrameStart(frame, env);
+	int length = FrameLength(frame, env);
+	int64_t offset = CeilDiv(start, rate) * rate - start;
+	if (offset >= length)
+		return -1;
+	// Pixel x is centred on sample m_sample_ranges[x] + half_range.
+	int half_range = (1 << log_samples_per_pixel) / 2;
+	int last_range = length - (1 << log_samples_per_pixel);
+	int x_pixel = (last_range > 0) ? (int)(((offset - half_range) * (pixels_per_audioframe - 1) + last_range / 2) / last_range) : 0;
+	x_pixel = Clamp(x_pixel, 0, pixels_per_audioframe - 1);
+	return (x_pixel > 0) ? x_pixel : -1;
 }
 
 
 /*
- * AudioGraph::GetFrame
+ * AudioGraph::DrawGraph
  * 
- * Standard GetFrame method - gets video frame n as processed by this filter.
+ * Draw the audioframes for video frame n, and the vertical lines marking the
+ * audioframe boundaries, into the waveform and marker layers, with the
+ * colour of each column.  Each X pixel draws a vertical span from the
+ * previous Y pixel coordinate to its own, so the graph is a connected line.
+ * In YUY2 both pixels of a pair are drawn, which makes the graph a bit
+ * blocky but avoids chroma fringes.  Spectrograms replace the waveform, and
+ * are drawn by DrawSpectrum.
+ *
+ * In paged mode nothing depends on which frame of the page is current: the
+ * frames are all drawn in the side colour, and the playhead marks the
+ * current one instead.
  * 
  * Parameters:
- *   n          The frame to get.
+ *   n          The frame being drawn.
  *   env        A pointer to the IScriptEnvironment.
- * 
- * Returns:
- *   The frame, with audio graph overlaid.
  */
-PVideoFrame __stdcall AudioGraph::GetFrame(int n, IScriptEnvironment* env)
+void AudioGraph::DrawGraph(int n, IScriptEnvironment* env)
 {
-	/*
-	 * First create a copy of the child frame.
-	 */
-	PVideoFrame src = child->GetFrame(n, env);
-	PVideoFrame dst = (v8) ? env->NewVideoFrameP(vi, &src) :  env->NewVideoFrame(vi);
-	const unsigned char* srcp = src->GetReadPtr();
-	unsigned char* dstp = dst->GetWritePtr();
-	int src_pitch = src->GetPitch();
-	int dst_pitch = dst->GetPitch();
-	int row_size = dst->GetRowSize();
-	int height = dst->GetHeight();
-	int bytes_per_pixel = vi.BytesFromPixels(1);
-	int pixels_per_row = row_size / bytes_per_pixel;
-	
-	env->BitBlt(dstp, dst_pitch, srcp, src_pitch, row_size, height);
-
+	int height = vi.height;
 	int prev_y_pixel = height >> 1;
 	int frame = n - frames_either_side;
-	uint16_t *audioframe_buffer;
+	const uint16_t *audioframe_buffer = NULL;
+	const uint16_t *colour_buffer = NULL;
+	bool spectrum = false;
 	int x_pixel = pixels_per_audioframe;
-	int colour;
+	int second_x_pixel = -1;
+	bool full_marker = true;
+	const PixelColour *marker_colour = &side_pixel;
+	const PixelColour *colour = &side_pixel;
+	int tick = (height / 32 > 2) ? height / 32 : 2;
 
-	/*
-	 * The entire drawing loop has been duplicated for each possible number of
-	 * bytes per pixel, in order to increase efficiency.  This is important as
-	 * the inner part of this loop is one of the most executed parts of the
-	 * filter.  Better to test the number of bytes per pixel once, rather than
-	 * each time we draw a pixel.
-	 *
-	 * If speed was really critical this could be rewritten in assembler.
-	 */
-	if (vi.IsYUY2())
+	for (int x = 0; x < vi.width; x++)
 	{
-		dstp += ((prev_y_pixel - 1) * dst_pitch);
-		bool col = false;
-		while (pixels_per_row--)
-		{   
-			if (x_pixel == pixels_per_audioframe)
+		if (x_pixel == pixels_per_audioframe)
+		{
+			if (Deferred(frame))
 			{
-				audioframe_buffer = GetAudioFrame(frame, env);
-				col = (frame==n);
-				frame++;
-				x_pixel = 0;
+				audioframe_buffer = m_placeholder;
+				colour_buffer = NULL;
+				spectrum = false;
 			}
-
-			int y_pixel = audioframe_buffer[x_pixel];
-
-			while (prev_y_pixel < y_pixel)
+			else
 			{
-
-			  dstp[0] = dstp[2] = 235;
-			  dstp[1] = dstp[3] = (col) ? 15 : 225;
-
-			  dstp -= dst_pitch;
-			  prev_y_pixel++;
+				audioframe_buffer = GetAudioFrame(frame, env);
+				if (mode == MODE_BANDS)
+					colour_buffer = GetBandColours(frame, env);
+				spectrum = spectrogram;
 			}
-			while (prev_y_pixel > y_pixel)
+			x_pixel = 0;
+
+			// With the grid only the current frame keeps full height markers.
+			bool current = !paged && frame == n;
+			bool boundary = !paged && (frame == n || frame == n + 1);
+			full_marker = !grid || boundary;
+			marker_colour = (boundary) ? &middle_pixel : &side_pixel;
+			second_x_pixel = (grid) ? SecondMarker(frame, env) : -1;
+			colour = (current) ? &middle_pixel : &side_pixel;
+			if (colour_by == COLOUR_DISTANCE && !paged)
 			{
-
-			  dstp[0] = dstp[2] = 235;
-			  dstp[1] = dstp[3] = (col) ? 15 : 225;
-
-			  dstp += dst_pitch;
-			  prev_y_pixel--;
+				int distance = abs(frame - n) * 255 / ((frames_either_side) ? frames_either_side : 1);
+				colour = &m_gradient[(distance < 255) ? distance : 255];
 			}
-
-			dstp[0] = dstp[2] = 235;
-			dstp[1] = dstp[3] = (col) ? 15 : 225;
-
-			if (x_pixel&1)
-			  dstp += 4;
-
-			x_pixel++;
+			frame++;
 		}
-	}
-	else if (vi.IsRGB24())
-	{
-		dstp += prev_y_pixel * dst_pitch;
-
-		while (pixels_per_row--)
+		// The pixel pair in YUY2, or just this pixel.
+		int left = x & ~overlay_pair_mask, right = x | overlay_pair_mask;
+		int odd = (x & overlay_pair_mask) * 2;
+		if (x_pixel == 0 || x_pixel == second_x_pixel)
 		{
-			if (x_pixel == pixels_per_audioframe)
+			const PixelColour **marker_colours = ColumnColours(LAYER_MARKERS + odd);
+			for (int column = left; column <= right; column++)
 			{
-				audioframe_buffer = GetAudioFrame(frame, env);
-				colour = (frame == n || frame == n+1) ? middle_colour : side_colour;
-				x_pixel = 0;
-
-				unsigned char* vlinep = dst->GetWritePtr()+(frame-n+frames_either_side)*pixels_per_audioframe*bytes_per_pixel;
-				for (int y = 0; y < height; ++y)
+				if (x_pixel == 0 && !full_marker)
 				{
-					*(uint8_t*)(vlinep+0) = *((uint8_t*)&colour+0);
-					*(uint8_t*)(vlinep+1) = *((uint8_t*)&colour+1);
-					*(uint8_t*)(vlinep+2) = *((uint8_t*)&colour+2);
-					vlinep += row_size;
+					m_overlay->SetColumn(LAYER_MARKERS + odd, column, 0, tick - 1);
+					m_overlay->SetColumn(LAYER_MARKERS + odd, column, height - tick, height - 1);
 				}
-
-				colour = (frame == n) ? middle_colour : side_colour;
-				frame++;
-			}
-			int y_pixel = audioframe_buffer[x_pixel];
-			while (prev_y_pixel < y_pixel)
-			{
-				*(uint8_t*)(dstp+0) = *((uint8_t*)&colour+0);
-				*(uint8_t*)(dstp+1) = *((uint8_t*)&colour+1);
-				*(uint8_t*)(dstp+2) = *((uint8_t*)&colour+2);
-				dstp += dst_pitch;
-				prev_y_pixel++;
-			}
-			while (prev_y_pixel > y_pixel)
-			{
-				*(uint8_t*)(dstp+0) = *((uint8_t*)&colour+0);
-				*(uint8_t*)(dstp+1) = *((uint8_t*)&colour+1);
-				*(uint8_t*)(dstp+2) = *((uint8_t*)&colour+2);
-				dstp -= dst_pitch;
-				prev_y_pixel--;
+				else
+					m_overlay->SetColumn(LAYER_MARKERS + odd, column, 0, height - 1);
+				marker_colours[column] = (x_pixel == 0) ? marker_colour : &second_pixel;
 			}
-			*(uint8_t*)(dstp+0) = *((uint8_t*)&colour+0);
-			*(uint8_t*)(dstp+1) = *((uint8_t*)&colour+1);
-			*(uint8_t*)(dstp+2) = *((uint8_t*)&colour+2);
-			dstp += 3;
+		}
+		if (spectrum)
+		{
 			x_pixel++;
+			continue;
+		}
+		int y_pixel = audioframe_buffer[x_pixel];
+		if (colour_buffer)
+			colour = &m_band_palette[colour_buffer[x_pixel]];
+		int y_from = (prev_y_pixel < y_pixel) ? prev_y_pixel : y_pixel;
+		int y_to = (prev_y_pixel < y_pixel) ? y_pixel : prev_y_pixel;
+		// Audioframe Y coordinates grow upwards, picture rows grow downwards.
+		const PixelColour **wave_colours = ColumnColours(LAYER_WAVE + odd);
+		for (int column = left; column <= right; column++)
+		{
+			m_overlay->SetColumn(LAYER_WAVE + odd, column, height - 1 - y_to, height - 1 - y_from);
+			// NULL takes the colour from the amplitude gradient.
+			wave_colours[column] = (colour_by == COLOUR_AMPLITUDE && !colour_buffer) ? NULL : colour;
 		}
+		prev_y_pixel = y_pixel;
+		x_pixel++;
 	}
-	else if (vi.IsRGB32())
+}
+
+
+/*
+ * AudioGraph::OverlayColour
+ * 
+ * The colour of pixel (x, y) in an overlay layer.
+ */
+inline const PixelColour& AudioGraph::OverlayColour(int layer, int x, int y) const
+{
+	switch (layer)
+	{
+	case LAYER_GRID:
+		return grid_pixel;
+	case LAYER_MARKERS:
+	case LAYER_ODD_MARKERS:
+		return *ColumnColours(layer)[x];
+	case LAYER_WAVE:
+	case LAYER_ODD_WAVE:
 	{
-		dstp += prev_y_pixel * dst_pitch;
+		const PixelColour *colour = ColumnColours(layer)[x];
+		return (colour) ? *colour : m_gradient[m_gradient_rows[y]];
+	}
+	case LAYER_DROPOUTS:
+		return dropout_pixel;
+	case LAYER_VAD:
+		return vad_pixel;
+	case LAYER_ONSETS:
+		return onset_pixel;
+	case LAYER_CURSOR:
+	case LAYER_PLAYHEAD:
+		return middle_pixel;
+	case LAYER_OUTLINE:
+		return outline_pixel;
+	default:
+		return label_pixel;
+	}
+}
+
 
-		while (pixels_per_row--)
+/*
+ * AudioGraph::CompositeOverlay
+ * 
+ * Merge the overlay layers into the frame, one pass per row: each pixel
+ * that any layer covers is written once, in the colour of its topmost
+ * layer.  Rows of the minimap only take the layers from the playhead up.  In
+ * YUY2 the two pixels of a pair share their chroma, which is left to the
+ * higher of their layers by writing that pixel last.
+ */
+template<class Writer>
+void AudioGraph::CompositeOverlay(Writer writer)
+{
+	const int minimap_top = vi.height - minimap_height;
+	const __m128i zero = _mm_setzero_si128();
+	for (int y = 0; y < vi.height; y++)
+	{
+		if (!m_overlay->Resolve(y, (y >= minimap_top) ? LAYER_PLAYHEAD : LAYER_GRID, m_overlay_ids))
+			continue;
+		for (int x0 = 0; x0 < vi.width; x0 += 16)
 		{
-			if (x_pixel == pixels_per_audioframe)
+			const uint8_t *ids = m_overlay_ids + x0;
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)ids), zero)) == 0xFFFF)
+				continue;
+			int count = (vi.width - x0 < 16) ? vi.width - x0 : 16;
+			for (int i = 0; i < count; i++)
 			{
-				audioframe_buffer = GetAudioFrame(frame, env);
-				colour = (frame == n || frame == n+1) ? middle_colour : side_colour;
-				x_pixel = 0;
-
-				unsigned char* vlinep = dst->GetWritePtr()+(frame-n+frames_either_side)*pixels_per_audioframe*bytes_per_pixel;
-				for (int y = 0; y < height; ++y)
+				if (!ids[i])
+					continue;
+				if (overlay_pair_mask && !(i & 1) && i + 1 < count && ids[i] > ids[i + 1] && ids[i + 1])
 				{
-					*(DWORD*)vlinep = colour;
-					vlinep += row_size;
+					writer.PutSingle(x0 + i + 1, y, OverlayColour(ids[i + 1] - 1, x0 + i + 1, y));
+					writer.PutSingle(x0 + i, y, OverlayColour(ids[i] - 1, x0 + i, y));
+					i++;
 				}
-
-				colour = (frame == n) ? middle_colour : side_colour;
-				++frame;
-			}
-			int y_pixel = audioframe_buffer[x_pixel];
-			while (prev_y_pixel < y_pixel)
-			{
-				*(DWORD*)dstp = colour;
-				dstp += dst_pitch;
-				prev_y_pixel++;
-			}
-			while (prev_y_pixel > y_pixel)
-			{
-				*(DWORD*)dstp = colour;
-				dstp -= dst_pitch;
-				prev_y_pixel--;
+				else
+					writer.PutSingle(x0 + i, y, OverlayColour(ids[i] - 1, x0 + i, y));
 			}
-			*(DWORD*)dstp = colour;
-			dstp += 4;
-			x_pixel++;
 		}
 	}
-	else if (vi.IsYV24()) {
-		uint8_t* dstpu = dst->GetWritePtr(PLANAR_U);
-		uint8_t* dstpv = dst->GetWritePtr(PLANAR_V);
-
-		memset(dstpu, 128, height * dst_pitch);
-		memset(dstpv, 128, height * dst_pitch);
+}
 
-		dstp += ((prev_y_pixel - 1) * dst_pitch);
-		dstpu += ((prev_y_pixel - 1) * dst_pitch);
-		dstpv += ((prev_y_pixel - 1) * dst_pitch);
 
-		bool col = false;
-		while (pixels_per_row--)
+/*
+ * AudioGraph::DrawSpectrum
+ * 
+ * Copy the spectrogram columns of the audioframes for video frame n into the
+ * frame, under every overlay layer.  Audioframes left over by the latency
+ * budget are skipped.
+ */
+template<class Writer>
+void AudioGraph::DrawSpectrum(Writer writer, int n, IScriptEnvironment* env)
+{
+	for (int i = 0; i * pixels_per_audioframe < vi.width; i++)
+	{
+		int frame = n - frames_either_side + i;
+		if (Deferred(frame))
+			continue;
+		const uint8_t *spectrum = GetSpectrum(frame, env);
+		int x0 = i * pixels_per_audioframe;
+		for (int x_pixel = 0; x_pixel < pixels_per_audioframe && x0 + x_pixel < vi.width; x_pixel++)
 		{
-			if (x_pixel == pixels_per_audioframe)
-			{
-				audioframe_buffer = GetAudioFrame(frame, env);
-				col = (frame == n);
-				frame++;
-				x_pixel = 0;
-			}
+			const uint8_t *column = &spectrum[x_pixel * spectrum_bands];
+			for (int y = 0; y < vi.height; y++)
+				writer.Put(x0 + x_pixel, y, m_spectrum_palette[column[m_spectrum_rows[y]]]);
+		}
+	}
+}
 
-			int y_pixel = audioframe_buffer[x_pixel];
 
-			while (prev_y_pixel < y_pixel)
-			{
+/*
+ * AudioGraph::DrawOverlay
+ * 
+ * Draw everything but the goniometer over the picture of frame n: the
+ * layers are filled in, the spectrogram and minimap go straight into the
+ * frame, and the layers are then merged into it in one pass.
+ * 
+ * In paged mode the layers of a page are only filled in for its first
+ * frame shown, and are reused for the rest while the page has no
+ * placeholders left, so every other frame only moves the playhead.
+ * 
+ * Parameters:
+ *   page       The frame the graph is centred on: n, or in paged mode the
+ *              middle frame of n's page.
+ */
+template<class Writer>
+void AudioGraph::DrawOverlay(Writer writer, Canvas& canvas, int n, int page, IScriptEnvironment* env)
+{
+	if (!paged || page != overlay_page || !overlay_complete)
+	{
+		m_overlay->Clear();
+		if (grid)
+			DrawGridRows();
+		DrawGraph(page, env);
+		if (vad)
+			DrawVoiceLane(page, env);
+		if (dropouts)
+			DrawDropouts(page, env);
+		if (onsets)
+			DrawOnsets(page, env);
+		if (labels != LABELS_NONE)
+			DrawLabels(page, env);
+		overlay_page = page;
+		overlay_complete = m_deferred_frames.empty();
+		cursor_x = playhead_x = -1;
+	}
+	if (spectrogram)
+		DrawSpectrum(writer, page, env);
+	if (paged)
+	{
+		if (cursor_x >= 0)
+			m_overlay->UnsetColumn(LAYER_CURSOR, cursor_x, 0, vi.height - 1);
+		cursor_x = Clamp((n - (page - frames_either_side)) * pixels_per_audioframe, 0, vi.width - 1);
+		m_overlay->SetColumn(LAYER_CURSOR, cursor_x, 0, vi.height - 1);
+	}
+	if (minimap)
+	{
+		if (!m_minimap)
+			BuildMinimap(env);
+		DrawMinimap(canvas, n, env);
+	}
+	CompositeOverlay(writer);
+}
 
-				dstp[0] = dstp[1] = 235;
-				dstpu[0] = dstpu[1] = (col) ? 15 : 225;
-				dstpv[0] = dstpv[1] = (col) ? 15 : 225;
 
-				dstp -= dst_pitch;
-				dstpu -= dst_pitch;
-				dstpv -= dst_pitch;
-				prev_y_pixel++;
-			}
-			while (prev_y_pixel > y_pixel)
-			{
+/*
+ * AudioGraph::Deferred
+ * 
+ * Returns:
+ *   true if the audioframe was left over by the last prefetch, so it must
+ *   be drawn as a placeholder.
+ */
+bool AudioGraph::Deferred(int frame) const
+{
+	return latency_budget > 0.0 && m_cache_lookup[frame & (num_audioframe_buffers - 1)] != frame;
+}
 
-				dstp[0] = dstp[1] = 235;
-				dstpu[0] = dstpu[1] = (col) ? 15 : 225;
-				dstpv[0] = dstpv[1] = (col) ? 15 : 225;
 
-				dstp += dst_pitch;
-				dstpu += dst_pitch;
-				dstpv += dst_pitch;
-				prev_y_pixel--;
-			}
+/*
+ * AudioGraph::SetWindow
+ * 
+ * Note the frames whose audioframes are visible when frame n is shown.
+ */
+void AudioGraph::SetWindow(int n)
+{
+	window_first = n - frames_either_side;
+	window_last = window_first + (vi.width + pixels_per_audioframe - 1) / pixels_per_audioframe - 1;
+}
 
-			dstp[0] = dstp[1] = 235;
-			dstpu[0] = dstpu[1] = (col) ? 15 : 225;
-			dstpv[0] = dstpv[1] = (col) ? 15 : 225;
-			
-			dstp++;
-			dstpu++;
-			dstpv++;
-			x_pixel++;
+
+/*
+ * AudioGraph::PrefetchAudioFrames
+ * 
+ * Generate the missing audioframes of frame n for as long as the latency
+ * budget allows: the current frame, which is always generated, then the
+ * frames the previous call left over that are still visible, as they have
+ * waited longest, then the rest nearest the current frame first.  The cost
+ * of a miss is a moving average of the measured ones, so a miss is only
+ * started if it is expected to finish within the budget.  Whatever is left
+ * over is kept for the next call.  Everything runs on the calling thread,
+ * which is the only one that reads the child.
+ */
+void AudioGraph::PrefetchAudioFrames(int n, IScriptEnvironment* env)
+{
+	typedef std::chrono::steady_clock clock;
+	clock::time_point begin = clock::now();
+	int visible = (vi.width + pixels_per_audioframe - 1) / pixels_per_audioframe;
+	SetWindow(n);
+	std::deque<int> waiting;
+	waiting.swap(m_deferred_frames);
+
+	auto generate = [&](int frame)
+	{
+		if (frame < window_first || frame > window_last)
+			return;
+		if (m_cache_lookup[frame & (num_audioframe_buffers - 1)] == frame)
+			return;
+		double elapsed = std::chrono::duration<double, std::milli>(clock::now() - begin).count();
+		if (frame != n && elapsed + miss_cost > latency_budget)
+		{
+			if (std::find(m_deferred_frames.begin(), m_deferred_frames.end(), frame) == m_deferred_frames.end())
+				m_deferred_frames.push_back(frame);
+			return;
 		}
-	}
-	else if (vi.IsPlanarRGB() || vi.IsPlanarRGBA())
+		clock::time_point start = clock::now();
+		GetAudioFrame(frame, env);
+		double cost = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		miss_cost = (miss_cost > 0.0) ? miss_cost * 0.75 + cost * 0.25 : cost;
+	};
+	generate(n);
+	for (size_t i = 0; i < waiting.size(); i++)
+		generate(waiting[i]);
+	for (int distance = 1; distance < visible; distance++)
 	{
-		uint8_t* dstpb = dst->GetWritePtr(PLANAR_B);
-		uint8_t* dstpr = dst->GetWritePtr(PLANAR_R);
-		uint8_t* dstpa = (vi.IsPlanarRGBA()) ? dst->GetWritePtr(PLANAR_A) : nullptr;
-
-		env->BitBlt(dstpb, dst_pitch, src->GetReadPtr(PLANAR_B), src_pitch, row_size, height);
-		env->BitBlt(dstpr, dst_pitch, src->GetReadPtr(PLANAR_R), src_pitch, row_size, height);
+		generate(n + distance);
+		generate(n - distance);
+	}
+}
 
-		if (dstpa)
-			env->BitBlt(dstpa, dst_pitch, src->GetReadPtr(PLANAR_A), src_pitch, row_size, height);
 
-		dstp += ((prev_y_pixel - 1) * dst_pitch);
-		dstpb += ((prev_y_pixel - 1) * dst_pitch);
-		dstpr += ((prev_y_pixel - 1) * dst_pitch);
-		if (dstpa)
-			dstpa += ((prev_y_pixel - 1) * dst_pitch);
+/*
+ * AudioGraph::BuildMinimap
+ * 
+ * Read the audio of the whole clip once into a peak pyramid, and render the
+ * minimap from the coarsest level that still has an entry per pixel.  The
+ * minimap is rendered in the clip's pixel format, so that drawing it is a
+ * memcpy per row.  The waveform is normalised to the loudest peak of the
+ * clip.
+ * 
+ * With peaks_file, level 0 of the pyramid is taken from that file instead
+ * if it was built from audio of the same rate and channel count and covers
+ * at least the graphed part of the clip, so that it can be made ahead of
+ * time by audiograph-peaks.  If there is no such file yet, the one built
+ * here is written to it; a file that does not match is left alone.
+ */
+void AudioGraph::BuildMinimap(IScriptEnvironment* env)
+{
+	const int chunk = 1 << 16;
+	minimap_samples = FrameStart(vi.num_frames, env);
+	if (minimap_samples > audio_vi.num_audio_samples)
+		minimap_samples = audio_vi.num_audio_samples;
+
+	PcmFormat format;
+	format.sample_rate = audio_vi.audio_samples_per_second;
+	format.channels = audio_vi.AudioChannels();
+	format.bits_per_sample = (audio_vi.SampleType() == SAMPLE_INT16) ? 16 : 8;
+	format.is_float = false;
+	format.num_samples = minimap_samples;
+
+	bool exists = false;
+	if (!peaks_file.empty())
+	{
+		PeakFileHeader header;
+		std::vector<float> pairs;
+		FILE* file = fopen(peaks_file.c_str(), "rb");
+		exists = (file != NULL);
+		if (file)
+			fclose(file);
+		if (exists && ReadPeakFile(peaks_file.c_str(), header, pairs) && header.sample_rate == format.sample_rate
+			&& header.channels == format.channels && header.num_samples >= minimap_samples)
+		{
+			m_peaks.reset(new PeakPyramid(header.block_size));
+			m_peaks->AppendBlocks(pairs.data(), CeilDiv(minimap_samples, header.block_size));
+			m_peaks->Finish();
+		}
+	}
 
-		while (pixels_per_row--)
+	if (!m_peaks)
+	{
+		PeakIndexBuilder builder(format, PEAK_BLOCK_SIZE);
+		std::vector<uint8_t> raw((size_t)chunk * audio_vi.BytesPerAudioSample());
+		for (int64_t position = 0; position < minimap_samples; position += chunk)
 		{
-			if (x_pixel == pixels_per_audioframe)
-			{
-				audioframe_buffer = GetAudioFrame(frame, env);
-				colour = (frame == n || frame == n + 1) ? middle_colour : side_colour;
-				x_pixel = 0;
-
-				unsigned char* vlinep = dst->GetWritePtr() + (frame - n + frames_either_side) * pixels_per_audioframe * bytes_per_pixel;
-				unsigned char* vlinepg = dst->GetWritePtr(PLANAR_B) + (frame - n + frames_either_side) * pixels_per_audioframe * bytes_per_pixel;
-				unsigned char* vlinepb = dst->GetWritePtr(PLANAR_R) + (frame - n + frames_either_side) * pixels_per_audioframe * bytes_per_pixel;
-				unsigned char* vlinepa = (dstpa) ? dst->GetWritePtr(PLANAR_A) + (frame - n + frames_either_side) * pixels_per_audioframe * bytes_per_pixel : nullptr;
-				for (int y = 0; y < height; ++y)
-				{
-					vlinep[0] = *((uint8_t*)&colour + 1);
-					vlinepg[0] = *((uint8_t*)&colour + 2);
-					vlinepb[0] = *((uint8_t*)&colour);
-					if (dstpa)
-						*(uint8_t*)vlinepa = *((uint8_t*)&colour + 3);
-					vlinep += row_size;
-					vlinepg += row_size;
-					vlinepb += row_size;
-					if (dstpa)
-						vlinepa += row_size;
-				}
+			int count = (int)((minimap_samples - position < chunk) ? minimap_samples - position : chunk);
+			m_audio->GetAudio(raw.data(), position, count, env);
+			builder.Append(raw.data(), count);
+		}
+		m_peaks.reset(builder.Finish());
+		if (!peaks_file.empty() && !exists && !WritePeakFile(peaks_file.c_str(), *m_peaks, format))
+			env->ThrowError("AudioGraph: cannot write peaks_file \"%s\"", peaks_file.c_str());
+	}
 
-				colour = (frame == n) ? middle_colour : side_colour;
-				++frame;
-			}
-			int y_pixel = audioframe_buffer[x_pixel];
-			while (prev_y_pixel < y_pixel)
-			{
-				dstp[0] = *((uint8_t*)&colour + 1);
-				dstpb[0] = *((uint8_t*)&colour + 2);
-				dstpr[0] = *((uint8_t*)&colour);
-				if (dstpa)
-					dstpa[0] = *((uint8_t*)&colour + 3);
-				dstp -= dst_pitch;
-				dstpb -= dst_pitch;
-				dstpr -= dst_pitch;
-				if (dstpa)
-					dstpa -= dst_pitch;
-				prev_y_pixel++;
-			}
-			while (prev_y_pixel > y_pixel)
-			{
-				dstp[0] = *((uint8_t*)&colour + 1);
-				dstpb[0] = *((uint8_t*)&colour + 2);
-				dstpr[0] = *((uint8_t*)&colour);
-				if (dstpa)
-					dstpa[0] = *((uint8_t*)&colour+3);
-				dstp += dst_pitch;
-				dstpb += dst_pitch;
-				dstpr += dst_pitch;
-				if (dstpa)
-					dstpa += dst_pitch;
-				prev_y_pixel--;
-			}
-			dstp[0] = *((uint8_t*)&colour + 1);
-			dstpb[0] = *((uint8_t*)&colour + 2);
-			dstpr[0] = *((uint8_t*)&colour);
-			if (dstpa)
-				dstpa[0] = *((uint8_t*)&colour + 3);
-			dstp++;
-			dstpb++;
-			dstpr++;
-			if (dstpa)
-				dstpa++;
-			x_pixel++;
+	m_minimap = m_arena.Allocate<uint8_t>(PictureSize(vi, minimap_height));
+	Canvas bitmap(vi, m_minimap, minimap_height);
+	PixelColour background = ConvertColour(0x202020);
+	for (int y = 0; y < minimap_height; y++)
+		for (int x = 0; x < vi.width; x++)
+			bitmap.Put(x, y, background);
+
+	// With no audio (or a zero-sample peaks_file) the pyramid is empty; leave the minimap blank.
+	if (minimap_samples <= 0 || m_peaks->Size(0) == 0)
+		return;
+
+	int level = m_peaks->LevelForWidth(vi.width);
+	int entries = m_peaks->Size(level);
+	const float *minimums = m_peaks->Minimums(level);
+	const float *maximums = m_peaks->Maximums(level);
+	int top = m_peaks->Levels() - 1;
+	float peak = -m_peaks->Minimums(top)[0];
+	if (m_peaks->Maximums(top)[0] > peak)
+		peak = m_peaks->Maximums(top)[0];
+	float scale = (peak > 0.0f) ? (minimap_height / 2 - 1) / peak : 0.0f;
+	int centre = minimap_height / 2;
+
+	for (int x = 0; x < vi.width && entries; x++)
+	{
+		int first = (int)((int64_t)x * entries / vi.width);
+		int last = (int)((int64_t)(x + 1) * entries / vi.width);
+		if (last <= first)
+			last = first + 1;
+		float low = minimums[first], high = maximums[first];
+		for (int i = first + 1; i < last; i++)
+		{
+			if (minimums[i] < low)
+				low = minimums[i];
+			if (maximums[i] > high)
+				high = maximums[i];
 		}
+		for (int y = centre - (int)(high * scale); y <= centre - (int)(low * scale); y++)
+			bitmap.Put(x, y, side_pixel);
 	}
+}
+
+
+/*
+ * AudioGraph::DrawMinimap
+ * 
+ * Copy the minimap onto the bottom of the canvas and draw the playhead in
+ * its layer.
+ */
+void AudioGraph::DrawMinimap(Canvas& canvas, int n, IScriptEnvironment* env)
+{
+	Canvas bitmap(vi, m_minimap, minimap_height);
+	int top = canvas.height - minimap_height;
+	int row_size = vi.BytesFromPixels(vi.width);
+	for (int y = 0; y < minimap_height; y++)
+		for (int p = 0; p < canvas.num_planes; p++)
+			memcpy(canvas.Row(p, top + y), bitmap.Row(p, y), row_size);
+
+	if (minimap_samples <= 0)
+		return;
+	int64_t position = FrameStart(n, env);
+	if (playhead_x >= 0)
+		m_overlay->UnsetColumn(LAYER_PLAYHEAD, playhead_x, top, canvas.height - 1);
+	playhead_x = Clamp((int)(position * vi.width / minimap_samples), 0, vi.width - 1);
+	m_overlay->SetColumn(LAYER_PLAYHEAD, playhead_x, top, canvas.height - 1);
+}
+
+
+/*
+ * AudioGraph::GetFrame
+ * 
+ * Standard GetFrame method - gets video frame n as processed by this filter.
+ * 
+ * Parameters:
+ *   n          The frame to get.
+ *   env        A pointer to the IScriptEnvironment.
+ * 
+ * Returns:
+ *   The frame, with audio graph overlaid.
+ */
+PVideoFrame __stdcall AudioGraph::GetFrame(int n, IScriptEnvironment* env)
+{
+	/*
+	 * First create a copy of the child frame.  YUV clips are shown in
+	 * greyscale so that the graph stands out.
+	 */
+	PVideoFrame src = child->GetFrame(n, env);
+	PVideoFrame dst = (v8) ? env->NewVideoFrameP(vi, &src) :  env->NewVideoFrame(vi);
+	int src_pitch = src->GetPitch();
+	int dst_pitch = dst->GetPitch();
+	int row_size = dst->GetRowSize();
+	int height = dst->GetHeight();
+
+	env->BitBlt(dst->GetWritePtr(), dst_pitch, src->GetReadPtr(), src_pitch, row_size, height);
+
+	// The nearest dropout regions either side, for scripts to jump between.
+	if (v8 && dropout_index)
+	{
+		std::vector<int>::const_iterator next = std::upper_bound(m_dropout_frames.begin(), m_dropout_frames.end(), n);
+		std::vector<int>::const_iterator previous = std::lower_bound(m_dropout_frames.begin(), m_dropout_frames.end(), n);
+		AVSMap* props = env->getFramePropsRW(dst);
+		env->propSetInt(props, "AudioGraph_DropoutNext", (next != m_dropout_frames.end()) ? *next : -1, 0);
+		env->propSetInt(props, "AudioGraph_DropoutPrevious", (previous != m_dropout_frames.begin()) ? *(previous - 1) : -1, 0);
+	}
+
+	if (vi.IsYV24())
+	{
+		memset(dst->GetWritePtr(PLANAR_U), 128, height * dst_pitch);
+		memset(dst->GetWritePtr(PLANAR_V), 128, height * dst_pitch);
+	}
+	else if (vi.IsPlanarRGB() || vi.IsPlanarRGBA())
+	{
+		env->BitBlt(dst->GetWritePtr(PLANAR_B), dst_pitch, src->GetReadPtr(PLANAR_B), src_pitch, row_size, height);
+		env->BitBlt(dst->GetWritePtr(PLANAR_R), dst_pitch, src->GetReadPtr(PLANAR_R), src_pitch, row_size, height);
+		if (vi.IsPlanarRGBA())
+			env->BitBlt(dst->GetWritePtr(PLANAR_A), dst_pitch, src->GetReadPtr(PLANAR_A), src_pitch, row_size, height);
+	}
+
+	/*
+	 * A frame shown recently only needs its cached layer copied over the
+	 * video.  Otherwise the bare picture is kept to find what gets drawn.
+	 */
+	Canvas canvas(vi, dst);
+	LayerPlanes drawn = CanvasPlanes(canvas);
+	if (m_layers && m_layers->Draw(n, drawn))
+		return dst;
+	LayerPlanes bare = drawn;
+	if (m_layers)
+	{
+		bare = CanvasPlanes(Canvas(vi, m_layer_bare, vi.height));
+		for (int p = 0; p < bare.num_planes; p++)
+			env->BitBlt(bare.planes[p], bare.pitches[p], drawn.planes[p], drawn.pitches[p], bare.row_size, bare.height);
+	}
+
+	// In paged mode the graph is centred on the middle frame of n's page.
+	int page = n;
+	if (paged)
+	{
+		int page_size = 2 * frames_either_side + 1;
+		page = n / page_size * page_size + frames_either_side;
+	}
+
+	if (latency_budget > 0.0)
+		PrefetchAudioFrames(page, env);
+	else
+		SetWindow(page);
+
+	if (vi.IsYUY2())
+		DrawOverlay(YUY2Writer(canvas), canvas, n, page, env);
+	else if (vi.IsRGB24())
+		DrawOverlay(PackedRGBWriter<3>(canvas), canvas, n, page, env);
+	else if (vi.IsRGB32())
+		DrawOverlay(PackedRGBWriter<4>(canvas), canvas, n, page, env);
+	else if (vi.IsPlanarRGBA())
+		DrawOverlay(PlanarWriter<4>(canvas), canvas, n, page, env);
+	else
+		DrawOverlay(PlanarWriter<3>(canvas), canvas, n, page, env);
+	if (goniometer)
+		DrawGoniometer(canvas, GetGoniometer(n, env));
+
+	// A layer drawn with placeholders for deferred audioframes is not kept.
+	if (m_layers && m_deferred_frames.empty())
+		m_layers->Store(n, bare, drawn);
 	return dst;
 }
 
 
+/*
+ * AudioGraph::SetCacheHints
+ * 
+ * With a latency budget a frame may be drawn with placeholders that are
+ * filled in on later calls, so AviSynth must not cache the frames.
+ * 
+ * Returns:
+ *   Nonzero for CACHE_DONT_CACHE_ME if the frames must not be cached.
+ */
+int __stdcall AudioGraph::SetCacheHints(int cachehints, int /* frame_range */)
+{
+	if (cachehints == CACHE_DONT_CACHE_ME)
+		return latency_budget > 0.0;
+	return 0;
+}
+
+
 /*
  * Create_AudioGraph
  * 
@@ -776,7 +3661,7 @@ PVideoFrame __stdcall AudioGraph::GetFrame(int n, IScriptEnvironment* env)
  */
 AVSValue __cdecl Create_AudioGraph(AVSValue args, void* user_data, IScriptEnvironment* env)
 {
-	return new AudioGraph(args[0].AsClip(), args[1].AsInt(0), args[2].AsInt(0), args[3].AsInt(0), args[4].AsInt(0), env);
+	return new AudioGraph(args[0].AsClip(), args[1].AsInt(0), args[2].AsInt(0), args[3].AsInt(0), args[4].AsInt(0), args[5].AsString("wave"), args[6].AsBool(false), args[7].AsBool(false), args[8].AsBool(false), args[9].AsString(""), args[10].AsString("none"), args[11].AsBool(false), args[12].AsBool(false), (float)args[13].AsFloat(-60.0f), (float)args[14].AsFloat(0.0f), args[15].AsString("frame"), (float)args[16].AsFloat(0.0f), args[17].AsBool(false), args[18].AsBool(false), args[19].AsString(""), args[20].AsInt(0), args[21].AsInt(0), args[22].AsInt(0), args[23].AsString(""), args[24].AsInt(0), args[25].AsBool(false), args[26].AsBool(false), args[27].AsString(""), env);
 }
 
 
@@ -796,7 +3681,8 @@ const AVS_Linkage *AVS_linkage = 0;
 extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScriptEnvironment* env, const AVS_Linkage* const vectors)
 {
   AVS_linkage = vectors;	
-	env->AddFunction("AudioGraph", "c[frames_either_side]i[graph_scale]i[middle_colour]i[side_colour]i", Create_AudioGraph, NULL);
+	env->AddFunction("AudioGraph", "c[frames_either_side]i[graph_scale]i[middle_colour]i[side_colour]i[mode]s[goniometer]b[onsets]b[vad]b[vad_file]s[labels]s[grid]b[db]b[db_floor]f[db_ceiling]f[colour_by]s[latency_budget_ms]f[minimap]b[vfr]b[timecodes]s[offset_samples]i[working_rate]i[threads]i[peaks_file]s[layer_cache_mb]i[paged]b[dropouts]b[dropout_file]s", Create_AudioGraph, NULL);
+	env->AddFunction("AudioQC", "c[properties]b[silence_db]f[threads]i[peaks_file]s", AudioQC::Create, NULL);
 	return "'AudioGraph' sample plugin";
 }
 
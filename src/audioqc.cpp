@@ -0,0 +1,201 @@
+/*
+ * AudioQC for AudioGraph
+ *
+ * See audioqc.h.
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "audioqc.h"
+#include "convertaudio.h"
+#include "engine/channels.h"
+#include "engine/engine.h"
+#include "engine/peakfile.h"
+#include "frameprops.h"
+#include "threadpool.h"
+
+
+/*
+ * Scan
+ *
+ * Measure the whole audio of a float clip.
+ *
+ * Parameters:
+ *   clip           The converted clip.
+ *   clip_level     The magnitude at which a sample counts as clipped.
+ *   silence_db     The level below which a block counts as silent.
+ *   threads        The most threads to measure on at once.
+ *   peaks_file     If not empty, write the peak index of the audio here.
+ */
+static QcReport Scan(PClip clip, float clip_level, double silence_db, int threads, const std::string& peaks_file, IScriptEnvironment* env)
+{
+	const VideoInfo& vi = clip->GetVideoInfo();
+	const int channels = vi.AudioChannels();
+	const int64_t num_samples = vi.num_audio_samples;
+	const size_t bytes_per_sample = vi.BytesPerAudioSample();
+
+	QcMeter meter(vi.audio_samples_per_second, channels, silence_db, clip_level);
+	const int block = meter.BlockSize();
+	const int run = block * QC_RUN_BLOCKS;
+	const int settle = block * QC_SETTLE_BLOCKS;
+	const size_t stride = (size_t)settle + run;
+	int64_t batch = (int64_t)(QC_BATCH_BYTES / bytes_per_sample) / run * run;
+	if (batch < run)
+		batch = run;
+
+	PcmFormat format;
+	format.sample_rate = vi.audio_samples_per_second;
+	format.channels = channels;
+	format.bits_per_sample = 32;
+	format.is_float = true;
+	format.num_samples = num_samples;
+	PeakIndexBuilder builder(format, PEAK_BLOCK_SIZE);
+
+	// One meter and one set of channel planes per task, and the mean square of every whole block.
+	const int tasks = (threads > 0) ? threads : ThreadPool::DefaultThreads();
+	std::vector<QcMeter> meters(tasks, meter);
+	std::vector<std::vector<float> > planes(tasks, std::vector<float>(stride * channels));
+	std::vector<double> blocks((size_t)(num_samples / block) + 1);
+	std::vector<uint8_t> raw((size_t)(settle + batch) * bytes_per_sample);
+
+	ThreadPool* pool = ThreadPool::Acquire(threads);
+	try
+	{
+		for (int64_t position = 0; position < num_samples; position += batch)
+		{
+			const int64_t count = (num_samples - position < batch) ? num_samples - position : batch;
+			const int64_t lead = (position < settle) ? position : settle;
+			clip->GetAudio(raw.data(), position - lead, lead + count, env);
+			const uint8_t *data = raw.data() + (size_t)lead * bytes_per_sample;
+			if (!peaks_file.empty())
+				builder.Append(data, count);
+
+			// Each run is settled on the audio before it, which the batch always holds.
+			auto measure = [&](int begin, int end, int slot)
+			{
+				float *plane = planes[slot].data();
+				for (int r = begin; r < end; r++)
+				{
+					const int64_t offset = (int64_t)r * run;
+					const int length = (int)((count - offset < run) ? count - offset : run);
+					const int settled = (int)((position + offset < settle) ? position + offset : settle);
+					const uint8_t *src = data + (offset - settled) * (int64_t)bytes_per_sample;
+					DeinterleaveFloat((const float*)src, channels, settled + length, plane, stride);
+					meters[slot].Restart();
+					meters[slot].Settle(plane, stride, settled);
+					meters[slot].Measure(plane + settled, stride, length, &blocks[(size_t)((position + offset) / block)]);
+				}
+			};
+			pool->ParallelFor((int)((count + run - 1) / run), tasks, measure);
+		}
+	}
+	catch (...)
+	{
+		ThreadPool::Release();
+		throw;
+	}
+	ThreadPool::Release();
+
+	if (!peaks_file.empty())
+	{
+		PeakPyramid* peaks = builder.Finish();
+		bool written = WritePeakFile(peaks_file.c_str(), *peaks, format);
+		delete peaks;
+		if (!written)
+			env->ThrowError("AudioQC: cannot write peaks_file \"%s\"", peaks_file.c_str());
+	}
+
+	for (int i = 1; i < tasks; i++)
+		meters[0].Merge(meters[i]);
+	return meters[0].Summarise(blocks.data(), num_samples / block);
+}
+
+
+/*
+ * AudioQC::Create
+ *
+ * Scan the clip, and return the report as a string, or the clip with the
+ * report in the properties of frame 0.
+ */
+AVSValue __cdecl AudioQC::Create(AVSValue args, void*, IScriptEnvironment* env)
+{
+	PClip clip = args[0].AsClip();
+	bool properties = args[1].AsBool(false);
+	double silence_db = args[2].AsFloat(-60.0f);
+	int threads = args[3].AsInt(0);
+	std::string peaks_file = args[4].AsString("");
+
+	if (!clip->GetVideoInfo().HasAudio())
+		env->ThrowError("AudioQC: the clip has no audio");
+	if (threads < 0)
+		env->ThrowError("AudioQC: threads must not be negative");
+	if (properties && !HasFrameProperties(env))
+		env->ThrowError("AudioQC: properties needs frame properties (AviSynth+ 3.6 or later)");
+
+	/*
+	 * The audio is measured as float, so that float overs are kept and no
+	 * bits of 24 or 32-bit audio are lost.  Integer audio clips at its
+	 * largest value, and float audio at full scale.
+	 */
+	float clip_level = 1.0f;
+	switch (clip->GetVideoInfo().SampleType())
+	{
+	case SAMPLE_INT8:
+		clip_level = 127.0f / 128;
+		break;
+	case SAMPLE_INT16:
+		clip_level = 32767.0f / 32768;
+		break;
+	case SAMPLE_INT24:
+		clip_level = 8388607.0f / 8388608;
+		break;
+	case SAMPLE_INT32:
+		clip_level = (float)(2147483647.0 / 2147483648.0);
+		break;
+	}
+	QcReport report = Scan(ConvertAudio::Create(clip, SAMPLE_FLOAT, SAMPLE_FLOAT), clip_level, silence_db, threads, peaks_file, env);
+	if (properties)
+		return new AudioQC(clip, report);
+
+	char text[512];
+	snprintf(text, sizeof(text),
+		"Integrated loudness: %.1f LUFS\n"
+		"Loudness range: %.1f LU\n"
+		"True peak: %.1f dBTP\n"
+		"DC offset: %.6f\n"
+		"Silence: %.1f%%\n"
+		"Clipped samples: %lld\n",
+		report.integrated, report.range, report.true_peak, report.dc_offset, report.silence, (long long)report.clipped);
+	return env->SaveString(text);
+}
+
+
+AudioQC::AudioQC(PClip _child, const QcReport& _report) :
+	GenericVideoFilter(_child),
+	report(_report)
+{
+}
+
+
+/*
+ * AudioQC::GetFrame
+ *
+ * Frame 0 gets the report as properties; the other frames pass through.
+ */
+PVideoFrame __stdcall AudioQC::GetFrame(int n, IScriptEnvironment* env)
+{
+	PVideoFrame frame = child->GetFrame(n, env);
+	if (n != 0)
+		return frame;
+	env->MakeWritable(&frame);
+	AVSMap* props = env->getFramePropsRW(frame);
+	env->propSetFloat(props, "AudioQC_IntegratedLoudness", report.integrated, 0);
+	env->propSetFloat(props, "AudioQC_LoudnessRange", report.range, 0);
+	env->propSetFloat(props, "AudioQC_TruePeak", report.true_peak, 0);
+	env->propSetFloat(props, "AudioQC_DCOffset", report.dc_offset, 0);
+	env->propSetFloat(props, "AudioQC_Silence", report.silence, 0);
+	env->propSetInt(props, "AudioQC_ClippedSamples", report.clipped, 0);
+	return frame;
+}
@@ -0,0 +1,40 @@
+/*
+ * AudioQC for AudioGraph
+ *
+ * A script function that scans the whole audio of a clip before delivery
+ * and reports its integrated loudness, loudness range, true peak, DC offset,
+ * share of silence and clipped samples (see engine/qc.h), either as a
+ * string or as frame properties of frame 0.
+ *
+ * The audio is converted to float, so that the measurements keep the full
+ * resolution and range of the source, and read in large batches on the
+ * calling thread.  Each batch is cut into runs of whole 100 ms blocks,
+ * which are deinterleaved with the kernels of channels.h and measured on
+ * the shared thread pool.  The peak index of the minimap can be
+ * built from the same batches and written as a peaks_file on the way.
+ */
+
+#ifndef __AUDIOQC_H__
+#define __AUDIOQC_H__
+
+#include "avisynth.h"
+#include "engine/qc.h"
+
+// Blocks per run measured on one thread, and blocks settled before each run.
+#define QC_RUN_BLOCKS 32
+#define QC_SETTLE_BLOCKS 2
+
+// The size of a batch of audio read at once, in bytes.
+#define QC_BATCH_BYTES ((size_t)16 << 20)
+
+class AudioQC : public GenericVideoFilter
+{
+public:
+	static AVSValue __cdecl Create(AVSValue args, void* user_data, IScriptEnvironment* env);
+	AudioQC(PClip _child, const QcReport& _report);
+	PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env);
+private:
+	QcReport report;
+};
+
+#endif //__AUDIOQC_H__
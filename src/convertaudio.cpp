@@ -37,6 +37,7 @@
 // Copyright (c) Ian Brabham 2005
 
 #include <malloc.h>
+#include <stdint.h>
 
 #include "avisynth.h"
 #include "convertaudio.h"
@@ -90,27 +91,27 @@ ConvertAudio::~ConvertAudio() {
 
 /*******************************************/
 
-void convert24To16(char* inbuf, void* outbuf, int count) {
+void convert24To16(char* inbuf, void* outbuf, __int64 count) {
     unsigned char*  in  = (unsigned char*)inbuf;
     unsigned short* out = (unsigned short*)outbuf;
 
-    for (int i=0;i<count;i++)
+    for (__int64 i=0;i<count;i++)
       out[i] = in[i*3+1] | (in[i*3+2] << 8); 
 }
 
 /*******************************************/
 
-void convert16To8(char* inbuf, void* outbuf, int count) {
+void convert16To8(char* inbuf, void* outbuf, __int64 count) {
     signed short*  in  = (signed short*)inbuf;
     unsigned char* out = (unsigned char*)outbuf;
 
-    for (int i=0;i<count;i++) 
+    for (__int64 i=0;i<count;i++) 
       out[i] = (in[i] >> 8) + 128;
 }
 
 /*******************************************/
 
-void convert8To16(char* inbuf, void* outbuf, int count) {
+void convert8To16(char* inbuf, void* outbuf, __int64 count) {
     unsigned char* in  = (unsigned char*)inbuf;
     signed short*  out = (signed short*)outbuf;
 
@@ -121,37 +122,52 @@ void convert8To16(char* inbuf, void* outbuf, int count) {
 
     // This make 0x7f(255-128) -> 0x7fff & 0x80(0-128) -> 0x8000
 
-    for (int i=0;i<count;i++)
+    for (__int64 i=0;i<count;i++)
       out[i] = ((in[i]-128) << 8) | in[i];
 }
 
 /*******************************************/
 
+// Bytes in a buffer of count samples of channels * bytes_per_sample each,
+// plus 64 bytes of padding so that SIMD code may run past the end, or an
+// error if a long request does not fit in memory.
+static size_t BufferBytes(__int64 count, int channels, int bytes_per_sample, IScriptEnvironment* env)
+{
+  __int64 sample_size = (__int64)channels * bytes_per_sample;
+  if (count < 0 || (sample_size && (unsigned __int64)count > (SIZE_MAX - 64) / sample_size))
+    env->ThrowError("ConvertAudio: audio request too large");
+  return (size_t)(count * sample_size) + 64;
+}
+
 void __stdcall ConvertAudio::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env) 
 {
   int channels=vi.AudioChannels();
+  __int64 total=count*channels;
 
   if (tempbuffer_size<count) {
     if (tempbuffer_size) _aligned_free(tempbuffer);
-    tempbuffer = (char *) _aligned_malloc((int)count*src_bps*channels, 16);
-    tempbuffer_size=(int)count;
+    tempbuffer_size=0;
+    tempbuffer = (char *) _aligned_malloc(BufferBytes(count, channels, src_bps, env), 64);
+    if (!tempbuffer)
+      env->ThrowError("ConvertAudio: out of memory");
+    tempbuffer_size=count;
   }
 
   child->GetAudio(tempbuffer, start, count, env);
 
   // Special fast cases
   if (src_format == SAMPLE_INT24 && dst_format == SAMPLE_INT16) {
-      convert24To16(tempbuffer, buf, (int)count*channels);
+      convert24To16(tempbuffer, buf, total);
 
 	return;
   }
   if (src_format == SAMPLE_INT8 && dst_format == SAMPLE_INT16) {
-      convert8To16(tempbuffer, buf, (int)count*channels);
+      convert8To16(tempbuffer, buf, total);
 
 	return;
   }
   if (src_format == SAMPLE_INT16 && dst_format == SAMPLE_INT8) {
-      convert16To8(tempbuffer, buf, (int)count*channels);
+      convert16To8(tempbuffer, buf, total);
 	return;
   }
 
@@ -161,19 +177,22 @@ void __stdcall ConvertAudio::GetAudio(void* buf, __int64 start, __int64 count, I
   else {
     if (floatbuffer_size < count) {
       if (floatbuffer_size) _aligned_free(floatbuffer);
-      floatbuffer = (SFLOAT*)_aligned_malloc((int)count*channels*sizeof(SFLOAT),16);
-      floatbuffer_size=(int)count;
+      floatbuffer_size=0;
+      floatbuffer = (SFLOAT*)_aligned_malloc(BufferBytes(count, channels, sizeof(SFLOAT), env),64);
+      if (!floatbuffer)
+        env->ThrowError("ConvertAudio: out of memory");
+      floatbuffer_size=count;
     }
 	tmp_fb = floatbuffer;
   }
 
   if (src_format != SAMPLE_FLOAT) {  // Skip initial copy, if samples are already float
 	//if ((((*(int*)tmp_fb) & 3) == 0) && (env->GetCPUFlags() & CPUF_SSE2)) {
-      //convertToFloat_SSE2(tempbuffer, tmp_fb, src_format, (int)count*channels);
+      //convertToFloat_SSE2(tempbuffer, tmp_fb, src_format, total);
     //} else if ((env->GetCPUFlags() & CPUF_SSE)) {
-      //convertToFloat_SSE(tempbuffer, tmp_fb, src_format, (int)count*channels);
+      //convertToFloat_SSE(tempbuffer, tmp_fb, src_format, total);
     //} else {
-      convertToFloat(tempbuffer, tmp_fb, src_format, (int)count*channels);
+      convertToFloat(tempbuffer, tmp_fb, src_format, total);
     //}
   } else {
     tmp_fb = (float*)tempbuffer;
@@ -181,11 +200,11 @@ void __stdcall ConvertAudio::GetAudio(void* buf, __int64 start, __int64 count, I
 
   if (dst_format != SAMPLE_FLOAT) {  // Skip final copy, if samples are to be float
 	//if ((env->GetCPUFlags() & CPUF_SSE2)) {
-	  //convertFromFloat_SSE2(tmp_fb, buf, dst_format, (int)count*channels);
+	  //convertFromFloat_SSE2(tmp_fb, buf, dst_format, total);
 	//} else if ((env->GetCPUFlags() & CPUF_SSE)) {
-	  //convertFromFloat_SSE(tmp_fb, buf, dst_format, (int)count*channels);
+	  //convertFromFloat_SSE(tmp_fb, buf, dst_format, total);
 	//} else {
-	  convertFromFloat(tmp_fb, buf, dst_format, (int)count*channels);
+	  convertFromFloat(tmp_fb, buf, dst_format, total);
 	//}
   }
 }
@@ -250,8 +269,8 @@ void __stdcall ConvertAudio::GetAudio(void* buf, __int64 start, __int64 count, I
 // convertToFloat
 //================
 
-void ConvertAudio::convertToFloat(char* inbuf, float* outbuf, char sample_type, int count) {
-  int i;
+void ConvertAudio::convertToFloat(char* inbuf, float* outbuf, char sample_type, __int64 count) {
+  __int64 i;
   switch (sample_type) {
     case SAMPLE_INT8: {
       const float divisor = float(1.0 / 128);
@@ -299,8 +318,8 @@ void ConvertAudio::convertToFloat(char* inbuf, float* outbuf, char sample_type,
 }
 
 
-void ConvertAudio::convertFromFloat(float* inbuf,void* outbuf, char sample_type, int count) {
-  int i;
+void ConvertAudio::convertFromFloat(float* inbuf,void* outbuf, char sample_type, __int64 count) {
+  __int64 i;
   switch (sample_type) {
     case SAMPLE_INT8: {
       unsigned char* samples = (unsigned char*)outbuf;
@@ -50,8 +50,8 @@ public:
   virtual ~ConvertAudio();
 
 private:
-  void convertToFloat(char* inbuf, float* outbuf, char sample_type, int count);
-  void convertFromFloat(float* inbuf, void* outbuf, char sample_type, int count);
+  void convertToFloat(char* inbuf, float* outbuf, char sample_type, __int64 count);
+  void convertFromFloat(float* inbuf, void* outbuf, char sample_type, __int64 count);
 
   __inline int Saturate_int8(float n);
   __inline short Saturate_int16(float n);
@@ -61,9 +61,9 @@ private:
   char src_format;
   char dst_format;
   int src_bps;
-  int tempbuffer_size;
+  __int64 tempbuffer_size;
   char *tempbuffer;
-  int floatbuffer_size;
+  __int64 floatbuffer_size;
   SFLOAT *floatbuffer;
 };
 
@@ -0,0 +1,185 @@
+/*
+ * Half-band decimator for AudioGraph
+ *
+ * See decimator.h.
+ */
+
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+#include "decimator.h"
+#include "engine/channels.h"
+
+/*
+ * The odd taps of the half-band filter, innermost first (the centre tap is
+ * 1/2 and the even taps are 0).  A Kaiser windowed sinc, rescaled so that the
+ * gain at DC is exactly 1; about 47 dB down from 3/4 of the stage's Nyquist
+ * frequency.
+ */
+static const float halfband_taps[4] = { 0.300649115f, -0.062679686f, 0.012706252f, -0.000675681f };
+
+
+/*
+ * Decimator::Create
+ *
+ * Wrap a clip in a decimator that brings its audio down to the lowest rate,
+ * halving at a time, that is still at least working_rate.  The clip is
+ * returned as it is if no halving is needed.
+ *
+ * Parameters:
+ *   clip           A clip with 16-bit or 8-bit audio.
+ *   working_rate   The lowest acceptable rate, or 0 for no decimation.
+ */
+PClip Decimator::Create(PClip clip, int working_rate, IScriptEnvironment* env)
+{
+	if (working_rate < 0)
+		env->ThrowError("AudioGraph: working_rate must not be negative");
+	const VideoInfo& vi = clip->GetVideoInfo();
+	int stages = 0;
+	if (working_rate > 0 && vi.HasAudio())
+		while (stages < DECIMATOR_MAX_STAGES && (vi.audio_samples_per_second >> (stages + 1)) >= working_rate)
+			stages++;
+	return (stages) ? new Decimator(clip, stages) : clip;
+}
+
+
+/*
+ * Decimator::Decimator
+ *
+ * Parameters:
+ *   _stages        The number of halvings.
+ */
+Decimator::Decimator(PClip _child, int _stages) :
+	GenericVideoFilter(_child),
+	stages(_stages),
+	factor(1 << _stages),
+	channels(vi.AudioChannels()),
+	next(-1)
+{
+	// Each stage is centred (DECIMATOR_HISTORY / 2 - 1) of its input samples back.
+	delay = (__int64)(DECIMATOR_HISTORY / 2 - 1) * (factor - 1);
+	vi.audio_samples_per_second >>= stages;
+	vi.num_audio_samples = (vi.num_audio_samples + factor - 1) / factor;
+	vi.sample_type = SAMPLE_INT16;
+
+	/*
+	 * A stage reads its input after DECIMATOR_HISTORY samples of history, and
+	 * reads up to 32 floats past the end when finishing its last four outputs.
+	 */
+	stride = (DECIMATOR_HISTORY + (size_t)DECIMATOR_BLOCK * factor + 32 + 3) & ~(size_t)3;
+	raw.resize((size_t)DECIMATOR_BLOCK * factor * _child->GetVideoInfo().BytesPerAudioSample());
+	planes.resize(stride * channels);
+	scratch.resize(stride);
+	history.resize((size_t)stages * channels * DECIMATOR_HISTORY);
+}
+
+
+int __stdcall Decimator::SetCacheHints(int cachehints, int frame_range)
+{
+	return child->SetCacheHints(cachehints, frame_range);
+}
+
+
+/*
+ * Halve the rate of count input samples at x + DECIMATOR_HISTORY, preceded
+ * by DECIMATOR_HISTORY samples of history.  Output j consumes inputs 2j and
+ * 2j + 1, and is centred on input 2j - 6.  count must be even.
+ */
+static void HalfBand(const float *x, int count, float *y)
+{
+	const __m128 centre = _mm_set1_ps(0.5f);
+	const __m128 c1 = _mm_set1_ps(halfband_taps[0]);
+	const __m128 c3 = _mm_set1_ps(halfband_taps[1]);
+	const __m128 c5 = _mm_set1_ps(halfband_taps[2]);
+	const __m128 c7 = _mm_set1_ps(halfband_taps[3]);
+#define ODD(k) _mm_shuffle_ps(_mm_loadu_ps(p + (k) - 1), _mm_loadu_ps(p + (k) + 3), _MM_SHUFFLE(3, 1, 3, 1))
+	for (int j = 0; j < count / 2; j += 4)
+	{
+		const float *p = x + 2 * j;
+		__m128 even = _mm_shuffle_ps(_mm_loadu_ps(p + 8), _mm_loadu_ps(p + 12), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 sum = _mm_mul_ps(even, centre);
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(ODD(7), ODD(9)), c1));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(ODD(5), ODD(11)), c3));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(ODD(3), ODD(13)), c5));
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_add_ps(ODD(1), ODD(15)), c7));
+		_mm_storeu_ps(y + j, sum);
+	}
+#undef ODD
+}
+
+
+/*
+ * Decimator::Process
+ *
+ * Produce count (at most DECIMATOR_BLOCK) working samples from the source
+ * audio, continuing from the filter state in history.
+ *
+ * Parameters:
+ *   start          The first working sample.
+ *   output         Receives count interleaved 16-bit samples, or NULL to
+ *                  only update the filter state.
+ */
+void Decimator::Process(__int64 start, int count, int16_t *output, IScriptEnvironment* env)
+{
+	const int source_count = count * factor;
+	child->GetAudio(raw.data(), start * factor + delay, source_count, env);
+	if (child->GetVideoInfo().SampleType() == SAMPLE_INT16)
+		Deinterleave16((const int16_t*)raw.data(), channels, source_count, 1.0f / 32768, &planes[DECIMATOR_HISTORY], stride);
+	else
+		Deinterleave8(raw.data(), channels, source_count, 1.0f / 128, &planes[DECIMATOR_HISTORY], stride);
+
+	for (int channel = 0; channel < channels; channel++)
+	{
+		// The stages alternate between the channel's plane and the scratch buffer.
+		float *input = &planes[channel * stride];
+		float *other = scratch.data();
+		int n = source_count;
+		for (int stage = 0; stage < stages; stage++)
+		{
+			float *state = &history[((size_t)stage * channels + channel) * DECIMATOR_HISTORY];
+			memcpy(input, state, DECIMATOR_HISTORY * sizeof(float));
+			HalfBand(input, n, other + DECIMATOR_HISTORY);
+			memcpy(state, input + n, DECIMATOR_HISTORY * sizeof(float));
+			float *swap = input;
+			input = other;
+			other = swap;
+			n /= 2;
+		}
+		if (output)
+		{
+			const float *result = input + DECIMATOR_HISTORY;
+			for (int i = 0; i < count; i++)
+			{
+				float value = floorf(result[i] * 32768.0f + 0.5f);
+				output[(size_t)i * channels + channel] = (int16_t)((value > 32767.0f) ? 32767 : (value < -32768.0f) ? -32768 : (int)value);
+			}
+		}
+	}
+}
+
+
+/*
+ * Decimator::GetAudio
+ *
+ * Get count working samples from start.
+ */
+void __stdcall Decimator::GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env)
+{
+	if (start != next)
+	{
+		// Warm up: the filters look back less than DECIMATOR_HISTORY working samples.
+		memset(history.data(), 0, history.size() * sizeof(float));
+		Process(start - DECIMATOR_HISTORY, DECIMATOR_HISTORY, NULL, env);
+	}
+	int16_t *output = (int16_t*)buf;
+	while (count > 0)
+	{
+		int block = (int)((count < DECIMATOR_BLOCK) ? count : DECIMATOR_BLOCK);
+		Process(start, block, output, env);
+		output += (size_t)block * channels;
+		start += block;
+		count -= block;
+	}
+	next = start;
+}
@@ -0,0 +1,58 @@
+/*
+ * Half-band decimator for AudioGraph
+ *
+ * A clip that presents the audio of its child at a working rate 2, 4, ... 64
+ * times lower, through a cascade of 15 tap half-band FIR filters, each of
+ * which halves the rate.  Every other tap of a half-band filter is zero, so
+ * each output costs 5 multiplies, computed four outputs at a time with SSE2.
+ * AudioGraph reads every reduction, and builds the frame index, through
+ * this clip, so their cost no longer grows with the source rate.  The
+ * decimated audio is only used for analysis; AudioGraph's output keeps the
+ * source audio.
+ *
+ * The filter state is carried from one request to the next when they are
+ * contiguous, as when playing through a clip.  Any other request warms the
+ * filters up on the audio just before it first, which gives exactly the same
+ * samples, since the filters only look back a finite number of samples.
+ *
+ * The cascade delays the audio by a whole number of source samples, which is
+ * compensated for, so working sample n is centred on source sample
+ * n * Factor().  The output is always 16-bit.
+ */
+
+#ifndef __DECIMATOR_H__
+#define __DECIMATOR_H__
+
+#include <vector>
+
+#include "avisynth.h"
+
+#define DECIMATOR_TAPS 15
+#define DECIMATOR_HISTORY (DECIMATOR_TAPS - 1)
+#define DECIMATOR_BLOCK 1024
+#define DECIMATOR_MAX_STAGES 6
+
+class Decimator : public GenericVideoFilter
+{
+public:
+	static PClip Create(PClip clip, int working_rate, IScriptEnvironment* env);
+	Decimator(PClip _child, int _stages);
+	void __stdcall GetAudio(void* buf, __int64 start, __int64 count, IScriptEnvironment* env);
+	int __stdcall SetCacheHints(int cachehints, int frame_range);
+	int Factor() const { return factor; }
+private:
+	void Process(__int64 start, int count, int16_t *output, IScriptEnvironment* env);
+
+	int stages;
+	int factor;
+	int channels;
+	__int64 delay;
+	__int64 next;
+	size_t stride;
+	std::vector<uint8_t> raw;
+	std::vector<float> planes;
+	std::vector<float> scratch;
+	std::vector<float> history;
+};
+
+#endif //__DECIMATOR_H__
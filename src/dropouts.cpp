@@ -0,0 +1,206 @@
+/*
+ * Dropout detector for AudioGraph
+ *
+ * See dropouts.h.
+ */
+
+#include <emmintrin.h>
+
+#include "dropouts.h"
+
+
+/*
+ * DropoutDetector::DropoutDetector
+ *
+ * Parameters:
+ *   sample_rate    The rate of the audio, which sets the longest gap and the
+ *                  repeat lags.
+ *   _channels      The number of interleaved channels.
+ */
+DropoutDetector::DropoutDetector(int sample_rate, int _channels) :
+	channels(_channels)
+{
+	max_zeros = sample_rate / 10;
+	lags[0] = sample_rate / 200;
+	lags[1] = sample_rate / 100;
+	lags[2] = sample_rate / 50;
+	// Every event is seen whole by a scan that covers this much audio either side of it.
+	margin = max_zeros + 2 * lags[DROPOUT_LAGS - 1] + DROPOUT_STEP_BLOCK;
+}
+
+
+/*
+ * DropoutDetector::Compare
+ *
+ * Set bit i of masks where value i equals the value shift values before it,
+ * or zero if shift is 0, 16 values per word.  Values with nothing shift
+ * values before them never match.
+ */
+void DropoutDetector::Compare(const int16_t *values, int count, int shift)
+{
+	const int words = (count + 15) / 16;
+	masks.assign(words, 0);
+	const __m128i zero = _mm_setzero_si128();
+	for (int w = 0; w < words; w++)
+	{
+		const int i = w * 16;
+		if (i >= shift && i + 16 <= count)
+		{
+			__m128i a0 = _mm_loadu_si128((const __m128i*)&values[i]);
+			__m128i a1 = _mm_loadu_si128((const __m128i*)&values[i + 8]);
+			__m128i b0 = (shift) ? _mm_loadu_si128((const __m128i*)&values[i - shift]) : zero;
+			__m128i b1 = (shift) ? _mm_loadu_si128((const __m128i*)&values[i + 8 - shift]) : zero;
+			__m128i equal = _mm_packs_epi16(_mm_cmpeq_epi16(a0, b0), _mm_cmpeq_epi16(a1, b1));
+			masks[w] = (uint16_t)_mm_movemask_epi8(equal);
+			continue;
+		}
+		uint16_t mask = 0;
+		for (int b = 0; b < 16 && i + b < count; b++)
+			if (i + b >= shift && values[i + b] == ((shift) ? values[i + b - shift] : 0))
+				mask |= (uint16_t)(1 << b);
+		masks[w] = mask;
+	}
+}
+
+
+/*
+ * DropoutDetector::Runs
+ *
+ * Call found(first, length) for every run of set bits in masks, in values.
+ * Words that are all set or all clear are stepped over whole.
+ */
+template<class Found>
+void DropoutDetector::Runs(int count, Found found) const
+{
+	int run_start = -1;
+	for (int w = 0; w * 16 < count; w++)
+	{
+		const uint16_t mask = masks[w];
+		if (mask == 0xFFFF && run_start >= 0)
+			continue;
+		if (mask == 0 && run_start < 0)
+			continue;
+		for (int b = 0; b < 16; b++)
+		{
+			const int i = w * 16 + b;
+			if (i >= count)
+				break;
+			if (mask & (1 << b))
+			{
+				if (run_start < 0)
+					run_start = i;
+			}
+			else if (run_start >= 0)
+			{
+				found(run_start, i - run_start);
+				run_start = -1;
+			}
+		}
+	}
+	if (run_start >= 0)
+		found(run_start, count - run_start);
+}
+
+
+/*
+ * DropoutDetector::Edge
+ *
+ * The largest magnitude in samples [first, end), in any channel.
+ */
+int DropoutDetector::Edge(const int16_t *samples, int first, int end, int count) const
+{
+	int largest = 0;
+	for (int i = (first > 0) ? first * channels : 0; i < end * channels && i < count * channels; i++)
+	{
+		int magnitude = (samples[i] < 0) ? -samples[i] : samples[i];
+		if (magnitude > largest)
+			largest = magnitude;
+	}
+	return largest;
+}
+
+
+/*
+ * DropoutDetector::Scan
+ *
+ * Find the dropouts in some audio.  Runs that reach either end of it are
+ * left out, as their length is unknown, so the audio should extend Margin()
+ * samples either side of the part of interest.
+ *
+ * Parameters:
+ *   samples    Interleaved 16-bit audio.
+ *   count      The number of samples (per channel).
+ *   origin     The clip position of the first sample.
+ *   events     Receives the events, at clip positions.
+ */
+void DropoutDetector::Scan(const int16_t *samples, int count, int64_t origin, std::vector<DropoutEvent>& events)
+{
+	const int values = count * channels;
+
+	// Gaps: exact zeros in every channel, cutting off audio on at least one side.
+	Compare(samples, values, 0);
+	Runs(values, [&](int first, int length)
+	{
+		if (first == 0 || first + length == values)
+			return;
+		int start = (first + channels - 1) / channels;
+		int end = (first + length) / channels;
+		if (end - start < DROPOUT_MIN_ZEROS || end - start > max_zeros)
+			return;
+		if (Edge(samples, start - DROPOUT_EDGE, start, count) >= DROPOUT_EDGE_LEVEL || Edge(samples, end, end + DROPOUT_EDGE, count) >= DROPOUT_EDGE_LEVEL)
+			events.push_back({ origin + start, end - start, DROPOUT_ZEROS });
+	});
+
+	// Repeats: a copy of the lag before, in audio that is not just held.
+	Compare(samples, values, channels);
+	held.swap(masks);
+	for (int l = 0; l < DROPOUT_LAGS; l++)
+	{
+		const int lag = lags[l];
+		if (lag <= 0 || lag >= count)
+			continue;
+		Compare(samples, values, lag * channels);
+		Runs(values, [&](int first, int length)
+		{
+			if (first == lag * channels || first + length == values)
+				return;
+			if (length < lag / 2 * channels || length > 2 * lag * channels)
+				return;
+			bool varying = false;
+			for (int i = first; i < first + length && !varying; i++)
+				varying = !(held[i >> 4] & (1 << (i & 15)));
+			if (varying)
+				events.push_back({ origin + first / channels, length / channels, DROPOUT_REPEAT });
+		});
+	}
+
+	// Steps: a jump far above the mean jump of its block.
+	const __m128i ones = _mm_set1_epi16(1);
+	const int block_values = DROPOUT_STEP_BLOCK * channels;
+	int block = (int)(((-origin) % DROPOUT_STEP_BLOCK + DROPOUT_STEP_BLOCK) % DROPOUT_STEP_BLOCK);
+	if (block == 0)
+		block = DROPOUT_STEP_BLOCK;
+	for (; block + DROPOUT_STEP_BLOCK <= count; block += DROPOUT_STEP_BLOCK)
+	{
+		const int16_t *v = &samples[(size_t)block * channels];
+		__m128i largest = _mm_setzero_si128();
+		__m128i total = _mm_setzero_si128();
+		for (int i = 0; i < block_values; i += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)&v[i]);
+			__m128i b = _mm_loadu_si128((const __m128i*)&v[i - channels]);
+			__m128i jump = _mm_max_epi16(_mm_subs_epi16(a, b), _mm_subs_epi16(b, a));
+			largest = _mm_max_epi16(largest, jump);
+			total = _mm_add_epi32(total, _mm_madd_epi16(jump, ones));
+		}
+		largest = _mm_max_epi16(largest, _mm_srli_si128(largest, 8));
+		largest = _mm_max_epi16(largest, _mm_srli_si128(largest, 4));
+		largest = _mm_max_epi16(largest, _mm_srli_si128(largest, 2));
+		total = _mm_add_epi32(total, _mm_srli_si128(total, 8));
+		total = _mm_add_epi32(total, _mm_srli_si128(total, 4));
+		const int jump = (int16_t)_mm_cvtsi128_si32(largest);
+		const int64_t rest = _mm_cvtsi128_si32(total) - jump;
+		if (jump >= DROPOUT_STEP_LEVEL && (int64_t)jump * (block_values - 1) > (int64_t)DROPOUT_STEP_RATIO * rest)
+			events.push_back({ origin + block, DROPOUT_STEP_BLOCK, DROPOUT_STEP });
+	}
+}
@@ -0,0 +1,74 @@
+/*
+ * Dropout detector for AudioGraph
+ *
+ * Finds the damage that tape transfers and network captures leave in
+ * digital audio, in interleaved 16-bit samples:
+ *
+ *   zeros     A gap of exact zeros in every channel, between DROPOUT_MIN_ZEROS
+ *             samples and 100 ms long, that cuts off audio on at least one
+ *             side: the DROPOUT_EDGE samples before or after it reach
+ *             DROPOUT_EDGE_LEVEL.  A fade to silence is not a gap, nor is
+ *             silence at the edges of the scanned audio.
+ *   repeat    A stretch of 5, 10 or 20 ms that is an exact copy of the one
+ *             before it, as left by packet loss concealment or a stuck
+ *             buffer.  A signal that keeps repeating for more than twice the
+ *             lag (a test tone) is periodic, not a repeat.
+ *   step      A jump between two samples of at least DROPOUT_STEP_LEVEL that
+ *             is DROPOUT_STEP_RATIO times the mean jump of the block of
+ *             DROPOUT_STEP_BLOCK samples around it.
+ *
+ * Each test is one pass of SSE2 compares over the interleaved samples, 16
+ * at a time: equality with zero, with the sample lag channels back, or the
+ * absolute difference from the previous sample.  The compares leave one
+ * bit per sample, and runs are only followed bit by bit in words that are
+ * neither all set nor all clear.  Step blocks are aligned to absolute sample
+ * positions, so the same audio gives the same events however it is cut into
+ * scans.
+ */
+
+#ifndef __DROPOUTS_H__
+#define __DROPOUTS_H__
+
+#include <stdint.h>
+#include <vector>
+
+#define DROPOUT_ZEROS 1
+#define DROPOUT_REPEAT 2
+#define DROPOUT_STEP 4
+
+#define DROPOUT_MIN_ZEROS 32
+#define DROPOUT_EDGE 8
+#define DROPOUT_EDGE_LEVEL 1024
+#define DROPOUT_STEP_LEVEL 8192
+#define DROPOUT_STEP_RATIO 8
+#define DROPOUT_STEP_BLOCK 64
+#define DROPOUT_LAGS 3
+
+struct DropoutEvent
+{
+	int64_t start;
+	int length;
+	int kind;
+};
+
+class DropoutDetector
+{
+public:
+	DropoutDetector(int sample_rate, int _channels);
+	int Margin() const { return margin; }
+	void Scan(const int16_t *samples, int count, int64_t origin, std::vector<DropoutEvent>& events);
+private:
+	void Compare(const int16_t *values, int count, int shift);
+	int Edge(const int16_t *samples, int first, int end, int count) const;
+	template<class Found>
+	void Runs(int count, Found found) const;
+
+	int channels;
+	int max_zeros;
+	int lags[DROPOUT_LAGS];
+	int margin;
+	std::vector<uint16_t> masks;
+	std::vector<uint16_t> held;
+};
+
+#endif //__DROPOUTS_H__
@@ -0,0 +1,253 @@
+/*
+ * Channel layout helpers for AudioGraph
+ *
+ * See channels.h.
+ */
+
+#include <emmintrin.h>
+
+#include "channels.h"
+
+
+/*
+ * Transpose an 8x8 tile of 16-bit values in place: row r holds 8 channels of
+ * sample r on entry, and row c holds 8 samples of channel c on exit.
+ */
+static inline void Transpose8x8(__m128i *rows)
+{
+	__m128i a0 = _mm_unpacklo_epi16(rows[0], rows[1]);
+	__m128i a1 = _mm_unpackhi_epi16(rows[0], rows[1]);
+	__m128i a2 = _mm_unpacklo_epi16(rows[2], rows[3]);
+	__m128i a3 = _mm_unpackhi_epi16(rows[2], rows[3]);
+	__m128i a4 = _mm_unpacklo_epi16(rows[4], rows[5]);
+	__m128i a5 = _mm_unpackhi_epi16(rows[4], rows[5]);
+	__m128i a6 = _mm_unpacklo_epi16(rows[6], rows[7]);
+	__m128i a7 = _mm_unpackhi_epi16(rows[6], rows[7]);
+
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	rows[0] = _mm_unpacklo_epi64(b0, b4);
+	rows[1] = _mm_unpackhi_epi64(b0, b4);
+	rows[2] = _mm_unpacklo_epi64(b1, b5);
+	rows[3] = _mm_unpackhi_epi64(b1, b5);
+	rows[4] = _mm_unpacklo_epi64(b2, b6);
+	rows[5] = _mm_unpackhi_epi64(b2, b6);
+	rows[6] = _mm_unpacklo_epi64(b3, b7);
+	rows[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+
+/*
+ * Store a transposed tile: 8 samples of each of 8 consecutive channels,
+ * sign extended, converted to float and scaled.
+ */
+static inline void StoreTile(const __m128i *rows, __m128 scale, float *plane, size_t stride)
+{
+	for (int c = 0; c < CHANNEL_TILE; c++, plane += stride)
+	{
+		__m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(rows[c], rows[c]), 16);
+		__m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(rows[c], rows[c]), 16);
+		_mm_storeu_ps(plane, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+		_mm_storeu_ps(plane + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+	}
+}
+
+
+static inline int HorizontalSum(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+
+/*
+ * Deinterleave16
+ *
+ * Split interleaved 16-bit audio into float channel planes.
+ *
+ * Parameters:
+ *   src            count samples of channels interleaved values.
+ *   scale          The factor applied to every value.
+ *   planes         Receives channel c at planes + c * stride.
+ */
+void Deinterleave16(const int16_t *src, int channels, int count, float scale, float *planes, size_t stride)
+{
+	const int tiled_channels = channels - channels % CHANNEL_TILE;
+	const int tiled_count = count - count % CHANNEL_TILE;
+	const __m128 scales = _mm_set1_ps(scale);
+	__m128i rows[CHANNEL_TILE];
+
+	for (int c0 = 0; c0 < tiled_channels; c0 += CHANNEL_TILE)
+	{
+		for (int i = 0; i < tiled_count; i += CHANNEL_TILE)
+		{
+			for (int r = 0; r < CHANNEL_TILE; r++)
+				rows[r] = _mm_loadu_si128((const __m128i*)&src[(size_t)(i + r) * channels + c0]);
+			Transpose8x8(rows);
+			StoreTile(rows, scales, &planes[c0 * stride + i], stride);
+		}
+		for (int channel = c0; channel < c0 + CHANNEL_TILE; channel++)
+			for (int i = tiled_count; i < count; i++)
+				planes[channel * stride + i] = src[(size_t)i * channels + channel] * scale;
+	}
+
+	for (int channel = tiled_channels; channel < channels; channel++)
+	{
+		float *dst = &planes[channel * stride];
+		for (int i = 0; i < count; i++)
+			dst[i] = src[(size_t)i * channels + channel] * scale;
+	}
+}
+
+
+/*
+ * Deinterleave8
+ *
+ * As Deinterleave16, for unsigned 8-bit audio, which is recentred on 0
+ * before scaling.
+ */
+void Deinterleave8(const uint8_t *src, int channels, int count, float scale, float *planes, size_t stride)
+{
+	const int tiled_channels = channels - channels % CHANNEL_TILE;
+	const int tiled_count = count - count % CHANNEL_TILE;
+	const __m128 scales = _mm_set1_ps(scale);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi16(128);
+	__m128i rows[CHANNEL_TILE];
+
+	for (int c0 = 0; c0 < tiled_channels; c0 += CHANNEL_TILE)
+	{
+		for (int i = 0; i < tiled_count; i += CHANNEL_TILE)
+		{
+			for (int r = 0; r < CHANNEL_TILE; r++)
+			{
+				__m128i row = _mm_loadl_epi64((const __m128i*)&src[(size_t)(i + r) * channels + c0]);
+				rows[r] = _mm_sub_epi16(_mm_unpacklo_epi8(row, zero), bias);
+			}
+			Transpose8x8(rows);
+			StoreTile(rows, scales, &planes[c0 * stride + i], stride);
+		}
+		for (int channel = c0; channel < c0 + CHANNEL_TILE; channel++)
+			for (int i = tiled_count; i < count; i++)
+				planes[channel * stride + i] = (src[(size_t)i * channels + channel] - 128) * scale;
+	}
+
+	for (int channel = tiled_channels; channel < channels; channel++)
+	{
+		float *dst = &planes[channel * stride];
+		for (int i = 0; i < count; i++)
+			dst[i] = (src[(size_t)i * channels + channel] - 128) * scale;
+	}
+}
+
+
+/*
+ * DeinterleaveFloat
+ *
+ * As Deinterleave16, for float audio, which is copied unscaled.
+ */
+void DeinterleaveFloat(const float *src, int channels, int count, float *planes, size_t stride)
+{
+	const int tiled_channels = channels - channels % 4;
+	const int tiled_count = count - count % 4;
+
+	for (int c0 = 0; c0 < tiled_channels; c0 += 4)
+	{
+		float *plane = &planes[c0 * stride];
+		for (int i = 0; i < tiled_count; i += 4)
+		{
+			__m128 row0 = _mm_loadu_ps(&src[(size_t)i * channels + c0]);
+			__m128 row1 = _mm_loadu_ps(&src[(size_t)(i + 1) * channels + c0]);
+			__m128 row2 = _mm_loadu_ps(&src[(size_t)(i + 2) * channels + c0]);
+			__m128 row3 = _mm_loadu_ps(&src[(size_t)(i + 3) * channels + c0]);
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+			_mm_storeu_ps(&plane[i], row0);
+			_mm_storeu_ps(&plane[stride + i], row1);
+			_mm_storeu_ps(&plane[2 * stride + i], row2);
+			_mm_storeu_ps(&plane[3 * stride + i], row3);
+		}
+		for (int channel = c0; channel < c0 + 4; channel++)
+			for (int i = tiled_count; i < count; i++)
+				planes[channel * stride + i] = src[(size_t)i * channels + channel];
+	}
+
+	for (int channel = tiled_channels; channel < channels; channel++)
+	{
+		float *dst = &planes[channel * stride];
+		for (int i = 0; i < count; i++)
+			dst[i] = src[(size_t)i * channels + channel];
+	}
+}
+
+
+/*
+ * Downmix16
+ *
+ * Sum the channels of each sample of interleaved 16-bit audio, 8 channels
+ * per SSE2 multiply-add.  The integer sums are exact (64 channels of full
+ * scale audio need only 22 bits).
+ *
+ * Parameters:
+ *   src            count samples of channels interleaved values.
+ *   scale          The factor applied to every sum.
+ *   mono           Receives count scaled sums.
+ */
+void Downmix16(const int16_t *src, int channels, int count, float scale, float *mono)
+{
+	const int tiled_channels = channels - channels % CHANNEL_TILE;
+	const __m128i ones = _mm_set1_epi16(1);
+	for (int i = 0; i < count; i++, src += channels)
+	{
+		int sum = 0;
+		if (tiled_channels)
+		{
+			__m128i total = _mm_setzero_si128();
+			for (int channel = 0; channel < tiled_channels; channel += CHANNEL_TILE)
+				total = _mm_add_epi32(total, _mm_madd_epi16(_mm_loadu_si128((const __m128i*)&src[channel]), ones));
+			sum = HorizontalSum(total);
+		}
+		for (int channel = tiled_channels; channel < channels; channel++)
+			sum += src[channel];
+		mono[i] = sum * scale;
+	}
+}
+
+
+/*
+ * Downmix8
+ *
+ * As Downmix16, for unsigned 8-bit audio: 16 channels at a time are summed
+ * with a sum of absolute differences against zero, and the 128 offset of
+ * every channel is taken off at the end.
+ */
+void Downmix8(const uint8_t *src, int channels, int count, float scale, float *mono)
+{
+	const int wide_channels = channels - channels % 16;
+	const int tiled_channels = channels - channels % CHANNEL_TILE;
+	const __m128i zero = _mm_setzero_si128();
+	for (int i = 0; i < count; i++, src += channels)
+	{
+		int sum = 0;
+		if (tiled_channels)
+		{
+			__m128i total = _mm_setzero_si128();
+			int channel = 0;
+			for (; channel < wide_channels; channel += 16)
+				total = _mm_add_epi64(total, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&src[channel]), zero));
+			if (channel < tiled_channels)
+				total = _mm_add_epi64(total, _mm_sad_epu8(_mm_loadl_epi64((const __m128i*)&src[channel]), zero));
+			sum = _mm_cvtsi128_si32(_mm_add_epi64(total, _mm_unpackhi_epi64(total, total)));
+		}
+		for (int channel = tiled_channels; channel < channels; channel++)
+			sum += src[channel];
+		mono[i] = (sum - 128 * channels) * scale;
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ * Channel layout helpers for AudioGraph
+ *
+ * Splitting interleaved audio into channel planes, or folding it down to
+ * mono, with a plain loop per channel reads the whole buffer once per
+ * channel, which stops being memory bound long before 64 channels.  These
+ * work on tiles of 8 channels by 8 samples instead: each tile is loaded as 8
+ * rows, transposed with SSE2 shuffles and stored as 8 plane segments, so the
+ * interleaved data is read exactly once whatever the channel count.  Any
+ * channels left over after the last whole tile, and the samples after the
+ * last whole tile, take the scalar path.  Float audio uses tiles of 4 by 4,
+ * the width of an SSE register.
+ */
+
+#ifndef __CHANNELS_H__
+#define __CHANNELS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHANNEL_TILE 8
+
+void Deinterleave16(const int16_t *src, int channels, int count, float scale, float *planes, size_t stride);
+void Deinterleave8(const uint8_t *src, int channels, int count, float scale, float *planes, size_t stride);
+void DeinterleaveFloat(const float *src, int channels, int count, float *planes, size_t stride);
+void Downmix16(const int16_t *src, int channels, int count, float scale, float *mono);
+void Downmix8(const uint8_t *src, int channels, int count, float scale, float *mono);
+
+#endif //__CHANNELS_H__
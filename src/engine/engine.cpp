@@ -0,0 +1,138 @@
+/*
+ * Reduction engine for AudioGraph
+ *
+ * See engine.h.
+ */
+
+#include <string.h>
+
+#include "channels.h"
+#include "engine.h"
+
+// The number of samples folded to mono at a time.
+#define ENGINE_CHUNK 65536
+
+
+/*
+ * PcmFormat::Valid
+ *
+ * Returns:
+ *   Whether the engine can read audio in this format.
+ */
+bool PcmFormat::Valid() const
+{
+	if (sample_rate <= 0 || channels <= 0 || num_samples < 0)
+		return false;
+	if (is_float)
+		return bits_per_sample == 32;
+	return bits_per_sample == 8 || bits_per_sample == 16 || bits_per_sample == 24 || bits_per_sample == 32;
+}
+
+
+/*
+ * MixPcmToMono
+ *
+ * Average the channels of interleaved PCM into one float plane, scaled to
+ * [-1, 1).  8-bit and 16-bit audio, which is all the plugin ever sees, takes
+ * the tiled SSE2 path of channels.h.
+ *
+ * Parameters:
+ *   pcm        The interleaved audio.
+ *   count      The number of samples (per channel).
+ *   mono       Receives count floats.
+ */
+void MixPcmToMono(const uint8_t *pcm, const PcmFormat& format, int count, float *mono)
+{
+	const int channels = format.channels;
+	if (format.is_float)
+	{
+		const float scale = 1.0f / channels;
+		for (int i = 0; i < count; i++)
+		{
+			float sum = 0.0f;
+			for (int channel = 0; channel < channels; channel++, pcm += 4)
+			{
+				float sample;
+				memcpy(&sample, pcm, sizeof(sample));
+				sum += sample;
+			}
+			mono[i] = sum * scale;
+		}
+	}
+	else if (format.bits_per_sample == 16)
+		Downmix16((const int16_t*)pcm, channels, count, 1.0f / (32768.0f * channels), mono);
+	else if (format.bits_per_sample == 8)
+		Downmix8(pcm, channels, count, 1.0f / (128.0f * channels), mono);
+	else
+	{
+		// 24 and 32-bit samples are read as the top bytes of a 32-bit word.
+		const int bytes = format.bits_per_sample / 8;
+		const double scale = 1.0 / (2147483648.0 * channels);
+		for (int i = 0; i < count; i++)
+		{
+			double sum = 0.0;
+			for (int channel = 0; channel < channels; channel++, pcm += bytes)
+			{
+				uint32_t word = 0;
+				for (int byte = 0; byte < bytes; byte++)
+					word |= (uint32_t)pcm[byte] << (8 * (4 - bytes + byte));
+				sum += (int32_t)word;
+			}
+			mono[i] = (float)(sum * scale);
+		}
+	}
+}
+
+
+/*
+ * PeakIndexBuilder::PeakIndexBuilder
+ *
+ * Parameters:
+ *   _format        The layout of the audio that will be appended.
+ *   block_size     The number of samples summarised by each level 0 entry.
+ */
+PeakIndexBuilder::PeakIndexBuilder(const PcmFormat& _format, int block_size) :
+	format(_format),
+	pyramid(new PeakPyramid(block_size)),
+	mono(ENGINE_CHUNK)
+{
+}
+
+
+PeakIndexBuilder::~PeakIndexBuilder()
+{
+	delete pyramid;
+}
+
+
+/*
+ * PeakIndexBuilder::Append
+ *
+ * Add the next count samples of interleaved PCM to the index.
+ */
+void PeakIndexBuilder::Append(const uint8_t *pcm, int64_t count)
+{
+	while (count > 0)
+	{
+		int chunk = (int)((count < ENGINE_CHUNK) ? count : ENGINE_CHUNK);
+		MixPcmToMono(pcm, format, chunk, mono.data());
+		pyramid->Append(mono.data(), chunk);
+		pcm += (size_t)chunk * format.BytesPerSample();
+		count -= chunk;
+	}
+}
+
+
+/*
+ * PeakIndexBuilder::Finish
+ *
+ * Build the coarser levels and hand the pyramid over to the caller, who
+ * deletes it.  Nothing may be appended afterwards.
+ */
+PeakPyramid* PeakIndexBuilder::Finish()
+{
+	PeakPyramid* result = pyramid;
+	pyramid = NULL;
+	result->Finish();
+	return result;
+}
@@ -0,0 +1,59 @@
+/*
+ * Reduction engine for AudioGraph
+ *
+ * The parts of AudioGraph that turn audio into peak indexes, with no
+ * dependency on AviSynth: folding interleaved PCM down to mono, building the
+ * peak pyramid (peaks.h) and reading and writing it as a sidecar file
+ * (peakfile.h).  The plugin builds its minimap through this engine, and the
+ * audiograph-peaks tool uses it to build the same sidecar files ahead of
+ * time, reading WAV or raw PCM through pcmsource.h.  qc.h measures
+ * loudness and the other delivery checks on channel planes.
+ */
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "peaks.h"
+
+// The number of samples summarised by each level 0 entry of a peak index.
+#define PEAK_BLOCK_SIZE 256
+
+/*
+ * The layout of interleaved PCM: 8-bit samples are unsigned, 16, 24 and
+ * 32-bit integer samples signed, and 32-bit float samples in [-1, 1], all
+ * little-endian, as in a WAV file.
+ */
+struct PcmFormat
+{
+	int sample_rate;
+	int channels;
+	int bits_per_sample;
+	bool is_float;
+	int64_t num_samples;
+
+	int BytesPerSample() const { return channels * (bits_per_sample / 8); }
+	bool Valid() const;
+};
+
+void MixPcmToMono(const uint8_t *pcm, const PcmFormat& format, int count, float *mono);
+
+class PeakIndexBuilder
+{
+public:
+	PeakIndexBuilder(const PcmFormat& _format, int block_size);
+	~PeakIndexBuilder();
+	void Append(const uint8_t *pcm, int64_t count);
+	PeakPyramid* Finish();
+private:
+	PeakIndexBuilder(const PeakIndexBuilder&);
+	PeakIndexBuilder& operator=(const PeakIndexBuilder&);
+
+	PcmFormat format;
+	PeakPyramid* pyramid;
+	std::vector<float> mono;
+};
+
+#endif //__ENGINE_H__
@@ -0,0 +1,175 @@
+/*
+ * PCM sources for the AudioGraph engine
+ *
+ * See pcmsource.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcmsource.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+
+static uint32_t Get16(const uint8_t *p)
+{
+	return p[0] | (uint32_t)p[1] << 8;
+}
+
+
+static uint32_t Get32(const uint8_t *p)
+{
+	return Get16(p) | Get16(p + 2) << 16;
+}
+
+
+PcmSource::PcmSource() :
+	mapping(NULL),
+	mapping_size(0),
+	samples(NULL)
+{
+	memset(&format, 0, sizeof(format));
+}
+
+
+PcmSource::~PcmSource()
+{
+	Close();
+}
+
+
+void PcmSource::Close()
+{
+	if (mapping)
+		munmap(mapping, mapping_size);
+	mapping = NULL;
+	mapping_size = 0;
+	samples = NULL;
+}
+
+
+bool PcmSource::Fail(const std::string& message)
+{
+	Close();
+	error = message;
+	return false;
+}
+
+
+/*
+ * PcmSource::Map
+ *
+ * Map the whole file read-only, and tell the kernel it will be read once
+ * from start to end.
+ */
+bool PcmSource::Map(const char* filename)
+{
+	Close();
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return Fail(std::string("cannot open \"") + filename + "\": " + strerror(errno));
+	struct stat status;
+	if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))
+	{
+		close(fd);
+		return Fail(std::string("\"") + filename + "\" is not a regular file");
+	}
+	mapping_size = (size_t)status.st_size;
+	if (mapping_size)
+	{
+		void* address = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address == MAP_FAILED)
+		{
+			int code = errno;
+			close(fd);
+			mapping_size = 0;
+			return Fail(std::string("cannot map \"") + filename + "\": " + strerror(code));
+		}
+		mapping = (uint8_t*)address;
+		madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	return true;
+}
+
+
+/*
+ * PcmSource::OpenWav
+ *
+ * Open a RIFF WAVE file of integer or float PCM.  A data chunk whose size
+ * runs past the end of the file, as left by a recorder that was stopped
+ * before it could fix up the header, is cut at the end of the file.
+ */
+bool PcmSource::OpenWav(const char* filename)
+{
+	if (!Map(filename))
+		return false;
+	if (mapping_size < 12 || memcmp(mapping, "RIFF", 4) != 0 || memcmp(mapping + 8, "WAVE", 4) != 0)
+		return Fail(std::string("\"") + filename + "\" is not a WAV file");
+
+	bool have_format = false;
+	int tag = 0;
+	memset(&format, 0, sizeof(format));
+	for (size_t position = 12; position + 8 <= mapping_size; )
+	{
+		const uint8_t *chunk = mapping + position;
+		uint64_t size = Get32(chunk + 4);
+		const uint8_t *body = chunk + 8;
+		uint64_t available = mapping_size - position - 8;
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && size <= available)
+		{
+			tag = (int)Get16(body);
+			format.channels = (int)Get16(body + 2);
+			format.sample_rate = (int)Get32(body + 4);
+			format.bits_per_sample = (int)Get16(body + 14);
+			if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 26)
+				tag = (int)Get16(body + 24);
+			format.is_float = (tag == WAVE_FORMAT_IEEE_FLOAT);
+			have_format = true;
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			if (!have_format)
+				return Fail(std::string("\"") + filename + "\" has no fmt chunk before its data");
+			if (tag != WAVE_FORMAT_PCM && tag != WAVE_FORMAT_IEEE_FLOAT)
+				return Fail(std::string("\"") + filename + "\" is not PCM");
+			if (!format.Valid())
+				return Fail(std::string("\"") + filename + "\" has an unsupported sample format");
+			if (size > available)
+				size = available;
+			samples = body;
+			format.num_samples = (int64_t)(size / format.BytesPerSample());
+			return true;
+		}
+		position += 8 + (size_t)size + (size & 1);
+		if (size > available)
+			break;
+	}
+	return Fail(std::string("\"") + filename + "\" has no data chunk");
+}
+
+
+/*
+ * PcmSource::OpenRaw
+ *
+ * Open a file of headerless interleaved PCM.  The number of samples is taken
+ * from the size of the file; a partial sample at the end is ignored.
+ */
+bool PcmSource::OpenRaw(const char* filename, const PcmFormat& _format)
+{
+	if (!_format.Valid())
+		return Fail("unsupported raw sample format");
+	if (!Map(filename))
+		return false;
+	format = _format;
+	format.num_samples = (int64_t)(mapping_size / format.BytesPerSample());
+	samples = mapping;
+	return true;
+}
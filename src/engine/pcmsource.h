@@ -0,0 +1,42 @@
+/*
+ * PCM sources for the AudioGraph engine
+ *
+ * Maps a WAV file, or a file of headerless PCM in a given format, into memory
+ * read-only, so that the engine can walk the samples in place.  POSIX only:
+ * the plugin gets its audio from AviSynth and does not use this.
+ */
+
+#ifndef __PCMSOURCE_H__
+#define __PCMSOURCE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "engine.h"
+
+class PcmSource
+{
+public:
+	PcmSource();
+	~PcmSource();
+	bool OpenWav(const char* filename);
+	bool OpenRaw(const char* filename, const PcmFormat& _format);
+	const PcmFormat& Format() const { return format; }
+	const uint8_t* Samples() const { return samples; }
+	const std::string& Error() const { return error; }
+private:
+	PcmSource(const PcmSource&);
+	PcmSource& operator=(const PcmSource&);
+	bool Map(const char* filename);
+	bool Fail(const std::string& message);
+	void Close();
+
+	uint8_t* mapping;
+	size_t mapping_size;
+	const uint8_t* samples;
+	PcmFormat format;
+	std::string error;
+};
+
+#endif //__PCMSOURCE_H__
@@ -0,0 +1,135 @@
+/*
+ * Peak files for AudioGraph
+ *
+ * See peakfile.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "peakfile.h"
+
+#define PEAK_FILE_HEADER_SIZE 40
+
+
+static void Put32(uint8_t *p, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+static void Put64(uint8_t *p, uint64_t value)
+{
+	Put32(p, (uint32_t)value);
+	Put32(p + 4, (uint32_t)(value >> 32));
+}
+
+
+static uint32_t Get32(const uint8_t *p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static uint64_t Get64(const uint8_t *p)
+{
+	return Get32(p) | (uint64_t)Get32(p + 4) << 32;
+}
+
+
+/*
+ * WritePeakFile
+ *
+ * Write level 0 of a finished pyramid.
+ *
+ * Parameters:
+ *   format         The audio the pyramid was built from; num_samples is the
+ *                  number of samples that went into it.
+ *
+ * Returns:
+ *   false if the file could not be written.
+ */
+bool WritePeakFile(const char* filename, const PeakPyramid& peaks, const PcmFormat& format)
+{
+	const int64_t num_blocks = peaks.Size(0);
+	uint8_t header[PEAK_FILE_HEADER_SIZE] = { 'A', 'G', 'P', 'K' };
+	Put32(header + 4, PEAK_FILE_VERSION);
+	Put32(header + 8, peaks.BlockSize());
+	Put32(header + 12, format.sample_rate);
+	Put32(header + 16, format.channels);
+	Put64(header + 24, format.num_samples);
+	Put64(header + 32, num_blocks);
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+	const float *minimums = peaks.Minimums(0);
+	const float *maximums = peaks.Maximums(0);
+	uint8_t pairs[8 * 1024];
+	for (int64_t block = 0; ok && block < num_blocks; )
+	{
+		size_t bytes = 0;
+		for (; bytes < sizeof(pairs) && block < num_blocks; bytes += 8, block++)
+		{
+			uint32_t low, high;
+			memcpy(&low, &minimums[block], 4);
+			memcpy(&high, &maximums[block], 4);
+			Put32(pairs + bytes, low);
+			Put32(pairs + bytes + 4, high);
+		}
+		ok = fwrite(pairs, bytes, 1, file) == 1;
+	}
+	if (fclose(file) != 0)
+		ok = false;
+	if (!ok)
+		remove(filename);
+	return ok;
+}
+
+
+/*
+ * ReadPeakFile
+ *
+ * Read a peak file into its header and its pairs of minimum and maximum.
+ *
+ * Returns:
+ *   false if the file could not be opened, is not a peak file of a version
+ *   this build knows, or is truncated.
+ */
+bool ReadPeakFile(const char* filename, PeakFileHeader& header, std::vector<float>& pairs)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+	uint8_t raw[PEAK_FILE_HEADER_SIZE];
+	bool ok = fread(raw, sizeof(raw), 1, file) == 1 && memcmp(raw, "AGPK", 4) == 0;
+	if (ok)
+	{
+		header.version = (int)Get32(raw + 4);
+		header.block_size = (int)Get32(raw + 8);
+		header.sample_rate = (int)Get32(raw + 12);
+		header.channels = (int)Get32(raw + 16);
+		header.num_samples = (int64_t)Get64(raw + 24);
+		header.num_blocks = (int64_t)Get64(raw + 32);
+		ok = header.version == PEAK_FILE_VERSION && header.block_size > 0 && header.sample_rate > 0 && header.channels > 0
+			&& header.num_samples >= 0 && header.num_blocks == (header.num_samples + header.block_size - 1) / header.block_size
+			&& header.num_blocks < (int64_t)1 << 40;
+	}
+	if (ok)
+	{
+		pairs.resize((size_t)header.num_blocks * 2);
+		ok = fread(pairs.data(), 8, (size_t)header.num_blocks, file) == (size_t)header.num_blocks;
+	}
+	fclose(file);
+	if (!ok)
+		return false;
+	// The pairs were read as they are stored; put them in host order.
+	for (size_t i = 0; i < pairs.size(); i++)
+	{
+		uint32_t bits = Get32((const uint8_t*)&pairs[i]);
+		memcpy(&pairs[i], &bits, 4);
+	}
+	return true;
+}
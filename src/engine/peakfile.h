@@ -0,0 +1,45 @@
+/*
+ * Peak files for AudioGraph
+ *
+ * A peak file keeps level 0 of a peak pyramid next to the audio it was built
+ * from, so that the minimap of a long clip can be drawn without reading the
+ * whole clip first.  All fields are little-endian:
+ *
+ *   offset  size  field
+ *        0     4  "AGPK"
+ *        4     4  version, 1
+ *        8     4  block_size, samples per entry
+ *       12     4  sample_rate
+ *       16     4  channels, of the audio before it was mixed to mono
+ *       20     4  reserved, 0
+ *       24     8  num_samples
+ *       32     8  num_blocks, num_samples / block_size rounded up
+ *       40        num_blocks pairs of 32-bit float minimum and maximum
+ *
+ * The last entry covers the samples left over after the last whole block.
+ */
+
+#ifndef __PEAKFILE_H__
+#define __PEAKFILE_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "engine.h"
+
+#define PEAK_FILE_VERSION 1
+
+struct PeakFileHeader
+{
+	int version;
+	int block_size;
+	int sample_rate;
+	int channels;
+	int64_t num_samples;
+	int64_t num_blocks;
+};
+
+bool WritePeakFile(const char* filename, const PeakPyramid& peaks, const PcmFormat& format);
+bool ReadPeakFile(const char* filename, PeakFileHeader& header, std::vector<float>& pairs);
+
+#endif //__PEAKFILE_H__
@@ -0,0 +1,118 @@
+/*
+ * Peak pyramid for AudioGraph
+ *
+ * See peaks.h.
+ */
+
+#include <stddef.h>
+
+#include "peaks.h"
+
+
+/*
+ * PeakPyramid::PeakPyramid
+ *
+ * Parameters:
+ *   _block_size    The number of samples summarised by each level 0 entry.
+ */
+PeakPyramid::PeakPyramid(int _block_size) :
+	block_size(_block_size),
+	filled(0),
+	block_min(0.0f),
+	block_max(0.0f),
+	minimums(1),
+	maximums(1)
+{
+}
+
+
+/*
+ * PeakPyramid::Append
+ *
+ * Add the next samples of the signal to level 0.
+ */
+void PeakPyramid::Append(const float *samples, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		float sample = samples[i];
+		if (!filled)
+			block_min = block_max = sample;
+		else if (sample < block_min)
+			block_min = sample;
+		else if (sample > block_max)
+			block_max = sample;
+		if (++filled == block_size)
+		{
+			minimums[0].push_back(block_min);
+			maximums[0].push_back(block_max);
+			filled = 0;
+		}
+	}
+}
+
+
+/*
+ * PeakPyramid::AppendBlocks
+ *
+ * Add whole level 0 entries that were summarised elsewhere, such as those
+ * read from a peak file, as count pairs of minimum and maximum.
+ */
+void PeakPyramid::AppendBlocks(const float *pairs, int64_t count)
+{
+	minimums[0].reserve(minimums[0].size() + (size_t)count);
+	maximums[0].reserve(maximums[0].size() + (size_t)count);
+	for (int64_t i = 0; i < count; i++)
+	{
+		minimums[0].push_back(pairs[2 * i]);
+		maximums[0].push_back(pairs[2 * i + 1]);
+	}
+}
+
+
+/*
+ * PeakPyramid::Finish
+ *
+ * Close the last, partial block and build the coarser levels.  An odd entry
+ * at the end of a level is carried up on its own.
+ */
+void PeakPyramid::Finish()
+{
+	if (filled)
+	{
+		minimums[0].push_back(block_min);
+		maximums[0].push_back(block_max);
+		filled = 0;
+	}
+	while (minimums.back().size() > 1)
+	{
+		const std::vector<float>& fine_min = minimums.back();
+		const std::vector<float>& fine_max = maximums.back();
+		std::vector<float> coarse_min((fine_min.size() + 1) / 2);
+		std::vector<float> coarse_max(coarse_min.size());
+		for (size_t i = 0; i < coarse_min.size(); i++)
+		{
+			size_t j = (2 * i + 1 < fine_min.size()) ? 2 * i + 1 : 2 * i;
+			coarse_min[i] = (fine_min[2 * i] < fine_min[j]) ? fine_min[2 * i] : fine_min[j];
+			coarse_max[i] = (fine_max[2 * i] > fine_max[j]) ? fine_max[2 * i] : fine_max[j];
+		}
+		minimums.push_back(coarse_min);
+		maximums.push_back(coarse_max);
+	}
+}
+
+
+/*
+ * PeakPyramid::LevelForWidth
+ *
+ * Returns:
+ *   The coarsest level with at least width entries, or level 0 if even that
+ *   has fewer.
+ */
+int PeakPyramid::LevelForWidth(int width) const
+{
+	int level = 0;
+	while (level + 1 < Levels() && Size(level + 1) >= width)
+		level++;
+	return level;
+}
@@ -0,0 +1,38 @@
+/*
+ * Peak pyramid for AudioGraph
+ *
+ * A min/max summary of a whole mono signal at several resolutions.  Level 0
+ * holds the minimum and maximum of each block of samples, and each further
+ * level halves the number of entries by merging pairs, down to a single
+ * entry.  Drawing any stretch of the signal at any width then only touches
+ * about one entry per pixel, from the level whose resolution is closest.
+ */
+
+#ifndef __PEAKS_H__
+#define __PEAKS_H__
+
+#include <stdint.h>
+#include <vector>
+
+class PeakPyramid
+{
+public:
+	PeakPyramid(int _block_size);
+	void Append(const float *samples, int count);
+	void AppendBlocks(const float *pairs, int64_t count);
+	void Finish();
+	int BlockSize() const { return block_size; }
+	int Levels() const { return (int)minimums.size(); }
+	int Size(int level) const { return (int)minimums[level].size(); }
+	const float *Minimums(int level) const { return minimums[level].data(); }
+	const float *Maximums(int level) const { return maximums[level].data(); }
+	int LevelForWidth(int width) const;
+private:
+	int block_size;
+	int filled;
+	float block_min, block_max;
+	std::vector<std::vector<float> > minimums;
+	std::vector<std::vector<float> > maximums;
+};
+
+#endif //__PEAKS_H__
@@ -0,0 +1,356 @@
+/*
+ * Audio QC measurements for AudioGraph
+ *
+ * See qc.h.
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "qc.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Gating block lengths, in blocks: 400 ms for integrated loudness, 3 s for the range.
+#define QC_MOMENTARY_BLOCKS 4
+#define QC_SHORT_TERM_BLOCKS 30
+
+
+/*
+ * Design a biquad for the rate, as [b0, b1, b2, a1, a2].  The two stages of
+ * the K-weighting filter are given by BS.1770 at 48 kHz; these are their
+ * analogue prototypes, so any rate gets the same response.
+ */
+static void HighShelf(int sample_rate, double *coefficients)
+{
+	const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / sample_rate);
+	double vh = pow(10.0, gain / 20.0);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	coefficients[0] = (vh + vb * k / q + k * k) / a0;
+	coefficients[1] = 2.0 * (k * k - vh) / a0;
+	coefficients[2] = (vh - vb * k / q + k * k) / a0;
+	coefficients[3] = 2.0 * (k * k - 1.0) / a0;
+	coefficients[4] = (1.0 - k / q + k * k) / a0;
+}
+
+
+static void HighPass(int sample_rate, double *coefficients)
+{
+	const double f0 = 38.13547087602444, q = 0.5003270373238773;
+	double k = tan(M_PI * f0 / sample_rate);
+	double a0 = 1.0 + k / q + k * k;
+	coefficients[0] = 1.0;
+	coefficients[1] = -2.0;
+	coefficients[2] = 1.0;
+	coefficients[3] = 2.0 * (k * k - 1.0) / a0;
+	coefficients[4] = (1.0 - k / q + k * k) / a0;
+}
+
+
+static inline double Biquad(const double *c, double *s, double x)
+{
+	double y = c[0] * x + s[0];
+	s[0] = c[1] * x - c[3] * y + s[1];
+	s[1] = c[2] * x - c[4] * y;
+	return y;
+}
+
+
+static inline double Loudness(double mean_square)
+{
+	return (mean_square > 0.0) ? -0.691 + 10.0 * log10(mean_square) : -HUGE_VAL;
+}
+
+
+/*
+ * QcMeter::QcMeter
+ *
+ * Parameters:
+ *   sample_rate    The rate of the audio.
+ *   _channels      The number of channel planes passed in.
+ *   silence_db     Blocks whose peak stays below this level count as silent.
+ *   _clip_level    Samples at or beyond this magnitude count as clipped: the
+ *                  largest value the source format can hold.
+ */
+QcMeter::QcMeter(int sample_rate, int _channels, double silence_db, float _clip_level) :
+	channels(_channels),
+	block_size((sample_rate / QC_BLOCK_RATE > 0) ? sample_rate / QC_BLOCK_RATE : 1),
+	silence_level((float)pow(10.0, silence_db / 20.0)),
+	clip_level(_clip_level),
+	state(_channels),
+	line(QC_PEAK_TAPS - 1 + block_size)
+{
+	HighShelf(sample_rate, shelf);
+	HighPass(sample_rate, highpass);
+
+	// A Hann windowed sinc cut off at the source Nyquist frequency, split into phases of unit gain.
+	const int taps = QC_PEAK_TAPS * QC_OVERSAMPLING;
+	for (int p = 0; p < QC_OVERSAMPLING; p++)
+	{
+		double sum = 0.0;
+		for (int j = 0; j < QC_PEAK_TAPS; j++)
+		{
+			int k = j * QC_OVERSAMPLING + p;
+			double t = (k - (taps - 1) * 0.5) / QC_OVERSAMPLING;
+			double sinc = (t == 0.0) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+			double window = 0.5 - 0.5 * cos(2.0 * M_PI * (k + 0.5) / taps);
+			phases[p][j] = (float)(sinc * window);
+			sum += phases[p][j];
+		}
+		for (int j = 0; j < QC_PEAK_TAPS; j++)
+			phases[p][j] = (float)(phases[p][j] / sum);
+	}
+
+	for (int channel = 0; channel < channels; channel++)
+	{
+		state[channel].weight = 1.0;
+		if (channels == 6)
+			state[channel].weight = (channel == 3) ? 0.0 : (channel >= 4) ? 1.41 : 1.0;
+		state[channel].sum = 0.0;
+		state[channel].peak = 0.0f;
+	}
+	samples = blocks_seen = silent_blocks = clipped = 0;
+	Restart();
+}
+
+
+/*
+ * QcMeter::Restart
+ *
+ * Forget the filter state, as at the start of the clip, before measuring a
+ * run that does not follow the previous one.  The totals are kept.
+ */
+void QcMeter::Restart()
+{
+	for (int channel = 0; channel < channels; channel++)
+	{
+		Channel& c = state[channel];
+		c.shelf_state[0] = c.shelf_state[1] = 0.0;
+		c.highpass_state[0] = c.highpass_state[1] = 0.0;
+		memset(c.history, 0, sizeof(c.history));
+	}
+}
+
+
+/*
+ * QcMeter::Run
+ *
+ * Pass count samples of each channel plane through the filters, a block at
+ * a time.  When measuring, the K-weighted mean square of each whole block
+ * goes to blocks, and the totals are updated; a block cut short by the end
+ * of the clip only counts towards the totals.
+ */
+void QcMeter::Run(const float *planes, size_t stride, int count, double *blocks, bool measure)
+{
+	const int history = QC_PEAK_TAPS - 1;
+	for (int start = 0; start < count; start += block_size)
+	{
+		const int length = (count - start < block_size) ? count - start : block_size;
+		double block_square = 0.0;
+		float block_peak = 0.0f;
+		for (int channel = 0; channel < channels; channel++)
+		{
+			Channel& c = state[channel];
+			const float *x = &planes[channel * stride + start];
+			float *samples_line = line.data();
+			memcpy(samples_line, c.history, sizeof(c.history));
+			memcpy(samples_line + history, x, length * sizeof(float));
+			memcpy(c.history, samples_line + length, sizeof(c.history));
+			if (!measure)
+			{
+				for (int i = 0; i < length; i++)
+					Biquad(highpass, c.highpass_state, Biquad(shelf, c.shelf_state, x[i]));
+				continue;
+			}
+
+			double square = 0.0, sum = 0.0;
+			float peak = 0.0f;
+			int64_t clips = 0;
+			for (int i = 0; i < length; i++)
+			{
+				double y = Biquad(highpass, c.highpass_state, Biquad(shelf, c.shelf_state, x[i]));
+				square += y * y;
+				sum += x[i];
+				float magnitude = fabsf(x[i]);
+				if (magnitude > peak)
+					peak = magnitude;
+				if (magnitude >= clip_level)
+					clips++;
+			}
+
+			// The oversampled signal, which lags the samples by half the filter length.
+			float true_peak = peak;
+			for (int i = 0; i < length; i++)
+			{
+				const float *taps = &samples_line[i + history];
+				for (int p = 0; p < QC_OVERSAMPLING; p++)
+				{
+					float y = 0.0f;
+					for (int j = 0; j < QC_PEAK_TAPS; j++)
+						y += phases[p][j] * taps[-j];
+					if (fabsf(y) > true_peak)
+						true_peak = fabsf(y);
+				}
+			}
+
+			block_square += c.weight * square / block_size;
+			if (peak > block_peak)
+				block_peak = peak;
+			if (true_peak > c.peak)
+				c.peak = true_peak;
+			c.sum += sum;
+			clipped += clips;
+		}
+		if (!measure)
+			continue;
+		if (length == block_size)
+			blocks[start / block_size] = block_square;
+		samples += length;
+		blocks_seen++;
+		if (block_peak < silence_level)
+			silent_blocks++;
+	}
+}
+
+
+/*
+ * QcMeter::Settle
+ *
+ * Run the filters over the audio just before a run, without measuring it.
+ */
+void QcMeter::Settle(const float *planes, size_t stride, int count)
+{
+	Run(planes, stride, count, NULL, false);
+}
+
+
+/*
+ * QcMeter::Measure
+ *
+ * Measure a run of audio that starts on a block boundary.
+ *
+ * Parameters:
+ *   planes     The channel planes, stride floats apart.
+ *   count      The number of samples; less than a whole number of blocks
+ *              only at the end of the clip.
+ *   blocks     Receives the mean square of each whole block.
+ */
+void QcMeter::Measure(const float *planes, size_t stride, int count, double *blocks)
+{
+	Run(planes, stride, count, blocks, true);
+}
+
+
+/*
+ * QcMeter::Merge
+ *
+ * Add the totals of a meter that measured other runs of the same clip.
+ */
+void QcMeter::Merge(const QcMeter& other)
+{
+	for (int channel = 0; channel < channels; channel++)
+	{
+		state[channel].sum += other.state[channel].sum;
+		if (other.state[channel].peak > state[channel].peak)
+			state[channel].peak = other.state[channel].peak;
+	}
+	samples += other.samples;
+	blocks_seen += other.blocks_seen;
+	silent_blocks += other.silent_blocks;
+	clipped += other.clipped;
+}
+
+
+/*
+ * QcMeter::Summarise
+ *
+ * Gate the blocks of the whole clip and put the totals in a report.
+ * Integrated loudness averages the 400 ms windows that pass the absolute
+ * gate of -70 LUFS and the relative gate 10 LU below their own mean.  The
+ * loudness range is the spread from the 10th to the 95th percentile of the
+ * 3 s windows that pass -70 LUFS and a relative gate 20 LU down.  The
+ * windows step by one block.
+ *
+ * Parameters:
+ *   blocks     The mean squares of the whole blocks of the clip, in order.
+ */
+QcReport QcMeter::Summarise(const double *blocks, int64_t num_blocks) const
+{
+	QcReport report;
+
+	// Window means from a running sum, for both window lengths.
+	std::vector<double> momentary, short_term;
+	double sum = 0.0, long_sum = 0.0;
+	for (int64_t i = 0; i < num_blocks; i++)
+	{
+		sum += blocks[i];
+		long_sum += blocks[i];
+		if (i >= QC_MOMENTARY_BLOCKS)
+			sum -= blocks[i - QC_MOMENTARY_BLOCKS];
+		if (i >= QC_SHORT_TERM_BLOCKS)
+			long_sum -= blocks[i - QC_SHORT_TERM_BLOCKS];
+		if (i >= QC_MOMENTARY_BLOCKS - 1 && Loudness(sum / QC_MOMENTARY_BLOCKS) > -70.0)
+			momentary.push_back(sum / QC_MOMENTARY_BLOCKS);
+		if (i >= QC_SHORT_TERM_BLOCKS - 1 && Loudness(long_sum / QC_SHORT_TERM_BLOCKS) > -70.0)
+			short_term.push_back(long_sum / QC_SHORT_TERM_BLOCKS);
+	}
+
+	report.integrated = -HUGE_VAL;
+	if (!momentary.empty())
+	{
+		double total = 0.0;
+		for (size_t i = 0; i < momentary.size(); i++)
+			total += momentary[i];
+		double gate = Loudness(total / momentary.size()) - 10.0;
+		double gated = 0.0;
+		size_t count = 0;
+		for (size_t i = 0; i < momentary.size(); i++)
+			if (Loudness(momentary[i]) > gate)
+			{
+				gated += momentary[i];
+				count++;
+			}
+		if (count)
+			report.integrated = Loudness(gated / count);
+	}
+
+	report.range = 0.0;
+	if (!short_term.empty())
+	{
+		double total = 0.0;
+		for (size_t i = 0; i < short_term.size(); i++)
+			total += short_term[i];
+		double gate = Loudness(total / short_term.size()) - 20.0;
+		std::vector<double> levels;
+		for (size_t i = 0; i < short_term.size(); i++)
+			if (Loudness(short_term[i]) > gate)
+				levels.push_back(Loudness(short_term[i]));
+		if (levels.size() > 1)
+		{
+			std::sort(levels.begin(), levels.end());
+			size_t low = (size_t)((levels.size() - 1) * 0.10 + 0.5);
+			size_t high = (size_t)((levels.size() - 1) * 0.95 + 0.5);
+			report.range = levels[high] - levels[low];
+		}
+	}
+
+	float peak = 0.0f;
+	report.dc_offset = 0.0;
+	for (int channel = 0; channel < channels; channel++)
+	{
+		if (state[channel].peak > peak)
+			peak = state[channel].peak;
+		double mean = (samples) ? fabs(state[channel].sum / samples) : 0.0;
+		if (mean > report.dc_offset)
+			report.dc_offset = mean;
+	}
+	report.true_peak = (peak > 0.0f) ? 20.0 * log10(peak) : -HUGE_VAL;
+	report.silence = (blocks_seen) ? 100.0 * silent_blocks / blocks_seen : 0.0;
+	report.clipped = clipped;
+	return report;
+}
@@ -0,0 +1,87 @@
+/*
+ * Audio QC measurements for AudioGraph
+ *
+ * The delivery checks of a whole programme: integrated loudness and loudness
+ * range (ITU-R BS.1770-4 and EBU Tech 3342), true peak, DC offset, the share
+ * of silence and the number of clipped samples.  The audio is measured in
+ * 100 ms blocks: a QcMeter turns each block into its K-weighted mean square
+ * and keeps the rest as running totals, and Summarise gates the blocks of
+ * the whole clip at the end.
+ *
+ * The clip can be split into runs of whole blocks measured on different
+ * threads, one meter per thread.  The K-weighting and oversampling filters
+ * only remember a few milliseconds, so settling a meter on the audio just
+ * before its run gives the same blocks as measuring the clip in one go.
+ * The meters are then merged.
+ *
+ * True peak is the largest of the samples and of the signal 4 times
+ * oversampled through a 48 tap polyphase interpolator, as in BS.1770-4
+ * Annex 2.  Channel weights follow BS.1770 for 5.1 in WAV order (L R C LFE
+ * Ls Rs): the LFE is left out and the surrounds weigh 1.41; any other layout
+ * weighs every channel 1.
+ */
+
+#ifndef __QC_H__
+#define __QC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Blocks per second, and the number of taps of each oversampling phase.
+#define QC_BLOCK_RATE 10
+#define QC_PEAK_TAPS 12
+#define QC_OVERSAMPLING 4
+
+/*
+ * The results: loudness in LUFS (minus infinity if nothing passes the
+ * gates), range in LU, true peak in dBTP, DC offset as the largest channel
+ * mean in full scale units, and silence as a percentage of the blocks.
+ */
+struct QcReport
+{
+	double integrated;
+	double range;
+	double true_peak;
+	double dc_offset;
+	double silence;
+	int64_t clipped;
+};
+
+class QcMeter
+{
+public:
+	QcMeter(int sample_rate, int _channels, double silence_db, float _clip_level);
+	int BlockSize() const { return block_size; }
+	void Restart();
+	void Settle(const float *planes, size_t stride, int count);
+	void Measure(const float *planes, size_t stride, int count, double *blocks);
+	void Merge(const QcMeter& other);
+	QcReport Summarise(const double *blocks, int64_t num_blocks) const;
+private:
+	struct Channel
+	{
+		double weight;
+		double shelf_state[2], highpass_state[2];
+		float history[QC_PEAK_TAPS - 1];
+		double sum;
+		float peak;
+	};
+
+	void Run(const float *planes, size_t stride, int count, double *blocks, bool measure);
+
+	int channels;
+	int block_size;
+	float silence_level;
+	float clip_level;
+	double shelf[5], highpass[5];
+	float phases[QC_OVERSAMPLING][QC_PEAK_TAPS];
+	std::vector<Channel> state;
+	std::vector<float> line;
+	int64_t samples;
+	int64_t blocks_seen;
+	int64_t silent_blocks;
+	int64_t clipped;
+};
+
+#endif //__QC_H__
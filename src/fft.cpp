@@ -0,0 +1,98 @@
+/*
+ * FFT helper for AudioGraph
+ *
+ * See fft.h.
+ */
+
+#include <math.h>
+
+#include "fft.h"
+
+
+/*
+ * FFT::FFT
+ *
+ * Parameters:
+ *   _log_size      The log (base 2) of the block size.
+ */
+FFT::FFT(int _log_size) :
+	log_size(_log_size),
+	size(1 << _log_size)
+{
+	const double pi = 3.14159265358979323846;
+	window = new float[size];
+	twiddle_re = new float[size / 2];
+	twiddle_im = new float[size / 2];
+	bit_reverse = new int[size];
+	re = new float[size];
+	im = new float[size];
+
+	for (int i = 0; i < size; i++)
+		window[i] = (float)(0.5 - 0.5 * cos(2.0 * pi * i / size));
+	for (int i = 0; i < size / 2; i++)
+	{
+		twiddle_re[i] = (float)cos(2.0 * pi * i / size);
+		twiddle_im[i] = (float)-sin(2.0 * pi * i / size);
+	}
+	for (int i = 0; i < size; i++)
+	{
+		int reversed = 0;
+		for (int bit = 0; bit < log_size; bit++)
+			if (i & (1 << bit))
+				reversed |= 1 << (log_size - 1 - bit);
+		bit_reverse[i] = reversed;
+	}
+}
+
+
+FFT::~FFT()
+{
+	delete[] window;
+	delete[] twiddle_re;
+	delete[] twiddle_im;
+	delete[] bit_reverse;
+	delete[] re;
+	delete[] im;
+}
+
+
+/*
+ * FFT::Magnitudes
+ *
+ * Window a block of samples and compute the magnitude of each bin.
+ *
+ * Parameters:
+ *   input          Size() samples.
+ *   magnitudes     Receives Bins() magnitudes, DC first.
+ */
+void FFT::Magnitudes(const float *input, float *magnitudes)
+{
+	for (int i = 0; i < size; i++)
+	{
+		re[bit_reverse[i]] = input[i] * window[i];
+		im[i] = 0.0f;
+	}
+
+	for (int half = 1, step = size / 2; half < size; half <<= 1, step >>= 1)
+	{
+		for (int group = 0; group < size; group += half * 2)
+		{
+			for (int k = 0; k < half; k++)
+			{
+				float wr = twiddle_re[k * step];
+				float wi = twiddle_im[k * step];
+				int a = group + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+
+	for (int k = 0; k <= size / 2; k++)
+		magnitudes[k] = sqrtf(re[k] * re[k] + im[k] * im[k]);
+}
@@ -0,0 +1,34 @@
+/*
+ * FFT helper for AudioGraph
+ *
+ * A plain radix-2 FFT of Hann windowed real blocks, returning magnitudes.
+ * The spectral modes only ever need magnitudes of short blocks, so the
+ * tables (window, twiddles, bit reversal) are built once per instance and
+ * every transform is allocation free.
+ */
+
+#ifndef __FFT_H__
+#define __FFT_H__
+
+#include <stdint.h>
+
+class FFT
+{
+public:
+	FFT(int _log_size);
+	~FFT();
+	int Size() const { return size; }
+	int Bins() const { return size / 2 + 1; }
+	void Magnitudes(const float *input, float *magnitudes);
+private:
+	int log_size;
+	int size;
+	float* window;
+	float* twiddle_re;
+	float* twiddle_im;
+	int*   bit_reverse;
+	float* re;
+	float* im;
+};
+
+#endif //__FFT_H__
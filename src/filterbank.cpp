@@ -0,0 +1,141 @@
+/*
+ * Sparse spectral filterbank for AudioGraph
+ *
+ * See filterbank.h.
+ */
+
+#include <emmintrin.h>
+#include <math.h>
+
+#include "filterbank.h"
+
+
+/*
+ * SparseFilterbank::SparseFilterbank
+ *
+ * Build the matrix.  Mel bands are triangles evenly spaced on the mel scale
+ * from 0 Hz to Nyquist.  Constant-Q bands are triangles evenly spaced on a
+ * log frequency scale from 32.7 Hz (C1) to 16 kHz or Nyquist, each spanning
+ * its neighbours' centres, so Q is the same for every band.
+ *
+ * Parameters:
+ *   scale          MEL or CONSTANT_Q.
+ *   _num_bands     The number of bands.
+ *   fft_size       The FFT size; powers have fft_size / 2 + 1 bins.
+ *   sample_rate    The audio sample rate.
+ */
+SparseFilterbank::SparseFilterbank(Scale scale, int _num_bands, int fft_size, int sample_rate) :
+	num_bands(_num_bands)
+{
+	double nyquist = sample_rate * 0.5;
+	double bin_width = (double)sample_rate / fft_size;
+	int max_bin = fft_size / 2;
+
+	if (scale == MEL)
+	{
+		double top = 2595.0 * log10(1.0 + nyquist / 700.0);
+		for (int band = 0; band < num_bands; band++)
+		{
+			double edges[3];
+			for (int e = 0; e < 3; e++)
+				edges[e] = 700.0 * (pow(10.0, top * (band + e) / (num_bands + 1) / 2595.0) - 1.0);
+			AddBand(edges[0], edges[1], edges[2], bin_width, max_bin);
+		}
+	}
+	else
+	{
+		double lowest = 32.703;
+		double highest = (16000.0 < nyquist) ? 16000.0 : nyquist;
+		double ratio = pow(highest / lowest, 1.0 / (num_bands + 1));
+		for (int band = 0; band < num_bands; band++)
+		{
+			double centre = lowest * pow(ratio, band + 1);
+			AddBand(centre / ratio, centre, centre * ratio, bin_width, max_bin);
+		}
+	}
+	row_starts.push_back((int)bins.size());
+}
+
+
+/*
+ * SparseFilterbank::AddBand
+ *
+ * Append the row for one triangular band, normalised so that its weights sum
+ * to 1.  A band narrower than the bin spacing catches no bin centre, so it
+ * interpolates between the two bins around its centre instead.
+ */
+void SparseFilterbank::AddBand(double low, double centre, double high, double bin_width, int max_bin)
+{
+	row_starts.push_back((int)bins.size());
+	centres.push_back(centre);
+	size_t row = bins.size();
+	float total = 0.0f;
+
+	int first = (int)ceil(low / bin_width);
+	int last = (int)floor(high / bin_width);
+	for (int bin = (first < 0) ? 0 : first; bin <= last && bin <= max_bin; bin++)
+	{
+		double frequency = bin * bin_width;
+		double weight = (frequency < centre) ? (frequency - low) / (centre - low) : (high - frequency) / (high - centre);
+		if (weight <= 0.0)
+			continue;
+		bins.push_back(bin);
+		weights.push_back((float)weight);
+		total += (float)weight;
+	}
+
+	if (total <= 0.0f)
+	{
+		double position = centre / bin_width;
+		int bin = (int)position;
+		float fraction = (float)(position - bin);
+		if (bin >= max_bin)
+		{
+			bin = max_bin - 1;
+			fraction = 1.0f;
+		}
+		bins.push_back(bin);
+		weights.push_back(1.0f - fraction);
+		bins.push_back(bin + 1);
+		weights.push_back(fraction);
+		total = 1.0f;
+	}
+
+	for (size_t i = row; i < weights.size(); i++)
+		weights[i] /= total;
+	while ((bins.size() - row) & 3)
+	{
+		bins.push_back(0);
+		weights.push_back(0.0f);
+	}
+}
+
+
+/*
+ * SparseFilterbank::Apply
+ *
+ * Multiply a power spectrum by the matrix.  The 4 bins of each step are
+ * gathered into one register (SSE2 has no gather) and multiplied with 4
+ * weights at once.
+ *
+ * Parameters:
+ *   powers         fft_size / 2 + 1 bin powers.
+ *   band_powers    Receives Bands() band powers.
+ */
+void SparseFilterbank::Apply(const float *powers, float *band_powers) const
+{
+	const int *bin = bins.data();
+	const float *weight = weights.data();
+	for (int band = 0; band < num_bands; band++)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (int i = row_starts[band]; i < row_starts[band + 1]; i += 4)
+		{
+			__m128 p = _mm_set_ps(powers[bin[i + 3]], powers[bin[i + 2]], powers[bin[i + 1]], powers[bin[i]]);
+			sum = _mm_add_ps(sum, _mm_mul_ps(p, _mm_loadu_ps(weight + i)));
+		}
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+		band_powers[band] = _mm_cvtss_f32(sum);
+	}
+}
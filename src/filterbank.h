@@ -0,0 +1,35 @@
+/*
+ * Sparse spectral filterbank for AudioGraph
+ *
+ * Maps FFT bin powers onto mel or constant-Q bands.  Each band only covers a
+ * handful of bins, so the matrix is stored CSR style: row_starts[band] is
+ * the first nonzero of the band, and every nonzero has a bin index and a
+ * weight.  Rows are padded with zero weights to a multiple of 4 nonzeros, so
+ * the dot product for a band runs 4 nonzeros per SSE step with no tail.
+ */
+
+#ifndef __FILTERBANK_H__
+#define __FILTERBANK_H__
+
+#include <vector>
+
+class SparseFilterbank
+{
+public:
+	enum Scale { MEL, CONSTANT_Q };
+
+	SparseFilterbank(Scale scale, int _num_bands, int fft_size, int sample_rate);
+	int Bands() const { return num_bands; }
+	double Centre(int band) const { return centres[band]; }
+	void Apply(const float *powers, float *band_powers) const;
+private:
+	void AddBand(double low, double centre, double high, double bin_width, int max_bin);
+
+	int num_bands;
+	std::vector<int>   row_starts;
+	std::vector<int>   bins;
+	std::vector<float> weights;
+	std::vector<double> centres;
+};
+
+#endif //__FILTERBANK_H__
@@ -0,0 +1,28 @@
+/*
+ * Frame property support for AudioGraph
+ *
+ * Frame properties, and NewVideoFrameP to carry them over, came with
+ * version 8 of the AviSynth+ interface (AviSynth+ 3.6).  AudioGraph and
+ * AudioQC both ask the environment for that interface version, so that
+ * they agree on whether properties can be used.
+ */
+
+#ifndef __FRAMEPROPS_H__
+#define __FRAMEPROPS_H__
+
+#include "avisynth.h"
+
+static inline bool HasFrameProperties(IScriptEnvironment* env)
+{
+	try
+	{
+		env->CheckVersion(8);
+	}
+	catch (const AvisynthError&)
+	{
+		return false;
+	}
+	return true;
+}
+
+#endif //__FRAMEPROPS_H__
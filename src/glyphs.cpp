@@ -0,0 +1,126 @@
+/*
+ * Glyph atlas for AudioGraph
+ *
+ * See glyphs.h.
+ */
+
+#include <string.h>
+
+#include "glyphs.h"
+
+/*
+ * The font: one character and its 7 rows, top first, with the 5 pixels of
+ * each row in bits 4 (left) to 0 (right).
+ */
+static const struct
+{
+	char c;
+	uint8_t rows[7];
+} font[] =
+{
+	{ '0', { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E } },
+	{ '1', { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+	{ '2', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F } },
+	{ '3', { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E } },
+	{ '4', { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 } },
+	{ '5', { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E } },
+	{ '6', { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E } },
+	{ '7', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+	{ '8', { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E } },
+	{ '9', { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C } },
+	{ ':', { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 } },
+	{ '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C } },
+	{ '-', { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 } },
+	{ '+', { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 } },
+	{ 'd', { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F } },
+	{ 'B', { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E } },
+	{ 'H', { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+	{ 'z', { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F } },
+	{ 'k', { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 } },
+};
+
+
+/*
+ * GlyphAtlas::GlyphAtlas
+ *
+ * Rasterise the font.  Each cell is the glyph scaled up, with a one pixel
+ * outline all round.
+ *
+ * Parameters:
+ *   _scale         The size of a font pixel, in picture pixels.
+ */
+GlyphAtlas::GlyphAtlas(int _scale) :
+	width(5 * _scale + 2),
+	height(7 * _scale + 2),
+	advance(6 * _scale)
+{
+	const int num_glyphs = sizeof(font) / sizeof(font[0]);
+	const int cell_size = width * height;
+	cells = new uint8_t[cell_size * num_glyphs]();
+	for (int c = 0; c < 128; c++)
+		lookup[c] = -1;
+
+	for (int glyph = 0; glyph < num_glyphs; glyph++)
+	{
+		uint8_t *cell = &cells[glyph * cell_size];
+		lookup[(int)font[glyph].c] = glyph * cell_size;
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				// Font pixel under this cell pixel, if any.
+				int fy = (y - 1) / _scale, fx = (x - 1) / _scale;
+				if (y >= 1 && x >= 1 && fy < 7 && fx < 5 && (font[glyph].rows[fy] >> (4 - fx)) & 1)
+					cell[y * width + x] = GLYPH_INK;
+			}
+		}
+		for (int y = 0; y < height; y++)
+		{
+			for (int x = 0; x < width; x++)
+			{
+				if (cell[y * width + x])
+					continue;
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						int ny = y + dy, nx = x + dx;
+						if (ny >= 0 && ny < height && nx >= 0 && nx < width && cell[ny * width + nx] == GLYPH_INK)
+							cell[y * width + x] = GLYPH_OUTLINE;
+					}
+			}
+		}
+	}
+}
+
+
+GlyphAtlas::~GlyphAtlas()
+{
+	delete[] cells;
+}
+
+
+/*
+ * GlyphAtlas::TextWidth
+ *
+ * The width of a label in pixels, including its outline.
+ */
+int GlyphAtlas::TextWidth(const char *text) const
+{
+	int length = (int)strlen(text);
+	return (length) ? (length - 1) * advance + width : 0;
+}
+
+
+/*
+ * GlyphAtlas::Glyph
+ *
+ * Returns:
+ *   The Width() x Height() cell of a character, or NULL for a space or a
+ *   character the font does not have.
+ */
+const uint8_t *GlyphAtlas::Glyph(char c) const
+{
+	if (c < 0 || lookup[(int)c] < 0)
+		return NULL;
+	return &cells[lookup[(int)c]];
+}
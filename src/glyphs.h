@@ -0,0 +1,36 @@
+/*
+ * Glyph atlas for AudioGraph
+ *
+ * The labels only need digits and a few symbols, so they come from a built
+ * in 5x7 pixel font rather than the system's text renderer.  The font is
+ * scaled and outlined once, into an atlas of small coverage bitmaps: 0 is
+ * transparent, GLYPH_OUTLINE is the dark outline that keeps the label
+ * readable over any picture, and GLYPH_INK is the label itself.  Drawing a
+ * label is then a straight copy of the atlas cells.
+ */
+
+#ifndef __GLYPHS_H__
+#define __GLYPHS_H__
+
+#include <stdint.h>
+
+#define GLYPH_OUTLINE 1
+#define GLYPH_INK 2
+
+class GlyphAtlas
+{
+public:
+	GlyphAtlas(int _scale);
+	~GlyphAtlas();
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int Advance() const { return advance; }
+	int TextWidth(const char *text) const;
+	const uint8_t *Glyph(char c) const;
+private:
+	int width, height, advance;
+	uint8_t* cells;
+	int lookup[128];
+};
+
+#endif //__GLYPHS_H__
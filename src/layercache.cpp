@@ -0,0 +1,143 @@
+/*
+ * Composed layer cache for AudioGraph
+ *
+ * See layercache.h.
+ */
+
+#include <emmintrin.h>
+#include <string.h>
+#include <utility>
+
+#include "layercache.h"
+
+
+/*
+ * LayerCache::LayerCache
+ *
+ * Parameters:
+ *   _budget        The most bytes of layers to keep.
+ */
+LayerCache::LayerCache(size_t _budget) :
+	budget(_budget),
+	size(0),
+	clock(0)
+{
+}
+
+
+/*
+ * LayerCache::Draw
+ *
+ * Draw the cached layer of a frame over the bare picture.
+ *
+ * Returns:
+ *   false if the frame's layer is not cached; target is left as it was.
+ */
+bool LayerCache::Draw(int frame, const LayerPlanes& target)
+{
+	std::map<int, Layer>::iterator found = layers.find(frame);
+	if (found == layers.end())
+		return false;
+	Layer& layer = found->second;
+	layer.last_use = ++clock;
+	const uint8_t *bytes = layer.bytes.data();
+	for (size_t i = 0; i < layer.spans.size(); i++)
+	{
+		const Span& span = layer.spans[i];
+		int plane = span.row / target.height;
+		int y = span.row % target.height;
+		memcpy(target.planes[plane] + (size_t)y * target.pitches[plane] + span.x, bytes, span.count);
+		bytes += span.count;
+	}
+	return true;
+}
+
+
+/*
+ * The first byte at or after x where two rows differ, or count if none.
+ */
+static int NextDifference(const uint8_t *a, const uint8_t *b, int x, int count)
+{
+	for (; x + 16 <= count; x += 16)
+	{
+		int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + x)), _mm_loadu_si128((const __m128i*)(b + x))));
+		if (equal != 0xFFFF)
+		{
+			while (a[x] == b[x])
+				x++;
+			return x;
+		}
+	}
+	while (x < count && a[x] == b[x])
+		x++;
+	return x;
+}
+
+
+/*
+ * LayerCache::Store
+ *
+ * Keep the layer of a frame: the bytes of drawn that differ from bare.  The
+ * least recently drawn layers are dropped to make room; a layer bigger than
+ * the whole budget is not kept.
+ *
+ * Parameters:
+ *   bare           The picture before the layer was drawn.
+ *   drawn          The same picture after.
+ */
+void LayerCache::Store(int frame, const LayerPlanes& bare, const LayerPlanes& drawn)
+{
+	std::map<int, Layer>::iterator found = layers.find(frame);
+	if (found != layers.end())
+	{
+		size -= found->second.Size();
+		layers.erase(found);
+	}
+
+	Layer layer;
+	for (int plane = 0; plane < drawn.num_planes; plane++)
+	{
+		for (int y = 0; y < drawn.height; y++)
+		{
+			const uint8_t *a = bare.planes[plane] + (size_t)y * bare.pitches[plane];
+			const uint8_t *b = drawn.planes[plane] + (size_t)y * drawn.pitches[plane];
+			int x = NextDifference(a, b, 0, drawn.row_size);
+			while (x < drawn.row_size)
+			{
+				// Extend the span over any gap shorter than LAYER_SPAN_GAP.
+				int end = x + 1;
+				for (;;)
+				{
+					while (end < drawn.row_size && a[end] != b[end])
+						end++;
+					int next = NextDifference(a, b, end, drawn.row_size);
+					if (next >= drawn.row_size || next - end >= LAYER_SPAN_GAP)
+					{
+						Span span = { (uint32_t)(plane * drawn.height + y), (uint32_t)x, (uint32_t)(end - x) };
+						layer.spans.push_back(span);
+						layer.bytes.insert(layer.bytes.end(), b + x, b + end);
+						x = next;
+						break;
+					}
+					end = next;
+				}
+			}
+		}
+	}
+
+	const size_t needed = layer.Size();
+	if (needed > budget)
+		return;
+	while (size + needed > budget)
+	{
+		std::map<int, Layer>::iterator oldest = layers.begin();
+		for (std::map<int, Layer>::iterator i = layers.begin(); i != layers.end(); ++i)
+			if (i->second.last_use < oldest->second.last_use)
+				oldest = i;
+		size -= oldest->second.Size();
+		layers.erase(oldest);
+	}
+	layer.last_use = ++clock;
+	size += needed;
+	layers[frame] = std::move(layer);
+}
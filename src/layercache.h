@@ -0,0 +1,73 @@
+/*
+ * Composed layer cache for AudioGraph
+ *
+ * Everything AudioGraph draws over the video (graph, markers, grid, lanes,
+ * labels, minimap) is a pure function of the output frame number, so when
+ * an editor loops over the same few seconds it is drawn again and again for
+ * nothing.  The layer cache keeps what was drawn for recently shown frames,
+ * as the bytes that differ from the bare picture, so that showing one again
+ * is a copy of the video and a memcpy per span, with no audio work.
+ *
+ * A layer is stored as spans of changed bytes, each within one row of one
+ * plane.  Changed bytes less than LAYER_SPAN_GAP apart go in the same span,
+ * so a span header always saves more than it costs and a layer is never much
+ * bigger than the picture.  Spans are found by comparing the drawn picture
+ * with a copy of it taken before drawing, so every layout and every drawing
+ * routine is covered without them knowing about the cache.
+ *
+ * The cache is bounded in bytes and drops the least recently shown layer
+ * first.
+ */
+
+#ifndef __LAYERCACHE_H__
+#define __LAYERCACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#define LAYER_SPAN_GAP 32
+
+/*
+ * The planes of a picture, rows in memory order.  All planes have the same
+ * row size (in bytes) and number of rows.
+ */
+struct LayerPlanes
+{
+	int num_planes;
+	uint8_t* planes[4];
+	int pitches[4];
+	int row_size;
+	int height;
+};
+
+class LayerCache
+{
+public:
+	LayerCache(size_t _budget);
+	bool Draw(int frame, const LayerPlanes& target);
+	void Store(int frame, const LayerPlanes& bare, const LayerPlanes& drawn);
+	size_t Size() const { return size; }
+private:
+	struct Span
+	{
+		uint32_t row;        // plane * height + y
+		uint32_t x;
+		uint32_t count;
+	};
+	struct Layer
+	{
+		std::vector<Span> spans;
+		std::vector<uint8_t> bytes;
+		uint64_t last_use;
+		size_t Size() const { return spans.size() * sizeof(Span) + bytes.size(); }
+	};
+
+	size_t budget;
+	size_t size;
+	uint64_t clock;
+	std::map<int, Layer> layers;
+};
+
+#endif //__LAYERCACHE_H__
@@ -0,0 +1,164 @@
+/*
+ * Overlay masks for AudioGraph
+ *
+ * See overlay.h.
+ */
+
+#include <emmintrin.h>
+#include <string.h>
+
+#include "overlay.h"
+
+
+/*
+ * OverlayMasks::OverlayMasks
+ *
+ * Parameters:
+ *   _layers        The number of layers, at most 255.
+ *   arena          Where the masks are carved from.
+ */
+OverlayMasks::OverlayMasks(int _width, int _height, int _layers, Arena& arena) :
+	width(_width),
+	height(_height),
+	layers(_layers)
+{
+	// Whole blocks of 16 pixels, so that Resolve never needs a scalar tail.
+	row_bytes = ((size_t)(width + 15) / 16) * 2;
+	masks = arena.Allocate<uint8_t>(row_bytes * layers * height);
+	dirty = arena.Allocate<uint8_t>(height);
+}
+
+
+/*
+ * OverlayMasks::Clear
+ *
+ * Empty every layer, touching only the rows that were drawn on.
+ */
+void OverlayMasks::Clear()
+{
+	for (int y = 0; y < height; y++)
+	{
+		if (!dirty[y])
+			continue;
+		memset(masks + (size_t)y * layers * row_bytes, 0, layers * row_bytes);
+		dirty[y] = 0;
+	}
+}
+
+
+/*
+ * OverlayMasks::SetColumn
+ *
+ * Put the pixels of column x from row y0 to row y1 (inclusive) in a layer.
+ */
+void OverlayMasks::SetColumn(int layer, int x, int y0, int y1)
+{
+	if ((unsigned)x >= (unsigned)width)
+		return;
+	if (y0 < 0)
+		y0 = 0;
+	if (y1 >= height)
+		y1 = height - 1;
+	uint8_t *byte = masks + ((size_t)y0 * layers + layer) * row_bytes + (x >> 3);
+	const uint8_t bit = (uint8_t)(1 << (x & 7));
+	const size_t step = layers * row_bytes;
+	for (int y = y0; y <= y1; y++, byte += step)
+	{
+		*byte |= bit;
+		dirty[y] = 1;
+	}
+}
+
+
+/*
+ * OverlayMasks::UnsetColumn
+ *
+ * Take the pixels of column x from row y0 to row y1 (inclusive) out of a
+ * layer.
+ */
+void OverlayMasks::UnsetColumn(int layer, int x, int y0, int y1)
+{
+	if ((unsigned)x >= (unsigned)width)
+		return;
+	if (y0 < 0)
+		y0 = 0;
+	if (y1 >= height)
+		y1 = height - 1;
+	uint8_t *byte = masks + ((size_t)y0 * layers + layer) * row_bytes + (x >> 3);
+	const uint8_t bit = (uint8_t)~(1 << (x & 7));
+	const size_t step = layers * row_bytes;
+	for (int y = y0; y <= y1; y++, byte += step)
+		*byte &= bit;
+}
+
+
+/*
+ * OverlayMasks::SetRow
+ *
+ * Put the pixels of row y from column x0 up to (not including) x1 in a
+ * layer.
+ */
+void OverlayMasks::SetRow(int layer, int y, int x0, int x1)
+{
+	if ((unsigned)y >= (unsigned)height)
+		return;
+	if (x0 < 0)
+		x0 = 0;
+	if (x1 > width)
+		x1 = width;
+	if (x0 >= x1)
+		return;
+	uint8_t *row = masks + ((size_t)y * layers + layer) * row_bytes;
+	for (; x0 < x1 && (x0 & 7); x0++)
+		row[x0 >> 3] |= (uint8_t)(1 << (x0 & 7));
+	if (x1 - x0 >= 8)
+	{
+		memset(row + (x0 >> 3), 0xFF, (x1 - x0) >> 3);
+		x0 += (x1 - x0) & ~7;
+	}
+	for (; x0 < x1; x0++)
+		row[x0 >> 3] |= (uint8_t)(1 << (x0 & 7));
+	dirty[y] = 1;
+}
+
+
+/*
+ * OverlayMasks::Resolve
+ *
+ * Find the topmost layer of each pixel of a row, 16 pixels at a time: the
+ * two mask bytes of each layer are spread over 16 byte lanes, tested against
+ * each lane's bit, and the layer number is selected into the lanes that are
+ * set, bottom layer first.
+ *
+ * Parameters:
+ *   lowest         Layers below this one are left out.
+ *   ids            Receives ResolvedWidth() bytes: 0 for a pixel that no
+ *                  layer covers, otherwise its topmost layer plus 1.
+ *
+ * Returns:
+ *   false if nothing was drawn on the row; ids is then left as it was.
+ */
+bool OverlayMasks::Resolve(int y, int lowest, uint8_t *ids) const
+{
+	if (!dirty[y])
+		return false;
+	const uint8_t *row = masks + (size_t)y * layers * row_bytes;
+	const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+	bool any = false;
+	for (size_t block = 0; block < row_bytes; block += 2)
+	{
+		__m128i result = _mm_setzero_si128();
+		for (int layer = lowest; layer < layers; layer++)
+		{
+			const uint8_t *pair = row + layer * row_bytes + block;
+			if (!(pair[0] | pair[1]))
+				continue;
+			__m128i spread = _mm_unpacklo_epi64(_mm_set1_epi8((char)pair[0]), _mm_set1_epi8((char)pair[1]));
+			__m128i covered = _mm_cmpeq_epi8(_mm_and_si128(spread, bits), bits);
+			result = _mm_or_si128(_mm_and_si128(covered, _mm_set1_epi8((char)(layer + 1))), _mm_andnot_si128(covered, result));
+			any = true;
+		}
+		_mm_storeu_si128((__m128i*)(ids + block * 8), result);
+	}
+	return any;
+}
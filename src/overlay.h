@@ -0,0 +1,69 @@
+/*
+ * Overlay masks for AudioGraph
+ *
+ * The grid, markers, waveform, lanes, playhead and labels used to be drawn
+ * straight into the frame one after the other, so every new element added
+ * another pass of scattered writes over the whole picture.  They are now
+ * rasterised into one bit per pixel per layer instead, where a scattered
+ * write is a bit set in a buffer small enough to stay in cache, and merged
+ * into the frame in one pass per row: the masks of a row are resolved with
+ * SSE2 into the topmost layer of each pixel, blocks of 16 pixels that no
+ * layer covers are skipped, and every covered pixel is written once, however
+ * many layers cover it.
+ *
+ * Layers are numbered bottom to top.  A pixel can be taken out of a layer
+ * again, so two layers can act as one 2-bit layer where the last write wins
+ * (label ink over outline).
+ */
+
+#ifndef __OVERLAY_H__
+#define __OVERLAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+class OverlayMasks
+{
+public:
+	OverlayMasks(int _width, int _height, int _layers, Arena& arena);
+	void Clear();
+	inline void Set(int layer, int x, int y);
+	inline void Unset(int layer, int x, int y);
+	void SetColumn(int layer, int x, int y0, int y1);
+	void UnsetColumn(int layer, int x, int y0, int y1);
+	void SetRow(int layer, int y, int x0, int x1);
+	bool Resolve(int y, int lowest, uint8_t *ids) const;
+	int ResolvedWidth() const { return (int)row_bytes * 8; }
+private:
+	int width, height, layers;
+	size_t row_bytes;
+	uint8_t* masks;
+	uint8_t* dirty;
+};
+
+
+/*
+ * Put pixel (x, y) in a layer.  Pixels outside the picture are ignored.
+ */
+inline void OverlayMasks::Set(int layer, int x, int y)
+{
+	if ((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height)
+		return;
+	masks[((size_t)y * layers + layer) * row_bytes + (x >> 3)] |= (uint8_t)(1 << (x & 7));
+	dirty[y] = 1;
+}
+
+
+/*
+ * Take pixel (x, y) out of a layer.
+ */
+inline void OverlayMasks::Unset(int layer, int x, int y)
+{
+	if ((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height)
+		return;
+	masks[((size_t)y * layers + layer) * row_bytes + (x >> 3)] &= (uint8_t)~(1 << (x & 7));
+}
+
+#endif //__OVERLAY_H__
@@ -0,0 +1,165 @@
+/*
+ * Shared prefix sum cache for AudioGraph
+ *
+ * See sumcache.h.
+ */
+
+#include <map>
+#include <mutex>
+
+#include "engine/channels.h"
+#include "sumcache.h"
+
+/*
+ * The chunks of one source clip, with the last use of each so that the
+ * least recently used chunk can be dropped.  Each source has its own mutex,
+ * held only to look up or insert chunks, never while reading audio.  A
+ * source stays registered for as long as some SumCache uses it, so a clip
+ * allocated later at the same address never sees its chunks.
+ */
+struct SharedSums
+{
+	struct Entry
+	{
+		std::shared_ptr<const std::vector<int64_t> > sums;
+		uint64_t last_use;
+	};
+
+	std::mutex mutex;
+	uint64_t clock;
+	std::map<int64_t, Entry> chunks;
+};
+
+static std::mutex registry_mutex;
+static std::map<const IClip*, std::weak_ptr<SharedSums> > registry;
+
+
+/*
+ * SumCache::SumCache
+ *
+ * Parameters:
+ *   _child         The clip to read 16-bit or 8-bit audio from.
+ *   _source        The clip the audio originally comes from, which
+ *                  identifies the shared chunks.
+ */
+SumCache::SumCache(PClip _child, const IClip* _source) :
+	child(_child),
+	source(_source),
+	last_chunk(0),
+	raw((size_t)SUM_CHUNK_SIZE * _child->GetVideoInfo().BytesPerAudioSample()),
+	mono(SUM_CHUNK_SIZE)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	std::weak_ptr<SharedSums>& registered = registry[source];
+	shared = registered.lock();
+	if (!shared)
+	{
+		shared = std::make_shared<SharedSums>();
+		shared->clock = 0;
+		registered = shared;
+	}
+}
+
+
+SumCache::~SumCache()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	shared.reset();
+	std::map<const IClip*, std::weak_ptr<SharedSums> >::iterator registered = registry.find(source);
+	if (registered != registry.end() && registered->second.expired())
+		registry.erase(registered);
+}
+
+
+/*
+ * SumCache::Chunk
+ *
+ * Get the prefix sums of a chunk, reading its audio if no instance has
+ * cached it yet.  Entry i is the sum of the chunk's first i samples, over
+ * all channels.  The audio is read and summed without the source's mutex
+ * held, so two instances may both compute a missing chunk; the first one
+ * inserted is kept.
+ */
+std::shared_ptr<const std::vector<int64_t> > SumCache::Chunk(int64_t chunk, IScriptEnvironment* env)
+{
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		shared->clock++;
+		std::map<int64_t, SharedSums::Entry>::iterator found = shared->chunks.find(chunk);
+		if (found != shared->chunks.end())
+		{
+			found->second.last_use = shared->clock;
+			return found->second.sums;
+		}
+	}
+
+	const VideoInfo& vi = child->GetVideoInfo();
+	int channels = vi.AudioChannels();
+	child->GetAudio(raw.data(), chunk * SUM_CHUNK_SIZE, SUM_CHUNK_SIZE, env);
+	std::shared_ptr<std::vector<int64_t> > sums(new std::vector<int64_t>(SUM_CHUNK_SIZE + 1));
+	/*
+	 * The per-sample channel sums come back as floats, but unscaled they are
+	 * whole numbers well inside float precision (up to 512 channels).
+	 */
+	if (vi.SampleType() == SAMPLE_INT16)
+		Downmix16((const int16_t*)raw.data(), channels, SUM_CHUNK_SIZE, 1.0f, mono.data());
+	else
+		Downmix8(raw.data(), channels, SUM_CHUNK_SIZE, 1.0f, mono.data());
+	int64_t total = 0;
+	(*sums)[0] = 0;
+	for (int i = 0; i < SUM_CHUNK_SIZE; i++)
+	{
+		total += (int64_t)mono[i];
+		(*sums)[i + 1] = total;
+	}
+
+	std::lock_guard<std::mutex> lock(shared->mutex);
+	shared->clock++;
+	std::map<int64_t, SharedSums::Entry>::iterator found = shared->chunks.find(chunk);
+	if (found != shared->chunks.end())
+	{
+		found->second.last_use = shared->clock;
+		return found->second.sums;
+	}
+	if (shared->chunks.size() >= SUM_CHUNKS_PER_SOURCE)
+	{
+		std::map<int64_t, SharedSums::Entry>::iterator oldest = shared->chunks.begin();
+		for (std::map<int64_t, SharedSums::Entry>::iterator i = shared->chunks.begin(); i != shared->chunks.end(); ++i)
+			if (i->second.last_use < oldest->second.last_use)
+				oldest = i;
+		shared->chunks.erase(oldest);
+	}
+	SharedSums::Entry& entry = shared->chunks[chunk];
+	entry.sums = sums;
+	entry.last_use = shared->clock;
+	return sums;
+}
+
+
+/*
+ * SumCache::Sum
+ *
+ * The sum of all channels over count samples from start, which may be
+ * negative or past the end of the clip (the audio there is silence).
+ * Consecutive pixels mostly fall in the same chunk, so the last chunk used
+ * is kept and the shared cache is only consulted when the chunk changes.
+ */
+int64_t SumCache::Sum(int64_t start, int count, IScriptEnvironment* env)
+{
+	int64_t result = 0;
+	while (count > 0)
+	{
+		int64_t chunk = (start >= 0) ? start / SUM_CHUNK_SIZE : -((-start + SUM_CHUNK_SIZE - 1) / SUM_CHUNK_SIZE);
+		int first = (int)(start - chunk * SUM_CHUNK_SIZE);
+		int last = (first + count < SUM_CHUNK_SIZE) ? first + count : SUM_CHUNK_SIZE;
+		if (!last_sums || chunk != last_chunk)
+		{
+			last_sums = Chunk(chunk, env);
+			last_chunk = chunk;
+		}
+		result += (*last_sums)[last] - (*last_sums)[first];
+		count -= last - first;
+		start += last - first;
+	}
+	return result;
+}
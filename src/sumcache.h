@@ -0,0 +1,52 @@
+/*
+ * Shared prefix sum cache for AudioGraph
+ *
+ * The waveform only needs the sum of all channels over each pixel's sample
+ * range, and any such sum is the difference of two prefix sums.  The prefix
+ * sums are cached in chunks of SUM_CHUNK_SIZE samples, shared by every
+ * AudioGraph instance on the same source clip.  So graphing the same audio
+ * at another offset_samples, or at any other alignment, reuses the cached
+ * chunks instead of reading the audio again.
+ *
+ * The chunks are found through a registry keyed on the source IClip, and
+ * live only as long as some SumCache on that clip.  So they are shared
+ * within one script, but a reloaded script builds new clips and starts
+ * again.  Only the plain waveform (wave mode without the goniometer) is
+ * drawn from the sums.
+ *
+ * Sums are exact integers in the units of the (16-bit or recentred 8-bit)
+ * samples.
+ */
+
+#ifndef __SUMCACHE_H__
+#define __SUMCACHE_H__
+
+#include <memory>
+#include <vector>
+
+#include "avisynth.h"
+
+#define SUM_CHUNK_SIZE 16384
+#define SUM_CHUNKS_PER_SOURCE 256
+
+struct SharedSums;
+
+class SumCache
+{
+public:
+	SumCache(PClip _child, const IClip* _source);
+	~SumCache();
+	int64_t Sum(int64_t start, int count, IScriptEnvironment* env);
+private:
+	std::shared_ptr<const std::vector<int64_t> > Chunk(int64_t chunk, IScriptEnvironment* env);
+
+	PClip child;
+	const IClip* source;
+	std::shared_ptr<SharedSums> shared;
+	int64_t last_chunk;
+	std::shared_ptr<const std::vector<int64_t> > last_sums;
+	std::vector<uint8_t> raw;
+	std::vector<float> mono;
+};
+
+#endif //__SUMCACHE_H__
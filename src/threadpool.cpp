@@ -0,0 +1,218 @@
+/*
+ * Shared thread pool for AudioGraph
+ *
+ * See threadpool.h.
+ */
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "threadpool.h"
+
+static std::mutex pool_mutex;
+static ThreadPool* shared_pool = NULL;
+static int pool_users = 0;
+
+// The index of the worker running on this thread, or -1 outside the pool.
+static thread_local int current_worker = -1;
+
+
+/*
+ * ThreadPool::Acquire
+ *
+ * Get the shared pool, creating it if no instance holds it yet.  Every
+ * Acquire must be matched by a Release.
+ *
+ * Parameters:
+ *   threads        The number of workers if the pool is created here, or 0
+ *                  for DefaultThreads().
+ */
+ThreadPool* ThreadPool::Acquire(int threads)
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	if (!shared_pool)
+		shared_pool = new ThreadPool((threads > 0) ? threads : DefaultThreads());
+	pool_users++;
+	return shared_pool;
+}
+
+
+void ThreadPool::Release()
+{
+	std::lock_guard<std::mutex> lock(pool_mutex);
+	if (--pool_users == 0)
+	{
+		delete shared_pool;
+		shared_pool = NULL;
+	}
+}
+
+
+/*
+ * ThreadPool::DefaultThreads
+ *
+ * AUDIOGRAPH_THREADS if it is set to a positive number, otherwise the number
+ * of cores.
+ */
+int ThreadPool::DefaultThreads()
+{
+	const char* variable = getenv("AUDIOGRAPH_THREADS");
+	int threads = (variable) ? atoi(variable) : 0;
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	return (threads > 0) ? threads : 1;
+}
+
+
+ThreadPool::ThreadPool(int threads) :
+	pending(0),
+	next_queue(0),
+	stop(false)
+{
+	for (int i = 0; i < threads; i++)
+		queues.push_back(new Queue);
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&ThreadPool::Run, this, i));
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stop = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	for (size_t i = 0; i < queues.size(); i++)
+		delete queues[i];
+}
+
+
+/*
+ * ThreadPool::Submit
+ *
+ * Queue a task to run on some worker.
+ */
+void ThreadPool::Submit(const Task& task)
+{
+	unsigned index;
+	if (current_worker >= 0)
+		index = current_worker;
+	else
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		index = next_queue++ % queues.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[index]->mutex);
+		queues[index]->tasks.push_back(task);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		pending++;
+	}
+	wake.notify_one();
+}
+
+
+/*
+ * ThreadPool::Take
+ *
+ * Take the newest task of the worker's own deque, or else steal the oldest
+ * task of another one.
+ */
+bool ThreadPool::Take(int worker, Task& task)
+{
+	const int count = (int)queues.size();
+	for (int i = 0; i < count; i++)
+	{
+		Queue* queue = queues[(worker + i) % count];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->tasks.empty())
+			continue;
+		if (i == 0)
+		{
+			task = queue->tasks.back();
+			queue->tasks.pop_back();
+		}
+		else
+		{
+			task = queue->tasks.front();
+			queue->tasks.pop_front();
+		}
+		std::lock_guard<std::mutex> sleep_lock(sleep_mutex);
+		pending--;
+		return true;
+	}
+	return false;
+}
+
+
+void ThreadPool::Run(int worker)
+{
+	current_worker = worker;
+	for (;;)
+	{
+		Task task;
+		if (Take(worker, task))
+		{
+			task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		wake.wait(lock, [this] { return stop || pending > 0; });
+		if (stop)
+			return;
+	}
+}
+
+
+/*
+ * ThreadPool::ParallelFor
+ *
+ * Call body(begin, end, slot) over ranges covering [0, count), on the
+ * calling thread and up to (tasks - 1) workers, and return when all have
+ * finished.  slot is below tasks, and no two calls running at the same time
+ * get the same slot, so it can pick per-thread scratch buffers.  The body
+ * must not throw.
+ */
+void ThreadPool::ParallelFor(int count, int tasks, const std::function<void(int, int, int)>& body)
+{
+	if (tasks > count)
+		tasks = count;
+	if (tasks <= 1)
+	{
+		if (count > 0)
+			body(0, count, 0);
+		return;
+	}
+
+	// Two chunks per task, so that a slow chunk is not left to the end.
+	struct Loop
+	{
+		const std::function<void(int, int, int)>* body;
+		int count, chunks;
+		std::atomic<int> next, done;
+	};
+	std::shared_ptr<Loop> loop(new Loop);
+	loop->body = &body;
+	loop->count = count;
+	loop->chunks = (tasks * 2 < count) ? tasks * 2 : count;
+	loop->next = 0;
+	loop->done = 0;
+
+	auto claim = [loop](int slot)
+	{
+		for (int chunk; (chunk = loop->next++) < loop->chunks; loop->done++)
+			(*loop->body)((int)((int64_t)loop->count * chunk / loop->chunks), (int)((int64_t)loop->count * (chunk + 1) / loop->chunks), slot);
+	};
+	for (int slot = 1; slot < tasks; slot++)
+		Submit([claim, slot] { claim(slot); });
+	claim(0);
+	while (loop->done < loop->chunks)
+		std::this_thread::yield();
+}
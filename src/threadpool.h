@@ -0,0 +1,65 @@
+/*
+ * Shared thread pool for AudioGraph
+ *
+ * One pool of worker threads serves every AudioGraph instance in the
+ * process: the first instance to need it creates it and the last one to let
+ * go of it joins its threads, so a script with dozens of instances still
+ * only has one set of workers.  The number of workers is fixed when the pool
+ * is created, by the threads parameter of that instance or else by the
+ * AUDIOGRAPH_THREADS environment variable, and defaults to one per core.
+ *
+ * Each worker has its own deque of tasks.  Tasks submitted by a worker go on
+ * its own deque and are taken back newest first; tasks submitted from
+ * outside are dealt out round robin.  A worker whose deque is empty steals
+ * the oldest task of another one before going to sleep.
+ *
+ * ParallelFor splits a loop into chunks that the calling thread and up to
+ * (tasks - 1) workers claim one at a time.  The caller claims chunks too, so
+ * the loop always finishes even if no worker is free (or the caller is a
+ * worker itself), and only ever waits for chunks that are already running.
+ */
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	static ThreadPool* Acquire(int threads);
+	static void Release();
+	static int DefaultThreads();
+
+	int Workers() const { return (int)workers.size(); }
+	void Submit(const Task& task);
+	void ParallelFor(int count, int tasks, const std::function<void(int, int, int)>& body);
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	ThreadPool(int threads);
+	~ThreadPool();
+	bool Take(int worker, Task& task);
+	void Run(int worker);
+
+	std::vector<std::thread> workers;
+	std::vector<Queue*> queues;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	unsigned pending;
+	unsigned next_queue;
+	bool stop;
+};
+
+#endif //__THREADPOOL_H__
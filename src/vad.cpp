@@ -0,0 +1,134 @@
+/*
+ * Voice activity detector for AudioGraph
+ *
+ * See vad.h.
+ */
+
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+#include "vad.h"
+
+/*
+ * Thresholds: speech band energy in dB relative to a full scale sine, the
+ * highest spectral flatness (white noise is about 0.56) and the highest
+ * fraction of zero crossings per sample.
+ */
+#define VAD_ENERGY_DB -50.0f
+#define VAD_FLATNESS 0.4f
+#define VAD_ZERO_CROSSINGS 0.3f
+
+
+/*
+ * VoiceDetector::VoiceDetector
+ *
+ * Parameters:
+ *   _sample_rate   The audio sample rate.  A hop is 10 ms of audio, zero
+ *                  padded to the next power of 2 for the FFT.
+ */
+VoiceDetector::VoiceDetector(int _sample_rate) :
+	hop(_sample_rate / 100),
+	hangover(0)
+{
+	if (hop < 16)
+		hop = 16;
+	int log_fft_size = 4;
+	while ((1 << log_fft_size) < hop)
+		log_fft_size++;
+	fft = new FFT(log_fft_size);
+	block = new float[fft->Size()]();
+	magnitudes = new float[fft->Bins()];
+
+	double bin_width = (double)_sample_rate / fft->Size();
+	first_bin = (int)(300.0 / bin_width + 0.5);
+	last_bin = (int)(3400.0 / bin_width + 0.5);
+	if (first_bin < 1)
+		first_bin = 1;
+	if (last_bin > fft->Bins() - 1)
+		last_bin = fft->Bins() - 1;
+	if (last_bin < first_bin)
+		last_bin = first_bin;
+}
+
+
+VoiceDetector::~VoiceDetector()
+{
+	delete fft;
+	delete[] block;
+	delete[] magnitudes;
+}
+
+
+/*
+ * VoiceDetector::Reset
+ *
+ * Forget the hangover, before processing audio that does not follow on from
+ * the last hop processed.
+ */
+void VoiceDetector::Reset()
+{
+	hangover = 0;
+}
+
+
+/*
+ * VoiceDetector::Process
+ *
+ * Classify one hop.
+ *
+ * Parameters:
+ *   samples        Hop() mono samples, scaled to [-1, 1).
+ *
+ * Returns:
+ *   true if the hop is speech, after hangover smoothing.
+ */
+bool VoiceDetector::Process(const float *samples)
+{
+	/*
+	 * Zero crossings, four sample pairs at a time: a pair crosses zero when
+	 * the sign bits of its two samples differ.
+	 */
+	int crossings = 0;
+	int i = 0;
+	for (; i + 5 <= hop; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(samples + i);
+		__m128 b = _mm_loadu_ps(samples + i + 1);
+		int signs = _mm_movemask_ps(_mm_xor_ps(a, b));
+		crossings += (signs & 1) + ((signs >> 1) & 1) + ((signs >> 2) & 1) + ((signs >> 3) & 1);
+	}
+	for (; i + 1 < hop; i++)
+		crossings += ((samples[i] < 0.0f) != (samples[i + 1] < 0.0f));
+
+	memcpy(block, samples, hop * sizeof(float));
+	fft->Magnitudes(block, magnitudes);
+
+	/*
+	 * Energy and flatness of the speech band.  Flatness is the ratio of the
+	 * geometric to the arithmetic mean of the bin powers.
+	 */
+	double power = 0.0, log_power = 0.0;
+	for (int bin = first_bin; bin <= last_bin; bin++)
+	{
+		double p = (double)magnitudes[bin] * magnitudes[bin] + 1e-12;
+		power += p;
+		log_power += log(p);
+	}
+	int bins = last_bin - first_bin + 1;
+	double mean_power = power / bins;
+	float flatness = (float)(exp(log_power / bins) / mean_power);
+	// A full scale sine in one bin of a Hann window has magnitude hop / 4.
+	float reference = hop * 0.25f;
+	float energy_db = (float)(10.0 * log10(power / ((double)reference * reference) + 1e-12));
+
+	bool speech = energy_db > VAD_ENERGY_DB && flatness < VAD_FLATNESS && crossings < VAD_ZERO_CROSSINGS * hop;
+	if (speech)
+		hangover = VAD_HANGOVER_HOPS;
+	else if (hangover > 0)
+	{
+		hangover--;
+		speech = true;
+	}
+	return speech;
+}
@@ -0,0 +1,36 @@
+/*
+ * Voice activity detector for AudioGraph
+ *
+ * Classifies 10 ms hops of mono audio as speech or not, from three cheap
+ * features: the energy in the 300 - 3400 Hz speech band, the zero-crossing
+ * rate, and the spectral flatness of the speech band.  A hop is speech when
+ * it is loud enough in the speech band, tonal rather than noise-like, and
+ * not dominated by very high frequencies.  Decisions are held for a short
+ * hangover, so that the gaps between syllables and words are not split off.
+ */
+
+#ifndef __VAD_H__
+#define __VAD_H__
+
+#include "fft.h"
+
+#define VAD_HANGOVER_HOPS 20
+
+class VoiceDetector
+{
+public:
+	VoiceDetector(int _sample_rate);
+	~VoiceDetector();
+	int Hop() const { return hop; }
+	void Reset();
+	bool Process(const float *samples);
+private:
+	int hop;
+	FFT* fft;
+	float* block;
+	float* magnitudes;
+	int first_bin, last_bin;
+	int hangover;
+};
+
+#endif //__VAD_H__
@@ -0,0 +1,192 @@
+/*
+ * Channel kernel tests
+ *
+ * The tiled Deinterleave and Downmix kernels against plain loops over the
+ * interleaved samples, for channel counts on either side of the tile width
+ * and sample counts that leave part tiles.  The kernels convert and scale
+ * each value as the loops do, so the results must match exactly.
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include "check.h"
+#include "engine/channels.h"
+
+static const int test_channels[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 15, 16, 17, 24, 31, 32, 33, 64 };
+static const int test_counts[] = { 0, 1, 3, 7, 8, 9, 15, 16, 17, 100, 1001 };
+
+#define NUM_CHANNELS (int)(sizeof(test_channels) / sizeof(test_channels[0]))
+#define NUM_COUNTS (int)(sizeof(test_counts) / sizeof(test_counts[0]))
+
+// Values that the planes must not be written with past each count.
+#define GUARD 12345.0f
+#define STRIDE_PAD 5
+
+
+// Full range values, including both ends, from a fixed generator.
+static uint32_t Random(uint32_t& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return state >> 8;
+}
+
+
+static std::vector<int16_t> Samples16(int channels, int count)
+{
+	std::vector<int16_t> src((size_t)channels * count);
+	uint32_t state = (uint32_t)(channels * 1000 + count);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = (int16_t)(uint16_t)Random(state);
+	if (!src.empty())
+	{
+		src[0] = -32768;
+		src[src.size() - 1] = 32767;
+	}
+	return src;
+}
+
+
+static std::vector<uint8_t> Samples8(int channels, int count)
+{
+	std::vector<uint8_t> src((size_t)channels * count);
+	uint32_t state = (uint32_t)(channels * 1000 + count);
+	for (size_t i = 0; i < src.size(); i++)
+		src[i] = (uint8_t)Random(state);
+	if (!src.empty())
+	{
+		src[0] = 0;
+		src[src.size() - 1] = 255;
+	}
+	return src;
+}
+
+
+TEST(channels, deinterleave16)
+{
+	const float scale = 1.0f / 32768.0f;
+	for (int a = 0; a < NUM_CHANNELS; a++)
+		for (int b = 0; b < NUM_COUNTS; b++)
+		{
+			const int channels = test_channels[a], count = test_counts[b];
+			const size_t stride = count + STRIDE_PAD;
+			std::vector<int16_t> src = Samples16(channels, count);
+			std::vector<float> planes(channels * stride, GUARD);
+			Deinterleave16(src.data(), channels, count, scale, planes.data(), stride);
+			int mismatches = 0;
+			for (int c = 0; c < channels; c++)
+			{
+				for (int i = 0; i < count; i++)
+					mismatches += planes[c * stride + i] != src[(size_t)i * channels + c] * scale;
+				for (size_t i = count; i < stride; i++)
+					mismatches += planes[c * stride + i] != GUARD;
+			}
+			CHECK(mismatches == 0);
+		}
+}
+
+
+TEST(channels, deinterleave8)
+{
+	const float scale = 1.0f / 128.0f;
+	for (int a = 0; a < NUM_CHANNELS; a++)
+		for (int b = 0; b < NUM_COUNTS; b++)
+		{
+			const int channels = test_channels[a], count = test_counts[b];
+			const size_t stride = count + STRIDE_PAD;
+			std::vector<uint8_t> src = Samples8(channels, count);
+			std::vector<float> planes(channels * stride, GUARD);
+			Deinterleave8(src.data(), channels, count, scale, planes.data(), stride);
+			int mismatches = 0;
+			for (int c = 0; c < channels; c++)
+			{
+				for (int i = 0; i < count; i++)
+					mismatches += planes[c * stride + i] != (src[(size_t)i * channels + c] - 128) * scale;
+				for (size_t i = count; i < stride; i++)
+					mismatches += planes[c * stride + i] != GUARD;
+			}
+			CHECK(mismatches == 0);
+		}
+}
+
+
+TEST(channels, deinterleave_float)
+{
+	for (int a = 0; a < NUM_CHANNELS; a++)
+		for (int b = 0; b < NUM_COUNTS; b++)
+		{
+			const int channels = test_channels[a], count = test_counts[b];
+			const size_t stride = count + STRIDE_PAD;
+			std::vector<int16_t> values = Samples16(channels, count);
+			std::vector<float> src(values.size());
+			for (size_t i = 0; i < values.size(); i++)
+				src[i] = values[i] / 32768.0f;
+			std::vector<float> planes(channels * stride, GUARD);
+			DeinterleaveFloat(src.data(), channels, count, planes.data(), stride);
+			int mismatches = 0;
+			for (int c = 0; c < channels; c++)
+			{
+				for (int i = 0; i < count; i++)
+					mismatches += planes[c * stride + i] != src[(size_t)i * channels + c];
+				for (size_t i = count; i < stride; i++)
+					mismatches += planes[c * stride + i] != GUARD;
+			}
+			CHECK(mismatches == 0);
+		}
+}
+
+
+TEST(channels, downmix16)
+{
+	for (int a = 0; a < NUM_CHANNELS; a++)
+		for (int b = 0; b < NUM_COUNTS; b++)
+		{
+			const int channels = test_channels[a], count = test_counts[b];
+			const float scale = 1.0f / (32768.0f * channels);
+			std::vector<int16_t> src = Samples16(channels, count);
+			std::vector<float> mono(count + STRIDE_PAD, GUARD);
+			Downmix16(src.data(), channels, count, scale, mono.data());
+			int mismatches = 0;
+			for (int i = 0; i < count; i++)
+			{
+				int sum = 0;
+				for (int c = 0; c < channels; c++)
+					sum += src[(size_t)i * channels + c];
+				mismatches += mono[i] != sum * scale;
+			}
+			for (int i = count; i < count + STRIDE_PAD; i++)
+				mismatches += mono[i] != GUARD;
+			CHECK(mismatches == 0);
+		}
+
+	// Every channel at full scale must not wrap in the sum.
+	std::vector<int16_t> loud(64 * 16, 32767);
+	std::vector<float> mono(16);
+	Downmix16(loud.data(), 64, 16, 1.0f, mono.data());
+	CHECK(mono[0] == 64.0f * 32767.0f && mono[15] == 64.0f * 32767.0f);
+}
+
+
+TEST(channels, downmix8)
+{
+	for (int a = 0; a < NUM_CHANNELS; a++)
+		for (int b = 0; b < NUM_COUNTS; b++)
+		{
+			const int channels = test_channels[a], count = test_counts[b];
+			const float scale = 1.0f / (128.0f * channels);
+			std::vector<uint8_t> src = Samples8(channels, count);
+			std::vector<float> mono(count + STRIDE_PAD, GUARD);
+			Downmix8(src.data(), channels, count, scale, mono.data());
+			int mismatches = 0;
+			for (int i = 0; i < count; i++)
+			{
+				int sum = 0;
+				for (int c = 0; c < channels; c++)
+					sum += src[(size_t)i * channels + c] - 128;
+				mismatches += mono[i] != sum * scale;
+			}
+			for (int i = count; i < count + STRIDE_PAD; i++)
+				mismatches += mono[i] != GUARD;
+			CHECK(mismatches == 0);
+		}
+}
@@ -0,0 +1,35 @@
+/*
+ * Test harness for the AudioGraph engine
+ *
+ * Each TEST registers a function under a suite name; the audiograph-tests
+ * runner runs the tests of the suite named on its command line, so that
+ * CTest reports every suite on its own.  CHECK and CHECK_NEAR report a
+ * failure and carry on, so one run shows every broken expectation.
+ */
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <math.h>
+
+typedef void (*TestFunction)();
+
+struct TestRegistration
+{
+	TestRegistration(const char* suite, const char* name, TestFunction function);
+};
+
+void CheckFailed(const char* file, int line, const char* expression);
+
+#define TEST(suite, name) \
+	static void suite##_##name(); \
+	static TestRegistration suite##_##name##_registration(#suite, #name, suite##_##name); \
+	static void suite##_##name()
+
+#define CHECK(condition) \
+	do { if (!(condition)) CheckFailed(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+	do { if (!(fabs((double)(value) - (double)(expected)) <= (tolerance))) CheckFailed(__FILE__, __LINE__, #value " == " #expected " +- " #tolerance); } while (0)
+
+#endif //__CHECK_H__
@@ -0,0 +1,192 @@
+/*
+ * Dropout detector tests
+ *
+ * Gaps, repeats and steps cut into synthetic audio must be found where they
+ * were made, clean audio must give no events, and the events must not
+ * depend on how the audio is cut into scans.
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+#include "check.h"
+#include "dropouts.h"
+
+#define DROPOUT_TEST_RATE 48000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+// Noise in [-level, level] in every channel, which never repeats itself.
+static std::vector<int16_t> Noise(int channels, int count, int level)
+{
+	std::vector<int16_t> samples((size_t)channels * count);
+	uint32_t state = 12345;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		state = state * 1664525u + 1013904223u;
+		samples[i] = (int16_t)((int)((state >> 8) % (2 * level + 1)) - level);
+	}
+	return samples;
+}
+
+
+static std::vector<DropoutEvent> Scan(const std::vector<int16_t>& samples, int channels)
+{
+	DropoutDetector detector(DROPOUT_TEST_RATE, channels);
+	std::vector<DropoutEvent> events;
+	detector.Scan(samples.data(), (int)(samples.size() / channels), 0, events);
+	return events;
+}
+
+
+static int CountKind(const std::vector<DropoutEvent>& events, int kind)
+{
+	int found = 0;
+	for (size_t i = 0; i < events.size(); i++)
+		found += events[i].kind == kind;
+	return found;
+}
+
+
+TEST(dropouts, zero_gap)
+{
+	const int channels = 2, count = DROPOUT_TEST_RATE;
+	std::vector<int16_t> samples = Noise(channels, count, 8000);
+	std::fill(samples.begin() + 20000 * channels, samples.begin() + 20200 * channels, 0);
+	std::vector<DropoutEvent> events = Scan(samples, channels);
+	CHECK(events.size() == 1);
+	if (events.size() == 1)
+	{
+		CHECK(events[0].kind == DROPOUT_ZEROS);
+		CHECK(events[0].start == 20000);
+		CHECK(events[0].length == 200);
+	}
+}
+
+
+TEST(dropouts, gaps_that_are_not_dropouts)
+{
+	const int channels = 2, count = DROPOUT_TEST_RATE;
+
+	// Too short, too long, and zeros in one channel only.  The cut into the
+	// long gap is still a step.
+	std::vector<int16_t> samples = Noise(channels, count, 8000);
+	std::fill(samples.begin() + 5000 * channels, samples.begin() + (5000 + DROPOUT_MIN_ZEROS - 1) * channels, 0);
+	std::fill(samples.begin() + 10000 * channels, samples.begin() + (10000 + DROPOUT_TEST_RATE / 10 + 1) * channels, 0);
+	for (int i = 30000; i < 30200; i++)
+		samples[(size_t)i * channels] = 0;
+	CHECK(CountKind(Scan(samples, channels), DROPOUT_ZEROS) == 0);
+
+	// Quiet audio either side of the gap: a pause, not a dropout.
+	samples = Noise(channels, count, DROPOUT_EDGE_LEVEL / 2);
+	std::fill(samples.begin() + 20000 * channels, samples.begin() + 20200 * channels, 0);
+	CHECK(Scan(samples, channels).empty());
+
+	// Silence at either end of the scan.
+	samples = Noise(channels, count, 8000);
+	std::fill(samples.begin(), samples.begin() + 200 * channels, 0);
+	std::fill(samples.end() - 200 * channels, samples.end(), 0);
+	CHECK(Scan(samples, channels).empty());
+}
+
+
+TEST(dropouts, repeat)
+{
+	const int channels = 2, count = DROPOUT_TEST_RATE;
+	const int lag = DROPOUT_TEST_RATE / 100;
+	std::vector<int16_t> samples = Noise(channels, count, 8000);
+	std::copy(samples.begin() + (20000 - lag) * channels, samples.begin() + 20000 * channels, samples.begin() + 20000 * channels);
+	std::vector<DropoutEvent> events = Scan(samples, channels);
+	CHECK(events.size() == 1);
+	if (events.size() == 1)
+	{
+		CHECK(events[0].kind == DROPOUT_REPEAT);
+		CHECK(events[0].start == 20000);
+		CHECK(events[0].length == lag);
+	}
+}
+
+
+TEST(dropouts, step)
+{
+	const int channels = 2, count = DROPOUT_TEST_RATE;
+	const int position = 20000 + 17;
+	std::vector<int16_t> samples = Noise(channels, count, 100);
+	for (size_t i = (size_t)position * channels; i < samples.size(); i++)
+		samples[i] += 12000;
+	std::vector<DropoutEvent> events = Scan(samples, channels);
+	CHECK(events.size() == 1);
+	if (events.size() == 1)
+	{
+		CHECK(events[0].kind == DROPOUT_STEP);
+		CHECK(events[0].start == position - position % DROPOUT_STEP_BLOCK);
+		CHECK(events[0].length == DROPOUT_STEP_BLOCK);
+	}
+}
+
+
+// Tones, held values and loud noise are not damage.  The tone is played
+// from a table of one period, so that it repeats exactly.
+TEST(dropouts, clean_audio)
+{
+	const int channels = 2, count = DROPOUT_TEST_RATE, period = DROPOUT_TEST_RATE / 1000;
+	std::vector<int16_t> tone((size_t)channels * count);
+	for (int i = 0; i < count; i++)
+		for (int c = 0; c < channels; c++)
+			tone[(size_t)i * channels + c] = (int16_t)(16000 * sin(2 * M_PI * (i % period) / period + c));
+	CHECK(Scan(tone, channels).empty());
+
+	std::vector<int16_t> held((size_t)channels * count, 3000);
+	CHECK(Scan(held, channels).empty());
+
+	CHECK(Scan(Noise(channels, count, 8000), channels).empty());
+	CHECK(Scan(std::vector<int16_t>((size_t)channels * count, 0), channels).empty());
+}
+
+
+// The same audio cut into scans that overlap by the margin gives the same events.
+TEST(dropouts, scans_agree)
+{
+	const int channels = 3, count = DROPOUT_TEST_RATE * 2;
+	std::vector<int16_t> samples = Noise(channels, count, 8000);
+	std::fill(samples.begin() + 11111 * channels, samples.begin() + 11411 * channels, 0);
+	std::copy(samples.begin() + (40000 - 240) * channels, samples.begin() + 40000 * channels, samples.begin() + 40000 * channels);
+	std::fill(samples.begin() + 47980 * channels, samples.begin() + 48016 * channels, 0);
+	std::copy(samples.begin() + (70000 - 960) * channels, samples.begin() + 70000 * channels, samples.begin() + 70000 * channels);
+	for (int i = 80000; i < count; i++)
+		for (int c = 0; c < channels; c++)
+			samples[(size_t)i * channels + c] = (int16_t)(samples[(size_t)i * channels + c] / 80 + ((i >= 80123) ? 10000 : 0));
+
+	DropoutDetector detector(DROPOUT_TEST_RATE, channels);
+	std::vector<DropoutEvent> whole;
+	detector.Scan(samples.data(), count, 0, whole);
+	CHECK(CountKind(whole, DROPOUT_ZEROS) == 2);
+	CHECK(CountKind(whole, DROPOUT_REPEAT) == 2);
+	CHECK(CountKind(whole, DROPOUT_STEP) == 1);
+
+	const int margin = detector.Margin();
+	const int cuts[] = { 0, 11300, 40100, 48000, 80130, count };
+	std::vector<DropoutEvent> pieces;
+	for (size_t p = 0; p + 1 < sizeof(cuts) / sizeof(cuts[0]); p++)
+	{
+		const int first = std::max(cuts[p] - margin, 0), end = std::min(cuts[p + 1] + margin, count);
+		std::vector<DropoutEvent> events;
+		detector.Scan(&samples[(size_t)first * channels], end - first, first, events);
+		for (size_t i = 0; i < events.size(); i++)
+			if (events[i].start >= cuts[p] && events[i].start < cuts[p + 1])
+				pieces.push_back(events[i]);
+	}
+	CHECK(pieces.size() == whole.size());
+	for (size_t i = 0; i < whole.size(); i++)
+	{
+		bool found = false;
+		for (size_t j = 0; j < pieces.size() && !found; j++)
+			found = pieces[j].start == whole[i].start && pieces[j].length == whole[i].length && pieces[j].kind == whole[i].kind;
+		CHECK(found);
+	}
+}
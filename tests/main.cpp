@@ -0,0 +1,71 @@
+/*
+ * Test runner for the AudioGraph engine
+ *
+ *   audiograph-tests suite
+ *
+ * Runs every test of the suite and exits with 1 if any check failed, or if
+ * the suite has no tests.  Temporary files are written to the current
+ * directory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "check.h"
+
+struct Test
+{
+	const char* suite;
+	const char* name;
+	TestFunction function;
+};
+
+static std::vector<Test>& Tests()
+{
+	static std::vector<Test> tests;
+	return tests;
+}
+
+static int failures = 0;
+
+
+TestRegistration::TestRegistration(const char* suite, const char* name, TestFunction function)
+{
+	Test test = { suite, name, function };
+	Tests().push_back(test);
+}
+
+
+void CheckFailed(const char* file, int line, const char* expression)
+{
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expression);
+	failures++;
+}
+
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: audiograph-tests suite\n");
+		return 2;
+	}
+	int run = 0;
+	for (size_t i = 0; i < Tests().size(); i++)
+	{
+		const Test& test = Tests()[i];
+		if (strcmp(test.suite, argv[1]) != 0)
+			continue;
+		int before = failures;
+		test.function();
+		printf("%s %s.%s\n", (failures == before) ? "ok  " : "FAIL", test.suite, test.name);
+		run++;
+	}
+	if (!run)
+	{
+		fprintf(stderr, "audiograph-tests: no tests in suite \"%s\"\n", argv[1]);
+		return 1;
+	}
+	return (failures) ? 1 : 0;
+}
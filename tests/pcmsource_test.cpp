@@ -0,0 +1,221 @@
+/*
+ * WAV parsing tests
+ *
+ * PcmSource::OpenWav must step over chunks it does not know, including
+ * those of odd size with their pad byte, cut a data chunk that runs past
+ * the end of the file to the whole samples present, and refuse files it
+ * cannot read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "engine/pcmsource.h"
+
+#define WAV_TEST_FILE "pcmsource_test.wav"
+
+
+static void Put16(std::vector<uint8_t>& out, uint32_t value)
+{
+	out.push_back((uint8_t)value);
+	out.push_back((uint8_t)(value >> 8));
+}
+
+
+static void Put32(std::vector<uint8_t>& out, uint32_t value)
+{
+	Put16(out, value & 0xFFFF);
+	Put16(out, value >> 16);
+}
+
+
+/*
+ * Chunk
+ *
+ * Append a chunk with the given size field; the body is padded to an even
+ * length unless pad is false.
+ */
+static void Chunk(std::vector<uint8_t>& out, const char* id, uint32_t size, const std::vector<uint8_t>& body, bool pad = true)
+{
+	out.insert(out.end(), id, id + 4);
+	Put32(out, size);
+	out.insert(out.end(), body.begin(), body.end());
+	if (pad && (body.size() & 1))
+		out.push_back(0);
+}
+
+
+static std::vector<uint8_t> FormatBody(int tag, int channels, int rate, int bits)
+{
+	std::vector<uint8_t> body;
+	Put16(body, tag);
+	Put16(body, channels);
+	Put32(body, rate);
+	Put32(body, rate * channels * bits / 8);
+	Put16(body, channels * bits / 8);
+	Put16(body, bits);
+	return body;
+}
+
+
+static std::vector<uint8_t> Samples16(int count)
+{
+	std::vector<uint8_t> body;
+	for (int i = 0; i < count; i++)
+		Put16(body, (uint16_t)(i * 37 - 1000));
+	return body;
+}
+
+
+// Wrap the chunks in a RIFF header and write the file.
+static void WriteWav(const std::vector<uint8_t>& chunks)
+{
+	std::vector<uint8_t> out(chunks.begin(), chunks.end());
+	std::vector<uint8_t> riff;
+	riff.insert(riff.end(), "RIFF", "RIFF" + 4);
+	Put32(riff, (uint32_t)(4 + chunks.size()));
+	riff.insert(riff.end(), "WAVE", "WAVE" + 4);
+	out.insert(out.begin(), riff.begin(), riff.end());
+	FILE* file = fopen(WAV_TEST_FILE, "wb");
+	CHECK(file != NULL);
+	if (!file)
+		return;
+	fwrite(out.data(), 1, out.size(), file);
+	fclose(file);
+}
+
+
+TEST(wav, plain_pcm)
+{
+	std::vector<uint8_t> chunks;
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 2, 44100, 16));
+	std::vector<uint8_t> data = Samples16(200);
+	Chunk(chunks, "data", (uint32_t)data.size(), data);
+	WriteWav(chunks);
+
+	PcmSource source;
+	CHECK(source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Format().sample_rate == 44100);
+	CHECK(source.Format().channels == 2);
+	CHECK(source.Format().bits_per_sample == 16);
+	CHECK(!source.Format().is_float);
+	CHECK(source.Format().num_samples == 100);
+	CHECK(source.Samples() != NULL && memcmp(source.Samples(), data.data(), data.size()) == 0);
+	remove(WAV_TEST_FILE);
+}
+
+
+TEST(wav, odd_size_chunks)
+{
+	// Odd-size chunks before and after fmt, each followed by its pad byte.
+	std::vector<uint8_t> chunks;
+	std::vector<uint8_t> list(3, 'x');
+	Chunk(chunks, "LIST", 3, list);
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 1, 8000, 8));
+	std::vector<uint8_t> junk(5, 0xFF);
+	Chunk(chunks, "junk", 5, junk);
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 101; i++)
+		data.push_back((uint8_t)(i * 3));
+	Chunk(chunks, "data", 101, data);
+	WriteWav(chunks);
+
+	PcmSource source;
+	CHECK(source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Format().sample_rate == 8000);
+	CHECK(source.Format().channels == 1);
+	CHECK(source.Format().bits_per_sample == 8);
+	CHECK(source.Format().num_samples == 101);
+	CHECK(source.Samples() != NULL && memcmp(source.Samples(), data.data(), data.size()) == 0);
+	remove(WAV_TEST_FILE);
+}
+
+
+TEST(wav, extensible_float)
+{
+	std::vector<uint8_t> chunks;
+	std::vector<uint8_t> format = FormatBody(0xFFFE, 2, 48000, 32);
+	Put16(format, 22);
+	Put16(format, 32);
+	Put32(format, 3);
+	Put16(format, 3);
+	format.resize(40, 0);
+	Chunk(chunks, "fmt ", 40, format);
+	std::vector<uint8_t> data(8 * 10, 0);
+	Chunk(chunks, "data", (uint32_t)data.size(), data);
+	WriteWav(chunks);
+
+	PcmSource source;
+	CHECK(source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Format().is_float);
+	CHECK(source.Format().bits_per_sample == 32);
+	CHECK(source.Format().num_samples == 10);
+	remove(WAV_TEST_FILE);
+}
+
+
+TEST(wav, truncated_data)
+{
+	// A recorder that stopped before fixing up the header: the data chunk
+	// claims more than the file holds, and ends in part of a sample.
+	std::vector<uint8_t> chunks;
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 2, 48000, 16));
+	std::vector<uint8_t> data = Samples16(201);
+	data.push_back(0x55);
+	Chunk(chunks, "data", 4000, data, false);
+	WriteWav(chunks);
+
+	PcmSource source;
+	CHECK(source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Format().num_samples == 100);
+	CHECK(source.Samples() != NULL && memcmp(source.Samples(), data.data(), 400) == 0);
+
+	// The same with an unknown chunk that runs past the end before the data.
+	chunks.clear();
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 2, 48000, 16));
+	Chunk(chunks, "junk", 1000, std::vector<uint8_t>(10, 0), false);
+	WriteWav(chunks);
+	CHECK(!source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Samples() == NULL);
+	remove(WAV_TEST_FILE);
+}
+
+
+TEST(wav, bad_files_are_refused)
+{
+	PcmSource source;
+	std::vector<uint8_t> chunks;
+
+	// No data chunk.
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 2, 48000, 16));
+	WriteWav(chunks);
+	CHECK(!source.OpenWav(WAV_TEST_FILE));
+	CHECK(source.Error().find("no data chunk") != std::string::npos);
+
+	// Data before fmt.
+	chunks.clear();
+	Chunk(chunks, "data", 8, Samples16(4));
+	Chunk(chunks, "fmt ", 16, FormatBody(1, 2, 48000, 16));
+	WriteWav(chunks);
+	CHECK(!source.OpenWav(WAV_TEST_FILE));
+
+	// Compressed audio.
+	chunks.clear();
+	Chunk(chunks, "fmt ", 16, FormatBody(2, 2, 48000, 4));
+	Chunk(chunks, "data", 8, Samples16(4));
+	WriteWav(chunks);
+	CHECK(!source.OpenWav(WAV_TEST_FILE));
+
+	// Not RIFF at all.
+	FILE* file = fopen(WAV_TEST_FILE, "wb");
+	fputs("RIFX\0\0\0\0WAVE", file);
+	fclose(file);
+	CHECK(!source.OpenWav(WAV_TEST_FILE));
+	remove(WAV_TEST_FILE);
+
+	CHECK(!source.OpenWav("pcmsource_test_missing.wav"));
+	CHECK(!source.Error().empty());
+}
@@ -0,0 +1,178 @@
+/*
+ * Peak file tests
+ *
+ * A peak index written with WritePeakFile must read back bit for bit, and
+ * a file that is truncated or not a peak file must be refused.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "check.h"
+#include "engine/engine.h"
+#include "engine/peakfile.h"
+
+#define PEAK_TEST_FILE "peakfile_test.agpk"
+
+
+static PcmFormat StereoFormat(int64_t num_samples)
+{
+	PcmFormat format;
+	format.sample_rate = 48000;
+	format.channels = 2;
+	format.bits_per_sample = 16;
+	format.is_float = false;
+	format.num_samples = num_samples;
+	return format;
+}
+
+
+// A ramp in one channel against a square wave in the other.
+static std::vector<int16_t> TestSignal(int64_t num_samples)
+{
+	std::vector<int16_t> pcm((size_t)num_samples * 2);
+	for (int64_t i = 0; i < num_samples; i++)
+	{
+		pcm[(size_t)i * 2] = (int16_t)((i * 97) % 65536 - 32768);
+		pcm[(size_t)i * 2 + 1] = (int16_t)(((i / 300) & 1) ? 12000 : -12000);
+	}
+	return pcm;
+}
+
+
+static PeakPyramid* BuildPeaks(const PcmFormat& format, const std::vector<int16_t>& pcm)
+{
+	PeakIndexBuilder builder(format, PEAK_BLOCK_SIZE);
+	// Feed it in uneven pieces, as a reader would.
+	const uint8_t *bytes = (const uint8_t*)pcm.data();
+	int64_t done = 0;
+	for (int64_t piece = 1000; done < format.num_samples; piece += 777)
+	{
+		int64_t count = (piece < format.num_samples - done) ? piece : format.num_samples - done;
+		builder.Append(bytes + done * format.BytesPerSample(), count);
+		done += count;
+	}
+	return builder.Finish();
+}
+
+
+TEST(peakfile, round_trip)
+{
+	const int64_t num_samples = PEAK_BLOCK_SIZE * 10 + 37;
+	PcmFormat format = StereoFormat(num_samples);
+	std::vector<int16_t> pcm = TestSignal(num_samples);
+	PeakPyramid* peaks = BuildPeaks(format, pcm);
+	CHECK(peaks->Size(0) == 11);
+	CHECK(WritePeakFile(PEAK_TEST_FILE, *peaks, format));
+
+	PeakFileHeader header;
+	std::vector<float> pairs;
+	CHECK(ReadPeakFile(PEAK_TEST_FILE, header, pairs));
+	CHECK(header.version == PEAK_FILE_VERSION);
+	CHECK(header.block_size == PEAK_BLOCK_SIZE);
+	CHECK(header.sample_rate == 48000);
+	CHECK(header.channels == 2);
+	CHECK(header.num_samples == num_samples);
+	CHECK(header.num_blocks == 11);
+	CHECK(pairs.size() == 22);
+	if (pairs.size() == 22)
+		for (int i = 0; i < 11; i++)
+		{
+			CHECK(memcmp(&pairs[i * 2], &peaks->Minimums(0)[i], 4) == 0);
+			CHECK(memcmp(&pairs[i * 2 + 1], &peaks->Maximums(0)[i], 4) == 0);
+		}
+
+	// A pyramid rebuilt from the file matches the one it was written from.
+	PeakPyramid loaded(header.block_size);
+	loaded.AppendBlocks(pairs.data(), header.num_blocks);
+	loaded.Finish();
+	CHECK(loaded.Levels() == peaks->Levels());
+	for (int level = 0; level < loaded.Levels() && level < peaks->Levels(); level++)
+	{
+		CHECK(loaded.Size(level) == peaks->Size(level));
+		if (loaded.Size(level) == peaks->Size(level))
+			for (int i = 0; i < loaded.Size(level); i++)
+			{
+				CHECK(loaded.Minimums(level)[i] == peaks->Minimums(level)[i]);
+				CHECK(loaded.Maximums(level)[i] == peaks->Maximums(level)[i]);
+			}
+	}
+	delete peaks;
+	remove(PEAK_TEST_FILE);
+}
+
+
+TEST(peakfile, levels_match_the_signal)
+{
+	const int64_t num_samples = PEAK_BLOCK_SIZE * 4;
+	PcmFormat format = StereoFormat(num_samples);
+	std::vector<int16_t> pcm((size_t)num_samples * 2, 0);
+	// One full scale pair of samples in the third block only.
+	pcm[PEAK_BLOCK_SIZE * 2 * 2 + 10] = 16384;
+	pcm[PEAK_BLOCK_SIZE * 2 * 2 + 11] = 16384;
+	pcm[PEAK_BLOCK_SIZE * 2 * 2 + 20] = -16384;
+	pcm[PEAK_BLOCK_SIZE * 2 * 2 + 21] = -16384;
+	PeakPyramid* peaks = BuildPeaks(format, pcm);
+	CHECK(peaks->Size(0) == 4);
+	CHECK(peaks->Maximums(0)[0] == 0.0f && peaks->Minimums(0)[0] == 0.0f);
+	CHECK_NEAR(peaks->Maximums(0)[2], 0.5, 1e-6);
+	CHECK_NEAR(peaks->Minimums(0)[2], -0.5, 1e-6);
+	CHECK(peaks->Size(peaks->Levels() - 1) == 1);
+	CHECK_NEAR(peaks->Maximums(peaks->Levels() - 1)[0], 0.5, 1e-6);
+	delete peaks;
+}
+
+
+TEST(peakfile, truncated_file_is_refused)
+{
+	const int64_t num_samples = PEAK_BLOCK_SIZE * 10;
+	PcmFormat format = StereoFormat(num_samples);
+	PeakPyramid* peaks = BuildPeaks(format, TestSignal(num_samples));
+	CHECK(WritePeakFile(PEAK_TEST_FILE, *peaks, format));
+	delete peaks;
+
+	std::vector<uint8_t> contents;
+	FILE* file = fopen(PEAK_TEST_FILE, "rb");
+	CHECK(file != NULL);
+	if (!file)
+		return;
+	uint8_t buffer[4096];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		contents.insert(contents.end(), buffer, buffer + read);
+	fclose(file);
+	CHECK(contents.size() == 40 + 10 * 8);
+
+	// Cut within the pairs, and within the header.
+	const size_t cuts[] = { contents.size() - 1, 40 + 8 * 5, 39, 4, 0 };
+	for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++)
+	{
+		file = fopen(PEAK_TEST_FILE, "wb");
+		fwrite(contents.data(), 1, cuts[i], file);
+		fclose(file);
+		PeakFileHeader header;
+		std::vector<float> pairs;
+		CHECK(!ReadPeakFile(PEAK_TEST_FILE, header, pairs));
+	}
+
+	// Not a peak file, and a block count that does not match the samples.
+	std::vector<uint8_t> bad = contents;
+	memcpy(bad.data(), "RIFF", 4);
+	file = fopen(PEAK_TEST_FILE, "wb");
+	fwrite(bad.data(), 1, bad.size(), file);
+	fclose(file);
+	PeakFileHeader header;
+	std::vector<float> pairs;
+	CHECK(!ReadPeakFile(PEAK_TEST_FILE, header, pairs));
+
+	bad = contents;
+	bad[32] = 9;
+	file = fopen(PEAK_TEST_FILE, "wb");
+	fwrite(bad.data(), 1, bad.size(), file);
+	fclose(file);
+	CHECK(!ReadPeakFile(PEAK_TEST_FILE, header, pairs));
+
+	CHECK(!ReadPeakFile("peakfile_test_missing.agpk", header, pairs));
+	remove(PEAK_TEST_FILE);
+}
@@ -0,0 +1,225 @@
+/*
+ * QC meter tests
+ *
+ * Loudness, loudness range and true peak against the reference signals of
+ * EBU Tech 3341 and Tech 3342, which a BS.1770 meter must read within the
+ * tolerances given there, and the simpler totals against signals whose
+ * answer is known.
+ */
+
+#include <math.h>
+#include <vector>
+
+#include "check.h"
+#include "engine/channels.h"
+#include "engine/qc.h"
+
+#define QC_TEST_RATE 48000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/*
+ * Signal
+ *
+ * Interleaved audio built up a stretch at a time, and split into channel
+ * planes to measure.
+ */
+struct Signal
+{
+	int channels;
+	std::vector<float> samples;
+
+	Signal(int _channels) : channels(_channels) { }
+	int Length() const { return (int)(samples.size() / channels); }
+
+	// A sine of the given peak level in dBFS in the channels of mask.
+	void Sine(double seconds, double frequency, double level_db, unsigned mask, double phase = 0.0)
+	{
+		const int start = Length(), count = (int)(seconds * QC_TEST_RATE);
+		const double amplitude = pow(10.0, level_db / 20.0);
+		samples.resize(samples.size() + (size_t)count * channels, 0.0f);
+		for (int i = 0; i < count; i++)
+		{
+			float value = (float)(amplitude * sin(2.0 * M_PI * frequency * i / QC_TEST_RATE + phase));
+			for (int channel = 0; channel < channels; channel++)
+				if (mask & (1u << channel))
+					samples[(size_t)(start + i) * channels + channel] = value;
+		}
+	}
+
+	void Constant(double seconds, float value)
+	{
+		samples.resize(samples.size() + (size_t)(seconds * QC_TEST_RATE) * channels, value);
+	}
+};
+
+
+/*
+ * Measure
+ *
+ * Measure the signal in runs of whole blocks, each on its own meter
+ * settled on the block before it, as AudioQC does on several threads.
+ */
+static QcReport Measure(const Signal& signal, int runs = 1, float clip_level = 1.0f)
+{
+	const int count = signal.Length();
+	std::vector<float> planes((size_t)count * signal.channels);
+	DeinterleaveFloat(signal.samples.data(), signal.channels, count, planes.data(), count);
+
+	QcMeter meter(QC_TEST_RATE, signal.channels, -60.0, clip_level);
+	const int block = meter.BlockSize();
+	const int num_blocks = count / block;
+	std::vector<double> blocks((size_t)num_blocks + 1);
+	std::vector<QcMeter> meters(runs, meter);
+	const int run_blocks = (num_blocks + runs - 1) / runs;
+	for (int run = 0; run < runs; run++)
+	{
+		const int start = run * run_blocks * block;
+		if (start >= count)
+			break;
+		const int length = (run == runs - 1 || start + run_blocks * block > count) ? count - start : run_blocks * block;
+		if (start)
+		{
+			meters[run].Restart();
+			meters[run].Settle(planes.data() + start - block, count, block);
+		}
+		meters[run].Measure(planes.data() + start, count, length, &blocks[start / block]);
+	}
+	for (int run = 1; run < runs; run++)
+		meters[0].Merge(meters[run]);
+	return meters[0].Summarise(blocks.data(), num_blocks);
+}
+
+
+TEST(qc, block_size)
+{
+	QcMeter meter(QC_TEST_RATE, 2, -60.0, 1.0f);
+	CHECK(meter.BlockSize() == QC_TEST_RATE / QC_BLOCK_RATE);
+}
+
+
+// Tech 3341 cases 1 and 2: a stereo 1 kHz sine reads at its own level.
+TEST(qc, integrated_stereo_sine)
+{
+	Signal loud(2);
+	loud.Sine(20.0, 1000.0, -23.0, 3);
+	CHECK_NEAR(Measure(loud).integrated, -23.0, 0.1);
+
+	Signal quiet(2);
+	quiet.Sine(20.0, 1000.0, -33.0, 3);
+	CHECK_NEAR(Measure(quiet).integrated, -33.0, 0.1);
+}
+
+
+// Tech 3341 case 3: the relative gate leaves out the quiet start and end.
+TEST(qc, integrated_relative_gate)
+{
+	Signal signal(2);
+	signal.Sine(10.0, 1000.0, -36.0, 3);
+	signal.Sine(60.0, 1000.0, -23.0, 3);
+	signal.Sine(10.0, 1000.0, -36.0, 3);
+	CHECK_NEAR(Measure(signal).integrated, -23.0, 0.1);
+}
+
+
+// Tech 3341 case 5 in part: silence is left out by the absolute gate.
+TEST(qc, integrated_absolute_gate)
+{
+	Signal signal(2);
+	signal.Constant(10.0, 0.0f);
+	signal.Sine(20.0, 1000.0, -23.0, 3);
+	signal.Constant(10.0, 0.0f);
+	const QcReport report = Measure(signal);
+	CHECK_NEAR(report.integrated, -23.0, 0.1);
+	CHECK_NEAR(report.silence, 50.0, 0.5);
+
+	Signal silence(2);
+	silence.Constant(5.0, 0.0f);
+	CHECK(Measure(silence).integrated == -HUGE_VAL);
+	CHECK(Measure(silence).true_peak == -HUGE_VAL);
+}
+
+
+// 5.1 weights: the surrounds weigh 1.41, and the LFE is left out.
+TEST(qc, channel_weights)
+{
+	Signal front(6);
+	front.Sine(10.0, 1000.0, -23.0, 1 << 0);
+	Signal surround(6);
+	surround.Sine(10.0, 1000.0, -23.0, 1 << 4);
+	Signal lfe(6);
+	lfe.Sine(10.0, 1000.0, -23.0, 1 << 3);
+	const double front_loudness = Measure(front).integrated;
+	CHECK_NEAR(Measure(surround).integrated - front_loudness, 10.0 * log10(1.41), 0.01);
+	CHECK(Measure(lfe).integrated == -HUGE_VAL);
+}
+
+
+// Tech 3342 cases 1 and 2: 20 s at one level then 20 s at another.
+TEST(qc, loudness_range)
+{
+	Signal ten(2);
+	ten.Sine(20.0, 1000.0, -20.0, 3);
+	ten.Sine(20.0, 1000.0, -30.0, 3);
+	CHECK_NEAR(Measure(ten).range, 10.0, 1.0);
+
+	Signal five(2);
+	five.Sine(20.0, 1000.0, -20.0, 3);
+	five.Sine(20.0, 1000.0, -15.0, 3);
+	CHECK_NEAR(Measure(five).range, 5.0, 1.0);
+
+	Signal steady(2);
+	steady.Sine(20.0, 1000.0, -20.0, 3);
+	CHECK_NEAR(Measure(steady).range, 0.0, 0.1);
+}
+
+
+// Tech 3341 case 15: fs/4 at 45 degrees peaks between the samples.
+TEST(qc, true_peak)
+{
+	Signal signal(2);
+	signal.Sine(2.0, QC_TEST_RATE / 4.0, -6.0, 3, M_PI / 4.0);
+	const QcReport report = Measure(signal);
+	CHECK(report.true_peak >= -6.4 && report.true_peak <= -5.8);
+	// The samples themselves only reach 3 dB lower.
+	CHECK(report.true_peak > -6.0 + 20.0 * log10(sqrt(0.5)) + 1.0);
+}
+
+
+TEST(qc, dc_offset_and_clipping)
+{
+	Signal signal(2);
+	signal.Sine(5.0, 1000.0, -12.0, 1);
+	for (int i = 0; i < signal.Length(); i++)
+		signal.samples[(size_t)i * 2 + 1] = 0.01f;
+	signal.samples[1000 * 2] = 1.0f;
+	signal.samples[2000 * 2] = -1.0f;
+	signal.samples[3000 * 2] = 0.95f;
+	const QcReport report = Measure(signal);
+	CHECK_NEAR(report.dc_offset, 0.01, 1e-4);
+	CHECK(report.clipped == 2);
+	CHECK(Measure(signal, 1, 0.9f).clipped == 3);
+	CHECK(report.silence == 0.0);
+}
+
+
+// Runs measured on separate meters add up to the clip measured in one go.
+TEST(qc, runs_merge)
+{
+	Signal signal(2);
+	signal.Sine(10.0, 1000.0, -30.0, 3);
+	signal.Sine(10.0, 440.0, -20.0, 1);
+	signal.Sine(10.0, 3000.0, -25.0, 2);
+	signal.Constant(0.05, 0.0f);
+	const QcReport whole = Measure(signal);
+	const QcReport split = Measure(signal, 4);
+	CHECK_NEAR(split.integrated, whole.integrated, 0.01);
+	CHECK_NEAR(split.range, whole.range, 0.01);
+	CHECK_NEAR(split.true_peak, whole.true_peak, 0.01);
+	CHECK_NEAR(split.dc_offset, whole.dc_offset, 1e-9);
+	CHECK(split.clipped == whole.clipped);
+	CHECK(split.silence == whole.silence);
+}
@@ -0,0 +1,96 @@
+/*
+ * audiograph-peaks
+ *
+ * Build the peak file of a WAV or raw PCM file, in the format the
+ * AudioGraph plugin reads through its peaks_file parameter, without a script
+ * host.
+ *
+ *   audiograph-peaks [-r rate,channels,bits[f]] [-b block_size] input [output]
+ *
+ * -r reads the input as headerless interleaved PCM of the given layout (an f
+ * after the bits for float).  The output defaults to the input name with
+ * ".peaks" added.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "engine/engine.h"
+#include "engine/pcmsource.h"
+#include "engine/peakfile.h"
+
+
+static int Usage()
+{
+	fprintf(stderr, "usage: audiograph-peaks [-r rate,channels,bits[f]] [-b block_size] input [output]\n");
+	return 2;
+}
+
+
+static bool ParseRawFormat(const char* text, PcmFormat& format)
+{
+	char suffix[2] = { 0 };
+	memset(&format, 0, sizeof(format));
+	int fields = sscanf(text, "%d,%d,%d%1s", &format.sample_rate, &format.channels, &format.bits_per_sample, suffix);
+	if (fields == 4 && strcmp(suffix, "f") != 0)
+		return false;
+	format.is_float = (fields == 4);
+	return fields >= 3 && format.Valid();
+}
+
+
+int main(int argc, char** argv)
+{
+	PcmFormat raw_format;
+	bool raw = false;
+	int block_size = PEAK_BLOCK_SIZE;
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-' && argv[arg][1]; arg++)
+	{
+		if (!strcmp(argv[arg], "-r") && arg + 1 < argc)
+		{
+			if (!ParseRawFormat(argv[++arg], raw_format))
+			{
+				fprintf(stderr, "audiograph-peaks: bad raw format \"%s\"\n", argv[arg]);
+				return 2;
+			}
+			raw = true;
+		}
+		else if (!strcmp(argv[arg], "-b") && arg + 1 < argc)
+		{
+			block_size = atoi(argv[++arg]);
+			if (block_size <= 0)
+			{
+				fprintf(stderr, "audiograph-peaks: block_size must be positive\n");
+				return 2;
+			}
+		}
+		else
+			return Usage();
+	}
+	if (argc - arg < 1 || argc - arg > 2)
+		return Usage();
+	const char* input = argv[arg];
+	std::string output = (argc - arg == 2) ? argv[arg + 1] : std::string(input) + ".peaks";
+
+	PcmSource source;
+	if (!(raw ? source.OpenRaw(input, raw_format) : source.OpenWav(input)))
+	{
+		fprintf(stderr, "audiograph-peaks: %s\n", source.Error().c_str());
+		return 1;
+	}
+	const PcmFormat& format = source.Format();
+	PeakIndexBuilder builder(format, block_size);
+	builder.Append(source.Samples(), format.num_samples);
+	PeakPyramid* peaks = builder.Finish();
+	bool ok = WritePeakFile(output.c_str(), *peaks, format);
+	delete peaks;
+	if (!ok)
+	{
+		fprintf(stderr, "audiograph-peaks: cannot write \"%s\"\n", output.c_str());
+		return 1;
+	}
+	return 0;
+}